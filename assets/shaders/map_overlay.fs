@@ -7,10 +7,19 @@ in vec3 fragPosition;
 out vec4 finalColor;
 
 uniform sampler2D texture0;       // base diffuse (color map)
-uniform sampler2D politicalMap;   // overlay from MapEngine
+uniform sampler2D stateIndexMap;  // state index overlay from MapEngine (index + 1 packed in RGB, 0 = no state)
+uniform sampler2D statePalette;   // per-state color of the active map mode
+uniform sampler2D stateFlags;     // per-state flags (r = selected, g = hovered)
 uniform float overlayMix;         // 0..1
 uniform vec4 worldMinMax;         // (minX, maxX, minZ, maxZ)
 
+// Border distance field
+uniform sampler2D borderField;    // distance to nearest border, normalized to borderParams.x
+uniform vec2 borderParams;        // (max distance, border half width), both in overlay pixels
+
+// Baked terrain lighting, lines up with the terrain texture coordinates
+uniform sampler2D lightMap;       // r = ambient occlusion, a = sun visibility
+
 // Lighting uniforms
 uniform vec3 lightDir;            // world-space direction TO light (normalized)
 uniform vec3 lightColor;          // e.g., (1,1,1)
@@ -24,18 +33,46 @@ void main()
     float v = (fragPosition.z - worldMinMax.z) / (worldMinMax.w - worldMinMax.z);
     vec2 overlayUV = vec2(u, 1.0 - v); // if upside-down, change to vec2(u, v)
 
-    vec4 pol = texture(politicalMap, overlayUV);
+    // The overlay is off (overlayMix = 0) while the states are draped as geometry instead
+    vec3 albedo = base.rgb;
+    if (overlayMix > 0.0)
+    {
+        // Decode the state under this fragment and look up its layers
+        ivec3 packed = ivec3(texture(stateIndexMap, overlayUV).rgb * 255.0 + 0.5);
+        int stateIndex = packed.r | (packed.g << 8) | (packed.b << 16);
+
+        ivec2 layerSize = textureSize(statePalette, 0);
+        ivec2 layerCoord = ivec2(stateIndex % layerSize.x, stateIndex / layerSize.x);
+
+        vec4 pol = texelFetch(statePalette, layerCoord, 0);
+        vec4 flags = texelFetch(stateFlags, layerCoord, 0);
 
-    // Alpha-driven blend so transparent overlay leaves base intact
-    float a = pol.a * overlayMix;
-    vec3 albedo = mix(base.rgb, pol.rgb, a);
+        // Selection and hover are composited on top of the political color
+        pol = mix(pol, vec4(1.0, 1.0, 0.0, 1.0), flags.r * 0.75);
+        pol.rgb = mix(pol.rgb, vec3(1.0), flags.g * 0.3);
+
+        // Alpha-driven blend so transparent overlay leaves base intact
+        float a = pol.a * overlayMix;
+        albedo = mix(base.rgb, pol.rgb, a);
+
+        // Borders from the distance field, antialiased over one screen pixel
+        float d = texture(borderField, overlayUV).r * borderParams.x;
+        float w = fwidth(d);
+        float border = 1.0 - smoothstep(borderParams.y - w, borderParams.y + w, d);
+        border *= min(1.0, borderParams.y / max(w, 1e-4)); // fade out instead of aliasing when zoomed far out
+        albedo = mix(albedo, vec3(1.0), border * overlayMix);
+    }
 
     // Simple Lambert lighting
     vec3 N = normalize(fragNormal);
     vec3 L = normalize(lightDir);
-	
-	float diff = max(dot(N, L), 0.0);
-	vec3 lighting = ambient + diff * lightColor;
-	lighting = max(lighting, vec3(ambient)); // clamp floor
-	finalColor = vec4(albedo * lighting, 1.0);
+
+    vec4 baked = texture(lightMap, fragTexCoord);
+    float occlusion = baked.r;
+    float sun = baked.a;
+
+    float diff = max(dot(N, L), 0.0) * sun;
+    vec3 lighting = ambient * occlusion + diff * lightColor * mix(1.0, occlusion, 0.5);
+    lighting = max(lighting, vec3(ambient * occlusion)); // clamp floor
+    finalColor = vec4(albedo * lighting, 1.0);
 }
\ No newline at end of file
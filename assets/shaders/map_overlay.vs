@@ -6,13 +6,98 @@ in vec3 vertexNormal;
 
 uniform mat4 mvp;
 uniform mat4 matModel;
+uniform mat4 matView;
+uniform mat4 matProjection;
+
+// Displaced terrain, a flat grid lifted to the heightmap
+uniform int terrainDisplace;      // 1 = displace, 0 = the mesh already carries the heights
+uniform sampler2D heightMap;      // heightmap texture (gray value = height)
+uniform vec4 terrainSize;         // (sizeX, sizeY, sizeZ, base skirt depth)
+uniform vec2 heightMapSize;       // heightmap size in samples
+uniform vec3 terrainOrigin;       // world position of the terrain corner
+uniform float lodStep;            // heightmap samples between grid vertices
+
+// Streamed detail heights around the camera (terrain_streamer.hpp), used instead of the heightmap where loaded
+uniform sampler2D detailHeights;  // world heights, wrapped around (sample x, z in texel x % size, z % size)
+uniform vec4 detailWindow;        // streamed samples in the texture (first x, first z, last x, last z), empty when last < first
+uniform vec2 detailSpacing;       // world distance between streamed samples
+uniform float detailSlots[64];    // per texture slot, row by row: 1 = holds streamed heights, 0 = not copied yet
+uniform int detailSlotSize;       // texels per slot side
 
 out vec2 fragTexCoord;
 out vec3 fragNormal;
 out vec3 fragPosition;
 
+// Streamed height of sample p, < 0 while its slot doesn't hold it
+float detailTexel(ivec2 p, ivec2 size)
+{
+    ivec2 texel = ivec2(p.x % size.x, p.y % size.y);
+    ivec2 slot = texel / detailSlotSize;
+    if (detailSlots[slot.y * (size.x / detailSlotSize) + slot.x] < 0.5) return -1.0;
+
+    return texelFetch(detailHeights, texel, 0).r;
+}
+
+// Streamed height at a terrain local position, bilinear by hand over the wrapped texels. False outside the window
+// and where one of the 4 samples is not loaded.
+bool detailHeightAt(vec2 local, out float height)
+{
+    if (detailWindow.z < detailWindow.x) return false;
+
+    vec2 detailPos = local / detailSpacing;
+    if (any(lessThan(detailPos, detailWindow.xy)) || any(greaterThanEqual(detailPos, detailWindow.zw))) return false;
+
+    ivec2 size = textureSize(detailHeights, 0);
+    ivec2 p0 = ivec2(floor(detailPos));
+    ivec2 p1 = p0 + 1;
+    vec2 f = detailPos - vec2(p0);
+
+    float h00 = detailTexel(p0, size);
+    float h10 = detailTexel(ivec2(p1.x, p0.y), size);
+    float h01 = detailTexel(ivec2(p0.x, p1.y), size);
+    float h11 = detailTexel(p1, size);
+    if (min(min(h00, h10), min(h01, h11)) < 0.0) return false;
+
+    height = mix(mix(h00, h10, f.x), mix(h01, h11, f.x), f.y);
+    return true;
+}
+
+// Height at a position given in heightmap samples, sampled at texel centers
+float heightAt(vec2 samplePos)
+{
+    float detail;
+    if (detailHeightAt(samplePos / (heightMapSize - 1.0) * terrainSize.xz, detail)) return detail;
+
+    vec2 uv = (samplePos + 0.5) / heightMapSize;
+    return textureLod(heightMap, uv, 0.0).r * terrainSize.y;
+}
+
 void main()
 {
+    if (terrainDisplace == 1)
+    {
+        vec3 world = (matModel * vec4(vertexPosition.x, 0.0, vertexPosition.z, 1.0)).xyz;
+        vec2 local = world.xz - terrainOrigin.xz;
+        vec2 samplePos = local / terrainSize.xz * (heightMapSize - 1.0);
+
+        vec2 texelWorld = terrainSize.xz / (heightMapSize - 1.0);
+
+        // Skirt vertices are marked with y = -1
+        float skirt = -min(vertexPosition.y, 0.0);
+        world.y = terrainOrigin.y + heightAt(samplePos) - skirt * (terrainSize.w + texelWorld.x * lodStep);
+
+        // Central differences over one grid step
+        float dx = heightAt(samplePos - vec2(lodStep, 0.0)) - heightAt(samplePos + vec2(lodStep, 0.0));
+        float dz = heightAt(samplePos - vec2(0.0, lodStep)) - heightAt(samplePos + vec2(0.0, lodStep));
+        vec3 normal = normalize(vec3(dx / (2.0 * lodStep * texelWorld.x), 1.0, dz / (2.0 * lodStep * texelWorld.y)));
+
+        fragTexCoord = local / terrainSize.xz;
+        fragNormal   = normal;
+        fragPosition = world;
+        gl_Position  = matProjection * matView * vec4(world, 1.0);
+        return;
+    }
+
     fragTexCoord = vertexTexCoord;
     fragNormal   = normalize((matModel * vec4(vertexNormal, 0.0)).xyz);
     fragPosition = (matModel * vec4(vertexPosition, 1.0)).xyz;
@@ -0,0 +1,34 @@
+#version 330
+
+in float fragSide;
+in float fragFade;
+in vec3 fragNormal;
+in vec3 fragPosition;
+
+out vec4 finalColor;
+
+uniform float overlayMix;         // 0..1
+uniform vec4 worldMinMax;         // (minX, maxX, minZ, maxZ)
+uniform vec2 borderParams;        // (half width in pixels, half width in world units)
+
+// Same lighting as the terrain underneath, see map_overlay.fs
+uniform sampler2D lightMap;
+uniform vec3 lightDir;
+uniform vec3 lightColor;
+uniform float ambient;
+
+void main()
+{
+    float coverage = 1.0 - smoothstep(borderParams.x - 0.5, borderParams.x + 0.5, abs(fragSide));
+
+    vec2 terrainUV = vec2((fragPosition.x - worldMinMax.x) / (worldMinMax.y - worldMinMax.x),
+                          (fragPosition.z - worldMinMax.z) / (worldMinMax.w - worldMinMax.z));
+    vec4 baked = texture(lightMap, terrainUV);
+    float occlusion = baked.r;
+
+    float diff = max(dot(normalize(fragNormal), normalize(lightDir)), 0.0) * baked.a;
+    vec3 lighting = ambient * occlusion + diff * lightColor * mix(1.0, occlusion, 0.5);
+    lighting = max(lighting, vec3(ambient * occlusion));
+
+    finalColor = vec4(lighting, coverage * fragFade * overlayMix);
+}
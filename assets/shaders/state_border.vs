@@ -0,0 +1,53 @@
+#version 330
+
+in vec3 vertexPosition;
+in vec3 vertexNormal;
+in vec4 vertexTangent;            // xyz = other end of the segment, w = side (+-1)
+
+uniform mat4 matModel;
+uniform mat4 matView;
+uniform mat4 matProjection;
+
+uniform vec3 cameraPosition;
+uniform float drapeBias;
+uniform vec2 viewportSize;        // pixels
+uniform vec2 borderParams;        // (half width in pixels, half width in world units for fading out)
+
+out float fragSide;               // pixels from the center line
+out float fragFade;
+out vec3 fragNormal;
+out vec3 fragPosition;
+
+vec4 project(vec3 local)
+{
+    vec3 world = (matModel * vec4(local, 1.0)).xyz;
+    world += (cameraPosition - world) * drapeBias;
+    return matProjection * matView * vec4(world, 1.0);
+}
+
+void main()
+{
+    vec4 self = project(vertexPosition);
+    vec4 other = project(vertexTangent.xyz);
+
+    // Segment direction on screen, the other end may be behind the camera
+    vec2 a = self.xy / self.w * viewportSize;
+    vec2 b = other.xy / max(other.w, 1e-4) * viewportSize;
+    vec2 dir = b - a;
+    dir = dot(dir, dir) > 1e-8 ? normalize(dir) : vec2(1.0, 0.0);
+    vec2 perp = vec2(-dir.y, dir.x);
+
+    // One extra pixel for antialiasing, and the ends reach past the joints so corners have no gaps
+    float extent = borderParams.x + 1.0;
+    vec2 offset = perp * vertexTangent.w * extent - dir * borderParams.x;
+    self.xy += offset * 2.0 / viewportSize * self.w;
+
+    // World size of a pixel here, borders fade out once they are thinner than their world width
+    float pixelWorld = self.w / (viewportSize.y * 0.5 * matProjection[1][1]);
+
+    fragSide     = vertexTangent.w * extent;
+    fragFade     = min(1.0, borderParams.y / pixelWorld);
+    fragNormal   = normalize(vertexNormal);
+    fragPosition = (matModel * vec4(vertexPosition, 1.0)).xyz;
+    gl_Position  = self;
+}
@@ -0,0 +1,42 @@
+#version 330
+
+flat in int fragState;
+in vec3 fragNormal;
+in vec3 fragPosition;
+
+out vec4 finalColor;
+
+uniform sampler2D statePalette;   // per-state color of the active map mode
+uniform sampler2D stateFlags;     // per-state flags (r = selected, g = hovered)
+uniform float overlayMix;         // 0..1
+uniform vec4 worldMinMax;         // (minX, maxX, minZ, maxZ)
+
+// Same lighting as the terrain underneath, see map_overlay.fs
+uniform sampler2D lightMap;       // r = ambient occlusion, a = sun visibility
+uniform vec3 lightDir;
+uniform vec3 lightColor;
+uniform float ambient;
+
+void main()
+{
+    ivec2 layerSize = textureSize(statePalette, 0);
+    ivec2 layerCoord = ivec2(fragState % layerSize.x, fragState / layerSize.x);
+
+    vec4 pol = texelFetch(statePalette, layerCoord, 0);
+    vec4 flags = texelFetch(stateFlags, layerCoord, 0);
+
+    pol = mix(pol, vec4(1.0, 1.0, 0.0, 1.0), flags.r * 0.75);
+    pol.rgb = mix(pol.rgb, vec3(1.0), flags.g * 0.3);
+
+    vec2 terrainUV = vec2((fragPosition.x - worldMinMax.x) / (worldMinMax.y - worldMinMax.x),
+                          (fragPosition.z - worldMinMax.z) / (worldMinMax.w - worldMinMax.z));
+    vec4 baked = texture(lightMap, terrainUV);
+    float occlusion = baked.r;
+
+    float diff = max(dot(normalize(fragNormal), normalize(lightDir)), 0.0) * baked.a;
+    vec3 lighting = ambient * occlusion + diff * lightColor * mix(1.0, occlusion, 0.5);
+    lighting = max(lighting, vec3(ambient * occlusion));
+
+    // Blended over the lit terrain, which gives the same result as mixing before lighting
+    finalColor = vec4(pol.rgb * lighting, pol.a * overlayMix);
+}
@@ -0,0 +1,28 @@
+#version 330
+
+in vec3 vertexPosition;
+in vec2 vertexTexCoord;           // x = palette entry of the state
+in vec3 vertexNormal;
+
+uniform mat4 matModel;
+uniform mat4 matView;
+uniform mat4 matProjection;
+
+// Pulls the drape towards the camera, a fraction of the view distance, so it stays on top of the terrain LODs
+uniform vec3 cameraPosition;
+uniform float drapeBias;
+
+flat out int fragState;
+out vec3 fragNormal;
+out vec3 fragPosition;
+
+void main()
+{
+    vec3 world = (matModel * vec4(vertexPosition, 1.0)).xyz;
+    vec3 biased = world + (cameraPosition - world) * drapeBias;
+
+    fragState    = int(vertexTexCoord.x + 0.5);
+    fragNormal   = normalize(vertexNormal);
+    fragPosition = world;
+    gl_Position  = matProjection * matView * vec4(biased, 1.0);
+}
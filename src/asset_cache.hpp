@@ -0,0 +1,235 @@
+#ifndef ARPADICA_ASSETCACHE_H
+#define ARPADICA_ASSETCACHE_H
+
+#include "raylib.h"
+#include "map_cache.hpp"
+#include "heightfield.hpp"
+#include "block_compress.hpp"
+#include "trace.hpp"
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#define ASSETCACHE_ERR "Arpadica::AssetCache::Error: "
+
+static constexpr uint32_t ASSET_CACHE_VERSION = 3;
+
+// rlgl has no way to cap the mip chain of a texture. Both are GL 1.1 and exported by opengl32 / libGL, which
+// raylib links anyway, declaring them here spares us the GL headers and windows.h that come with them.
+#if defined(_WIN32)
+	extern "C" __declspec(dllimport) void __stdcall glBindTexture(unsigned int target, unsigned int texture);
+	extern "C" __declspec(dllimport) void __stdcall glTexParameteri(unsigned int target, unsigned int pname, int param);
+#else
+	extern "C" void glBindTexture(unsigned int target, unsigned int texture);
+	extern "C" void glTexParameteri(unsigned int target, unsigned int pname, int param);
+#endif
+
+#define ASSETCACHE_GL_TEXTURE_2D 0x0DE1
+#define ASSETCACHE_GL_TEXTURE_MAX_LEVEL 0x813D
+
+// Decoded assets kept in the map cache, so a launch with unchanged sources skips JPEG decoding and preprocessing.
+// Entries are keyed by the hash of their source file and opened memory mapped, textures are uploaded straight from
+// the mapping without an intermediate copy.
+class AssetCache
+{
+	private:
+		// Leads every image entry, followed by the pixel data of all mip levels
+		struct ImageHeader
+		{
+			int32_t width, height, mipmaps, format;
+		};
+
+		// Leads every heightfield entry, followed by the samples in tile order
+		struct HeightfieldHeader
+		{
+			int32_t width, height;
+			Vector3 size;
+		};
+
+		const MapCache& cache;
+
+		// Cache entry name of a derived asset, "./assets/maps/colormap.jpg" -> "colormap.jpg.texture"
+		static string entryName(const string& path, const char *kind)
+		{
+			size_t slash = path.find_last_of("/\\");
+			return (slash == string::npos ? path : path.substr(slash + 1)) + "." + kind;
+		}
+
+		static bool isBlockCompressed(int format)
+		{
+			return format == PIXELFORMAT_COMPRESSED_DXT1_RGB || format == PIXELFORMAT_COMPRESSED_DXT5_RGBA;
+		}
+
+		// Bytes of pixel data of an image including its mip chain
+		static size_t imageDataSize(int width, int height, int mipmaps, int format)
+		{
+			size_t bytes = 0;
+			for(int level = 0; level < mipmaps; level++)
+			{
+				bytes += isBlockCompressed(format) ? bcLevelBytes(width, height, format) : (size_t)GetPixelDataSize(width, height, format);
+				width = max(1, width / 2);
+				height = max(1, height / 2);
+			}
+			return bytes;
+		}
+
+		// Upload an image, block compressed images are decoded to RGBA8 first when the driver lacks S3TC
+		static Texture2D uploadImage(Image image)
+		{
+			Texture2D texture = LoadTextureFromImage(image);
+			if(texture.id == 0 && isBlockCompressed(image.format))
+			{
+				Image rgba = decompressImageBC(image);
+				texture = LoadTextureFromImage(rgba);
+				UnloadImage(rgba);
+			}
+
+			// Compressed chains stop before 1x1, without the cap GL treats them as incomplete and samples black
+			if(texture.id != 0 && texture.mipmaps > 1)
+			{
+				glBindTexture(ASSETCACHE_GL_TEXTURE_2D, texture.id);
+				glTexParameteri(ASSETCACHE_GL_TEXTURE_2D, ASSETCACHE_GL_TEXTURE_MAX_LEVEL, texture.mipmaps - 1);
+				glBindTexture(ASSETCACHE_GL_TEXTURE_2D, 0);
+			}
+			return texture;
+		}
+
+		// Nearest power of two of a side, from one block up to the largest texture we create
+		static int powerOfTwoSide(int side)
+		{
+			return 1 << min(max((int)lroundf(log2f((float)side)), 2), 14);
+		}
+
+		// Decode, mipmap and optionally block compress an image file
+		static Image prepareImage(const string& path, bool mipmaps, bool compress)
+		{
+			TRACE_SCOPE("AssetCache::prepareImage");
+			Image image = LoadImage(path.c_str());
+			if(image.data == NULL || (!mipmaps && !compress)) return image;
+
+			if(compress)
+			{
+				ImageFormat(&image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+
+				// raylib sizes compressed mip levels as w * h * bpp / 8, which only matches the 4x4 block layout while
+				// both sides are powers of two of at least 4. Each side is rounded on its own, so the 5400x2700
+				// colormap keeps its 2:1 aspect as 4096x2048.
+				int width = powerOfTwoSide(image.width), height = powerOfTwoSide(image.height);
+				if(image.width != width || image.height != height) ImageResize(&image, width, height);
+			}
+
+			ImageMipmaps(&image);
+			if(!compress) return image;
+
+			// Stop the chain at the last level that is still whole blocks, 8x4 for a 2:1 texture
+			int levels = 1;
+			for(int side = min(image.width, image.height); side >= 8; side /= 2) levels++;
+			image.mipmaps = min(image.mipmaps, levels);
+
+			bool opaque = true;
+			const Color *pixels = (const Color *)image.data;
+			for(size_t i = 0; i < (size_t)image.width * image.height && opaque; i++) opaque = pixels[i].a == 255;
+
+			Image compressed = compressImageBC(image, opaque ? PIXELFORMAT_COMPRESSED_DXT1_RGB : PIXELFORMAT_COMPRESSED_DXT5_RGBA);
+			UnloadImage(image);
+			return compressed;
+		}
+
+	public:
+		AssetCache(const MapCache& map_cache) : cache(map_cache) {}
+
+		// Load an image file as a texture, optionally with a full mip chain. With compress both sides are resized to
+		// powers of two and the chain, down to the last level of whole 4x4 blocks, is block compressed on the CPU
+		// (BC1 when opaque, BC3 otherwise). Use it for color textures only, never for data that must survive exactly.
+		// The decoded (and compressed) pixels are cached, the next launch uploads them without decoding.
+		Texture2D loadTexture(const string& path, bool mipmaps = false, bool compress = false)
+		{
+			TRACE_SCOPE("AssetCache::loadTexture");
+			uint64_t key = MapCache::combine(MapCache::hashFile(path), ASSET_CACHE_VERSION);
+			key = MapCache::combine(key, (mipmaps ? 1 : 0) | (compress ? 2 : 0));
+
+			string name = entryName(path, "texture");
+
+			CacheView view;
+			if(cache.view(name, key, view) && view.size() >= sizeof(ImageHeader))
+			{
+				ImageHeader header;
+				memcpy(&header, view.data(), sizeof(header));
+
+				size_t bytes = imageDataSize(header.width, header.height, header.mipmaps, header.format);
+				if(bytes > 0 && view.size() == sizeof(ImageHeader) + bytes)
+				{
+					// Points into the cache entry, uploaded as is and never unloaded
+					Image image = { (void *)(view.data() + sizeof(ImageHeader)), header.width, header.height, header.mipmaps, header.format };
+					return uploadImage(image);
+				}
+			}
+
+			Image image = prepareImage(path, mipmaps, compress);
+			if(image.data == NULL)
+			{
+				cerr << ASSETCACHE_ERR << "Could not load image: " << path << endl;
+				return Texture2D{ 0 };
+			}
+
+			ImageHeader header = { image.width, image.height, image.mipmaps, image.format };
+			size_t bytes = imageDataSize(image.width, image.height, image.mipmaps, image.format);
+
+			vector<unsigned char> blob(sizeof(header) + bytes);
+			memcpy(blob.data(), &header, sizeof(header));
+			memcpy(blob.data() + sizeof(header), image.data, bytes);
+			cache.write(name, key, blob.data(), blob.size());
+
+			Texture2D texture = uploadImage(image);
+			UnloadImage(image);
+			return texture;
+		}
+
+		// Load the heightfield of a heightmap image, terrain_size as in Heightfield::load.
+		// The tiled 16 bit samples are cached, the next launch copies them in without decoding the image.
+		bool loadHeightfield(const string& path, Vector3 terrain_size, Heightfield& heightfield)
+		{
+			TRACE_SCOPE("AssetCache::loadHeightfield");
+			uint64_t key = MapCache::combine(MapCache::hashFile(path), ASSET_CACHE_VERSION);
+			key = MapCache::hashBytes(&terrain_size, sizeof(terrain_size), key);
+
+			string name = entryName(path, "heightfield");
+
+			CacheView view;
+			if(cache.view(name, key, view) && view.size() >= sizeof(HeightfieldHeader))
+			{
+				HeightfieldHeader header;
+				memcpy(&header, view.data(), sizeof(header));
+
+				size_t count = (view.size() - sizeof(header)) / sizeof(uint16_t);
+				if(heightfield.loadTiles((const uint16_t *)(view.data() + sizeof(header)), count, header.width, header.height, header.size))
+				{
+					return true;
+				}
+			}
+
+			Image image = LoadImage(path.c_str());
+			bool loaded = heightfield.load(image, terrain_size);
+			UnloadImage(image);
+
+			if(!loaded)
+			{
+				cerr << ASSETCACHE_ERR << "Could not load heightmap: " << path << endl;
+				return false;
+			}
+
+			const auto& tiles = heightfield.getTileData();
+			HeightfieldHeader header = { heightfield.getWidth(), heightfield.getHeight(), heightfield.getSize() };
+
+			vector<unsigned char> blob(sizeof(header) + tiles.size() * sizeof(uint16_t));
+			memcpy(blob.data(), &header, sizeof(header));
+			memcpy(blob.data() + sizeof(header), tiles.data(), tiles.size() * sizeof(uint16_t));
+			cache.write(name, key, blob.data(), blob.size());
+
+			return true;
+		}
+};
+
+#endif
@@ -0,0 +1,327 @@
+#ifndef ARPADICA_BLOCKCOMPRESS_H
+#define ARPADICA_BLOCKCOMPRESS_H
+
+#include "raylib.h"
+#include "raymath.h"
+#include "parallel.hpp"
+#include "trace.hpp"
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+
+using namespace std;
+
+// CPU encoder and decoder for BC1 (DXT1, opaque) and BC3 (DXT5, with alpha) textures.
+// Endpoints are fitted along the principal axis of each 4x4 block's colors (range fit with a small inset),
+// good enough for photographic maps at a fraction of the cost of an exhaustive search.
+
+inline uint16_t bcPackColor565(float r, float g, float b)
+{
+	int r5 = (int)(Clamp(r, 0.0f, 255.0f) * 31.0f / 255.0f + 0.5f);
+	int g6 = (int)(Clamp(g, 0.0f, 255.0f) * 63.0f / 255.0f + 0.5f);
+	int b5 = (int)(Clamp(b, 0.0f, 255.0f) * 31.0f / 255.0f + 0.5f);
+	return (uint16_t)((r5 << 11) | (g6 << 5) | b5);
+}
+
+inline Color bcUnpackColor565(uint16_t c)
+{
+	int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+	return Color{ (unsigned char)((r << 3) | (r >> 2)), (unsigned char)((g << 2) | (g >> 4)), (unsigned char)((b << 3) | (b >> 2)), 255 };
+}
+
+inline Color bcLerpColor(Color a, Color b, int wa, int wb, int div)
+{
+	return Color{ (unsigned char)((a.r * wa + b.r * wb) / div), (unsigned char)((a.g * wa + b.g * wb) / div), (unsigned char)((a.b * wa + b.b * wb) / div), 255 };
+}
+
+// 4 color BC1 block (always c0 > c1, as BC3 requires), alpha is ignored
+inline void bcEncodeColorBlock(const Color block[16], unsigned char out[8])
+{
+	// Mean and covariance of the block colors
+	float mean[3] = { 0 };
+	for(int i = 0; i < 16; i++) { mean[0] += block[i].r; mean[1] += block[i].g; mean[2] += block[i].b; }
+	for(float& m : mean) m /= 16.0f;
+
+	float cov[6] = { 0 }; // rr rg rb gg gb bb
+	for(int i = 0; i < 16; i++)
+	{
+		float r = block[i].r - mean[0], g = block[i].g - mean[1], b = block[i].b - mean[2];
+		cov[0] += r * r; cov[1] += r * g; cov[2] += r * b;
+		cov[3] += g * g; cov[4] += g * b; cov[5] += b * b;
+	}
+
+	// Principal axis by power iteration
+	float axis[3] = { 1.0f, 1.0f, 1.0f };
+	for(int it = 0; it < 4; it++)
+	{
+		float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+		float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+		float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+		float len = sqrtf(x * x + y * y + z * z);
+		if(len < 1e-6f) break;
+		axis[0] = x / len; axis[1] = y / len; axis[2] = z / len;
+	}
+
+	float minT = 1e30f, maxT = -1e30f;
+	for(int i = 0; i < 16; i++)
+	{
+		float t = (block[i].r - mean[0]) * axis[0] + (block[i].g - mean[1]) * axis[1] + (block[i].b - mean[2]) * axis[2];
+		minT = min(minT, t);
+		maxT = max(maxT, t);
+	}
+
+	// Pull the endpoints in a little, the extremes are rarely worth an exact match
+	float inset = (maxT - minT) / 16.0f;
+	minT += inset;
+	maxT -= inset;
+
+	uint16_t c0 = bcPackColor565(mean[0] + axis[0] * maxT, mean[1] + axis[1] * maxT, mean[2] + axis[2] * maxT);
+	uint16_t c1 = bcPackColor565(mean[0] + axis[0] * minT, mean[1] + axis[1] * minT, mean[2] + axis[2] * minT);
+	if(c0 < c1) swap(c0, c1);
+
+	uint32_t indices = 0;
+	if(c0 != c1)
+	{
+		Color palette[4];
+		palette[0] = bcUnpackColor565(c0);
+		palette[1] = bcUnpackColor565(c1);
+		palette[2] = bcLerpColor(palette[0], palette[1], 2, 1, 3);
+		palette[3] = bcLerpColor(palette[0], palette[1], 1, 2, 3);
+
+		for(int i = 0; i < 16; i++)
+		{
+			int best = 0, bestError = INT32_MAX;
+			for(int p = 0; p < 4; p++)
+			{
+				int dr = block[i].r - palette[p].r, dg = block[i].g - palette[p].g, db = block[i].b - palette[p].b;
+				int error = dr * dr + dg * dg + db * db;
+				if(error < bestError) { bestError = error; best = p; }
+			}
+			indices |= (uint32_t)best << (2 * i);
+		}
+	}
+
+	memcpy(out, &c0, 2);
+	memcpy(out + 2, &c1, 2);
+	memcpy(out + 4, &indices, 4);
+}
+
+// BC3 alpha block, 8 interpolated values between the block minimum and maximum
+inline void bcEncodeAlphaBlock(const Color block[16], unsigned char out[8])
+{
+	int a0 = 0, a1 = 255;
+	for(int i = 0; i < 16; i++) { a0 = max(a0, (int)block[i].a); a1 = min(a1, (int)block[i].a); }
+
+	out[0] = (unsigned char)a0;
+	out[1] = (unsigned char)a1;
+
+	uint64_t indices = 0;
+	if(a0 != a1)
+	{
+		int palette[8] = { a0, a1 };
+		for(int p = 1; p < 7; p++) palette[p + 1] = ((7 - p) * a0 + p * a1) / 7;
+
+		for(int i = 0; i < 16; i++)
+		{
+			int best = 0, bestError = 256;
+			for(int p = 0; p < 8; p++)
+			{
+				int error = abs(block[i].a - palette[p]);
+				if(error < bestError) { bestError = error; best = p; }
+			}
+			indices |= (uint64_t)best << (3 * i);
+		}
+	}
+
+	for(int b = 0; b < 6; b++) out[2 + b] = (unsigned char)(indices >> (8 * b));
+}
+
+inline void bcDecodeColorBlock(const unsigned char in[8], Color block[16], bool allowTransparent)
+{
+	uint16_t c0, c1;
+	uint32_t indices;
+	memcpy(&c0, in, 2);
+	memcpy(&c1, in + 2, 2);
+	memcpy(&indices, in + 4, 4);
+
+	Color palette[4];
+	palette[0] = bcUnpackColor565(c0);
+	palette[1] = bcUnpackColor565(c1);
+	if(c0 > c1 || !allowTransparent)
+	{
+		palette[2] = bcLerpColor(palette[0], palette[1], 2, 1, 3);
+		palette[3] = bcLerpColor(palette[0], palette[1], 1, 2, 3);
+	}
+	else
+	{
+		palette[2] = bcLerpColor(palette[0], palette[1], 1, 1, 2);
+		palette[3] = Color{ 0, 0, 0, 0 };
+	}
+
+	for(int i = 0; i < 16; i++) block[i] = palette[(indices >> (2 * i)) & 3];
+}
+
+inline void bcDecodeAlphaBlock(const unsigned char in[8], Color block[16])
+{
+	int a0 = in[0], a1 = in[1];
+	int palette[8] = { a0, a1 };
+	if(a0 > a1)
+	{
+		for(int p = 1; p < 7; p++) palette[p + 1] = ((7 - p) * a0 + p * a1) / 7;
+	}
+	else
+	{
+		for(int p = 1; p < 5; p++) palette[p + 1] = ((5 - p) * a0 + p * a1) / 5;
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+
+	uint64_t indices = 0;
+	for(int b = 0; b < 6; b++) indices |= (uint64_t)in[2 + b] << (8 * b);
+
+	for(int i = 0; i < 16; i++) block[i].a = (unsigned char)palette[(indices >> (3 * i)) & 7];
+}
+
+inline int bcBlockBytes(int format)
+{
+	return format == PIXELFORMAT_COMPRESSED_DXT5_RGBA ? 16 : 8;
+}
+
+// Bytes of one compressed level, whole 4x4 blocks
+inline size_t bcLevelBytes(int width, int height, int format)
+{
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) * bcBlockBytes(format);
+}
+
+// Compress an RGBA8 image and all of its mip levels to BC1 (PIXELFORMAT_COMPRESSED_DXT1_RGB) or
+// BC3 (PIXELFORMAT_COMPRESSED_DXT5_RGBA). Rows of blocks are encoded in parallel. Levels below 4x4 are padded by
+// repeating their edge pixels. Returns an empty image for any other input format.
+inline Image compressImageBC(Image source, int format)
+{
+	TRACE_SCOPE("compressImageBC");
+	Image result = { 0 };
+	if(source.data == NULL || source.format != PIXELFORMAT_UNCOMPRESSED_R8G8B8A8) return result;
+	if(format != PIXELFORMAT_COMPRESSED_DXT1_RGB && format != PIXELFORMAT_COMPRESSED_DXT5_RGBA) return result;
+
+	size_t total = 0;
+	for(int level = 0, w = source.width, h = source.height; level < source.mipmaps; level++, w = max(1, w / 2), h = max(1, h / 2))
+	{
+		total += bcLevelBytes(w, h, format);
+	}
+
+	result.width = source.width;
+	result.height = source.height;
+	result.mipmaps = source.mipmaps;
+	result.format = format;
+	result.data = MemAlloc((unsigned int)total);
+
+	const Color *src = (const Color *)source.data;
+	unsigned char *dst = (unsigned char *)result.data;
+	const int bytes = bcBlockBytes(format);
+
+	for(int level = 0, w = source.width, h = source.height; level < source.mipmaps; level++, w = max(1, w / 2), h = max(1, h / 2))
+	{
+		const int blocksX = (w + 3) / 4, blocksY = (h + 3) / 4;
+
+		parallelFor(0, blocksY, [&](int rowBegin, int rowEnd)
+		{
+			Color block[16];
+			for(int by = rowBegin; by < rowEnd; by++)
+			{
+				for(int bx = 0; bx < blocksX; bx++)
+				{
+					for(int i = 0; i < 16; i++)
+					{
+						int x = min(bx * 4 + (i & 3), w - 1);
+						int y = min(by * 4 + (i >> 2), h - 1);
+						block[i] = src[(size_t)y * w + x];
+					}
+
+					unsigned char *out = dst + ((size_t)by * blocksX + bx) * bytes;
+					if(format == PIXELFORMAT_COMPRESSED_DXT5_RGBA)
+					{
+						bcEncodeAlphaBlock(block, out);
+						bcEncodeColorBlock(block, out + 8);
+					}
+					else
+					{
+						bcEncodeColorBlock(block, out);
+					}
+				}
+			}
+		}, 16);
+
+		src += (size_t)w * h;
+		dst += bcLevelBytes(w, h, format);
+	}
+
+	return result;
+}
+
+// Decode a BC1 / BC3 image with all of its mip levels back to RGBA8, for drivers without S3TC support
+inline Image decompressImageBC(Image source)
+{
+	TRACE_SCOPE("decompressImageBC");
+	Image result = { 0 };
+	if(source.data == NULL) return result;
+	if(source.format != PIXELFORMAT_COMPRESSED_DXT1_RGB && source.format != PIXELFORMAT_COMPRESSED_DXT1_RGBA &&
+		source.format != PIXELFORMAT_COMPRESSED_DXT5_RGBA) return result;
+
+	size_t total = 0;
+	for(int level = 0, w = source.width, h = source.height; level < source.mipmaps; level++, w = max(1, w / 2), h = max(1, h / 2))
+	{
+		total += (size_t)w * h * sizeof(Color);
+	}
+
+	result.width = source.width;
+	result.height = source.height;
+	result.mipmaps = source.mipmaps;
+	result.format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8;
+	result.data = MemAlloc((unsigned int)total);
+
+	const unsigned char *src = (const unsigned char *)source.data;
+	Color *dst = (Color *)result.data;
+	const int bytes = bcBlockBytes(source.format);
+	const bool hasAlphaBlock = source.format == PIXELFORMAT_COMPRESSED_DXT5_RGBA;
+
+	for(int level = 0, w = source.width, h = source.height; level < source.mipmaps; level++, w = max(1, w / 2), h = max(1, h / 2))
+	{
+		const int blocksX = (w + 3) / 4, blocksY = (h + 3) / 4;
+
+		parallelFor(0, blocksY, [&](int rowBegin, int rowEnd)
+		{
+			Color block[16];
+			for(int by = rowBegin; by < rowEnd; by++)
+			{
+				for(int bx = 0; bx < blocksX; bx++)
+				{
+					const unsigned char *in = src + ((size_t)by * blocksX + bx) * bytes;
+					if(hasAlphaBlock)
+					{
+						bcDecodeColorBlock(in + 8, block, false);
+						bcDecodeAlphaBlock(in, block);
+					}
+					else
+					{
+						bcDecodeColorBlock(in, block, source.format == PIXELFORMAT_COMPRESSED_DXT1_RGBA);
+					}
+
+					for(int i = 0; i < 16; i++)
+					{
+						int x = bx * 4 + (i & 3), y = by * 4 + (i >> 2);
+						if(x < w && y < h) dst[(size_t)y * w + x] = block[i];
+					}
+				}
+			}
+		}, 16);
+
+		src += bcLevelBytes(w, h, source.format);
+		dst += (size_t)w * h;
+	}
+
+	return result;
+}
+
+#endif
@@ -0,0 +1,298 @@
+#ifndef ARPADICA_FLYTHROUGH_H
+#define ARPADICA_FLYTHROUGH_H
+
+#include "raylib.h"
+#include "raymath.h"
+#include "profiler.hpp"
+#include "memory_stats.hpp"
+#include "render_stats.hpp"
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+#include <cctype>
+
+#define FLYTHROUGH_ERR "Arpadica::Flythrough::Error: "
+
+using namespace std;
+
+enum FlythroughEventType
+{
+	FLYTHROUGH_PICK = 0,  // left click at a screen position
+	FLYTHROUGH_COLOR,     // give the selected states a color, like "Add to Country"
+	FLYTHROUGH_MODE,      // switch the map mode
+	FLYTHROUGH_DRAPE      // switch between the overlay and the draped states
+};
+
+struct FlythroughEvent
+{
+	double time;
+	FlythroughEventType type;
+	Vector2 point = { 0 };
+	Color color = BLANK;
+	int mode = 0;
+};
+
+// Scripted camera path with picks and recolors, played back at a fixed step per frame so every run draws the
+// same frames. The script is a text file with one keyframe or event per line, '#' starts a comment:
+//
+//   <seconds> camera <target x> <target z> <distance> <yaw degrees> <pitch degrees>
+//   <seconds> pick <screen x> <screen y>
+//   <seconds> color <r> <g> <b>
+//   <seconds> mode <1-5>
+//   <seconds> drape
+//
+// Camera keyframes are eased into each other, the distance geometrically like the zoom. Pitch is the angle above
+// the map plane, 90 looks straight down. Events fire on the first frame at or after their time. The script ends
+// with its last line.
+//
+// CPU time per phase and the render counters are recorded every frame and written to CSV with a percentile summary.
+class Flythrough
+{
+	private:
+		struct CameraKey
+		{
+			double time;
+			Vector2 target;
+			float distance, yaw, pitch;
+		};
+
+		struct FrameRecord
+		{
+			double time;
+			float phases[PROFILE_PHASE_COUNT];
+			RenderStats render;
+		};
+
+		vector<CameraKey> keys;
+		vector<FlythroughEvent> events;
+		vector<FrameRecord> frames;
+		size_t nextEvent = 0;
+		double step = 1.0 / 60.0;
+		double time = 0.0;
+		double duration = 0.0;
+		bool active = false;
+
+		static Color parseColor(istringstream& in)
+		{
+			int r = 0, g = 0, b = 0;
+			in >> r >> g >> b;
+			return Color{ (unsigned char)Clamp(r, 0, 255), (unsigned char)Clamp(g, 0, 255), (unsigned char)Clamp(b, 0, 255), 255 };
+		}
+
+		static string columnName(int phase)
+		{
+			string name = profilePhaseNames[phase];
+			transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return (char)tolower(c); });
+			return name;
+		}
+
+	public:
+		// step is the script time between two frames
+		bool load(const string& path, double frame_step = 1.0 / 60.0)
+		{
+			ifstream file(path);
+			if(!file)
+			{
+				cerr << FLYTHROUGH_ERR << "Could not open script: " << path << endl;
+				return false;
+			}
+
+			keys.clear();
+			events.clear();
+			frames.clear();
+
+			string line;
+			int lineNumber = 0;
+			while(getline(file, line))
+			{
+				lineNumber++;
+				line = line.substr(0, line.find('#'));
+
+				istringstream in(line);
+				double at;
+				string command;
+				if(!(in >> at)) continue; // blank or comment
+
+				in >> command;
+
+				if(command == "camera")
+				{
+					CameraKey key = { at };
+					in >> key.target.x >> key.target.y >> key.distance >> key.yaw >> key.pitch;
+					if(in.fail())
+					{
+						cerr << FLYTHROUGH_ERR << path << ":" << lineNumber << ": camera needs target x, target z, distance, yaw and pitch" << endl;
+						return false;
+					}
+					keys.push_back(key);
+				}
+				else if(command == "pick" || command == "color" || command == "mode" || command == "drape")
+				{
+					FlythroughEvent event;
+					event.time = at;
+
+					if(command == "pick") { event.type = FLYTHROUGH_PICK; in >> event.point.x >> event.point.y; }
+					else if(command == "color") { event.type = FLYTHROUGH_COLOR; event.color = parseColor(in); }
+					else if(command == "mode") { event.type = FLYTHROUGH_MODE; in >> event.mode; }
+					else event.type = FLYTHROUGH_DRAPE;
+
+					if(in.fail())
+					{
+						cerr << FLYTHROUGH_ERR << path << ":" << lineNumber << ": missing arguments for " << command << endl;
+						return false;
+					}
+					events.push_back(event);
+				}
+				else
+				{
+					cerr << FLYTHROUGH_ERR << path << ":" << lineNumber << ": unknown command " << command << endl;
+					return false;
+				}
+
+				duration = max(duration, at);
+			}
+
+			if(keys.empty())
+			{
+				cerr << FLYTHROUGH_ERR << "Script has no camera keyframes: " << path << endl;
+				return false;
+			}
+
+			auto byTime = [](const auto& a, const auto& b) { return a.time < b.time; };
+			stable_sort(keys.begin(), keys.end(), byTime);
+			stable_sort(events.begin(), events.end(), byTime);
+
+			step = frame_step;
+			time = 0.0;
+			nextEvent = 0;
+			MemoryScope memory(MEMORY_PROFILING);
+			frames.reserve((size_t)(duration / step) + 2);
+			active = true;
+			return true;
+		}
+
+		bool isActive() const { return active; }
+		bool isFinished() const { return time > duration + step * 0.5; }
+		double getTime() const { return time; }
+
+		// Move to the next frame
+		void advance() { time += step; }
+
+		// Place the camera where the script wants it at the current time, distance receives the camera distance
+		void applyCamera(Camera& camera, float& distance) const
+		{
+			size_t next = 0;
+			while(next < keys.size() && keys[next].time <= time) next++;
+
+			CameraKey key;
+			if(next == 0) key = keys.front();
+			else if(next == keys.size()) key = keys.back();
+			else
+			{
+				const CameraKey& a = keys[next - 1];
+				const CameraKey& b = keys[next];
+				float t = (float)((time - a.time) / max(1e-9, b.time - a.time));
+				t = t * t * (3.0f - 2.0f * t);
+
+				key.target = Vector2Lerp(a.target, b.target, t);
+				key.distance = a.distance * powf(b.distance / a.distance, t);
+				key.yaw = Lerp(a.yaw, b.yaw, t);
+				key.pitch = Lerp(a.pitch, b.pitch, t);
+			}
+
+			// Straight down has no defined up vector
+			float yaw = key.yaw * DEG2RAD;
+			float pitch = Clamp(key.pitch, -89.5f, 89.5f) * DEG2RAD;
+
+			Vector3 offset = { cosf(pitch) * sinf(yaw), sinf(pitch), cosf(pitch) * cosf(yaw) };
+			Vector3 right = { cosf(yaw), 0.0f, -sinf(yaw) };
+
+			camera.target = (Vector3){ key.target.x, 0.0f, key.target.y };
+			camera.position = Vector3Add(camera.target, Vector3Scale(offset, key.distance));
+			camera.up = Vector3CrossProduct(right, Vector3Negate(offset));
+			distance = key.distance;
+		}
+
+		// Next event due by the current time, call until it returns false
+		bool pollEvent(FlythroughEvent& event)
+		{
+			if(nextEvent >= events.size() || events[nextEvent].time > time + step * 0.5) return false;
+			event = events[nextEvent++];
+			return true;
+		}
+
+		// Record the frame before the current one, call right after profiler.beginFrame() once advance() ran
+		void record(const Profiler& profiler, const RenderStats& render)
+		{
+			FrameRecord frame;
+			frame.time = time - step;
+			for(int phase = 0; phase < PROFILE_PHASE_COUNT; phase++) frame.phases[phase] = (float)profiler.getLastFrame((ProfilePhase)phase);
+			frame.render = render;
+			frames.push_back(frame);
+		}
+
+		// One row per frame, and next to it <name>_summary.csv with the percentiles of every phase
+		bool writeCsv(const string& path) const
+		{
+			ofstream out(path, ios::trunc);
+			if(!out)
+			{
+				cerr << FLYTHROUGH_ERR << "Could not write " << path << endl;
+				return false;
+			}
+
+			out << "frame,time_s";
+			for(int phase = 0; phase < PROFILE_PHASE_COUNT; phase++) out << "," << columnName(phase) << "_ms";
+			out << ",terrain_triangles,drape_triangles,terrain_chunks,overlay_triangles,overlay_edges,overlay_spans,polygons_tested,polygons_culled,outline_segments"
+				<< ",batch_flushes,mesh_draws,texture_uploads,texture_upload_bytes,mesh_uploads\n";
+
+			for(size_t i = 0; i < frames.size(); i++)
+			{
+				const FrameRecord& frame = frames[i];
+				out << i << "," << frame.time;
+				for(int phase = 0; phase < PROFILE_PHASE_COUNT; phase++) out << "," << frame.phases[phase];
+				const RenderStats& r = frame.render;
+				out << "," << r.terrainTriangles << "," << r.drapeTriangles << "," << r.terrainChunks << "," << r.overlayTriangles
+					<< "," << r.overlayEdges << "," << r.overlaySpans << "," << r.polygonsTested << "," << r.polygonsCulled
+					<< "," << r.outlineSegments << "," << r.batchFlushes << "," << r.meshDraws << "," << r.textureUploads << "," << r.textureUploadBytes << "," << r.meshUploads << "\n";
+			}
+
+			string summaryPath = path;
+			size_t extension = summaryPath.rfind(".csv");
+			if(extension != string::npos) summaryPath.erase(extension);
+			summaryPath += "_summary.csv";
+
+			ofstream summary(summaryPath, ios::trunc);
+			if(!summary)
+			{
+				cerr << FLYTHROUGH_ERR << "Could not write " << summaryPath << endl;
+				return false;
+			}
+
+			summary << "phase,frames,p50_ms,p95_ms,p99_ms,max_ms\n";
+			vector<float> values(frames.size());
+			for(int phase = 0; phase < PROFILE_PHASE_COUNT; phase++)
+			{
+				for(size_t i = 0; i < frames.size(); i++) values[i] = frames[i].phases[phase];
+				PhaseStats s = computePhaseStats(values.data(), (int)values.size());
+
+				summary << columnName(phase) << "," << s.samples << "," << s.p50 << "," << s.p95 << "," << s.p99 << "," << s.max << "\n";
+			}
+
+			return (bool)out && (bool)summary;
+		}
+
+		// Frame time percentiles of the whole run
+		PhaseStats frameStats() const
+		{
+			vector<float> values(frames.size());
+			for(size_t i = 0; i < frames.size(); i++) values[i] = frames[i].phases[PROFILE_FRAME];
+			return computePhaseStats(values.data(), (int)values.size());
+		}
+};
+
+#endif
@@ -0,0 +1,350 @@
+#ifndef ARPADICA_HEIGHTFIELD_H
+#define ARPADICA_HEIGHTFIELD_H
+
+#include "raylib.h"
+#include "raymath.h"
+#include "parallel.hpp"
+#include "trace.hpp"
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+
+#define HEIGHTFIELD_ERR "Arpadica::Heightfield::Error: "
+
+using namespace std;
+
+// CPU copy of the terrain heights for gameplay, labels and picking.
+// Samples are 16 bit and stored in TILE x TILE tiles, so the 4 samples of a bilinear lookup (and most lookups of
+// nearby points) share a cache line or two instead of being a whole heightmap row apart.
+// Positions are in terrain local space: x in [0, size.x], z in [0, size.z], heights in [0, size.y].
+class Heightfield
+{
+	public:
+		static constexpr int TILE_BITS = 6;
+		static constexpr int TILE = 1 << TILE_BITS; // samples per tile side
+
+	private:
+		int width = 0, height = 0; // samples
+		int tilesX = 0, tilesZ = 0;
+		Vector3 size = { 0 };
+		Vector3 scale = { 0 };     // world units per sample (y: per 16 bit level)
+		vector<uint16_t> samples;  // tile by tile, rows inside a tile
+		vector<uint16_t> tileMax;  // highest sample per tile, lets raycasts skip empty space
+
+		size_t sampleIndex(int x, int z) const
+		{
+			size_t tile = (size_t)(z >> TILE_BITS) * tilesX + (x >> TILE_BITS);
+			return (tile << (2 * TILE_BITS)) + ((z & (TILE - 1)) << TILE_BITS) + (x & (TILE - 1));
+		}
+
+		void allocate(int w, int h, Vector3 terrain_size)
+		{
+			width = w;
+			height = h;
+			size = terrain_size;
+			scale = { size.x / (width - 1), size.y / 65535.0f, size.z / (height - 1) };
+
+			tilesX = (width + TILE - 1) / TILE;
+			tilesZ = (height + TILE - 1) / TILE;
+			samples.assign((size_t)tilesX * tilesZ * TILE * TILE, 0);
+		}
+
+		void buildTileMax()
+		{
+			tileMax.assign((size_t)tilesX * tilesZ, 0);
+
+			for(size_t tile = 0; tile < tileMax.size(); tile++)
+			{
+				auto first = samples.begin() + (tile << (2 * TILE_BITS));
+				tileMax[tile] = *max_element(first, first + TILE * TILE);
+			}
+		}
+
+		// Bilinear lookup in sample space, clamped to the edges
+		float sampleBilinear(float sx, float sz) const
+		{
+			sx = min(max(sx, 0.0f), (float)(width - 1));
+			sz = min(max(sz, 0.0f), (float)(height - 1));
+
+			int x0 = min((int)sx, width - 2);
+			int z0 = min((int)sz, height - 2);
+			float fx = sx - x0;
+			float fz = sz - z0;
+
+			float h00 = samples[sampleIndex(x0, z0)];
+			float h10 = samples[sampleIndex(x0 + 1, z0)];
+			float h01 = samples[sampleIndex(x0, z0 + 1)];
+			float h11 = samples[sampleIndex(x0 + 1, z0 + 1)];
+
+			float top = h00 + (h10 - h00) * fx;
+			float bottom = h01 + (h11 - h01) * fx;
+			return (top + (bottom - top) * fz) * scale.y;
+		}
+
+	public:
+		Heightfield() {}
+
+		// Load from a heightmap image, the gray value is the average of the color channels (same as GenMeshHeightmap).
+		// terrain_size is the world size, y is the height of a white pixel.
+		bool load(Image heightmap, Vector3 terrain_size)
+		{
+			TRACE_SCOPE("Heightfield::load");
+			unload();
+
+			if(heightmap.data == NULL || heightmap.width < 2 || heightmap.height < 2)
+			{
+				cerr << HEIGHTFIELD_ERR << "Invalid heightmap image" << endl;
+				return false;
+			}
+
+			allocate(heightmap.width, heightmap.height, terrain_size);
+
+			Color *pixels = LoadImageColors(heightmap);
+			parallelFor(0, height, [&](int rowBegin, int rowEnd)
+			{
+				for(int z = rowBegin; z < rowEnd; z++)
+				{
+					for(int x = 0; x < width; x++)
+					{
+						const Color& c = pixels[(size_t)z * width + x];
+						samples[sampleIndex(x, z)] = (uint16_t)((c.r + c.g + c.b) / 3 * 257); // 255 -> 65535
+					}
+				}
+			}, 64);
+			UnloadImageColors(pixels);
+
+			buildTileMax();
+			return true;
+		}
+
+		// Load from row major 16 bit samples
+		bool load(const uint16_t *data, int w, int h, Vector3 terrain_size)
+		{
+			unload();
+
+			if(data == NULL || w < 2 || h < 2)
+			{
+				cerr << HEIGHTFIELD_ERR << "Invalid heightfield data" << endl;
+				return false;
+			}
+
+			allocate(w, h, terrain_size);
+
+			for(int z = 0; z < height; z++)
+			{
+				for(int x = 0; x < width; x++) samples[sampleIndex(x, z)] = data[(size_t)z * width + x];
+			}
+
+			buildTileMax();
+			return true;
+		}
+
+		// Load samples already in tile order, as returned by getTileData (used by the asset cache)
+		bool loadTiles(const uint16_t *tiles, size_t count, int w, int h, Vector3 terrain_size)
+		{
+			unload();
+
+			if(tiles == NULL || w < 2 || h < 2)
+			{
+				cerr << HEIGHTFIELD_ERR << "Invalid heightfield tiles" << endl;
+				return false;
+			}
+
+			allocate(w, h, terrain_size);
+			if(count != samples.size())
+			{
+				cerr << HEIGHTFIELD_ERR << "Heightfield tile data does not match its size" << endl;
+				unload();
+				return false;
+			}
+
+			memcpy(samples.data(), tiles, count * sizeof(uint16_t));
+			buildTileMax();
+			return true;
+		}
+
+		void unload()
+		{
+			samples.clear();
+			samples.shrink_to_fit();
+			tileMax.clear();
+			width = height = tilesX = tilesZ = 0;
+		}
+
+		bool isLoaded() const { return !samples.empty(); }
+
+		// Samples in tile order, TILE * TILE per tile, tiles row by row
+		const vector<uint16_t>& getTileData() const { return samples; }
+
+		int getWidth() const { return width; }
+		int getHeight() const { return height; }
+		Vector3 getSize() const { return size; }
+		Vector3 getScale() const { return scale; }
+
+		// Height of a single sample, clamped to the edges
+		float heightAtSample(int x, int z) const
+		{
+			x = min(max(x, 0), width - 1);
+			z = min(max(z, 0), height - 1);
+			return samples[sampleIndex(x, z)] * scale.y;
+		}
+
+		uint16_t rawSample(int x, int z) const
+		{
+			x = min(max(x, 0), width - 1);
+			z = min(max(z, 0), height - 1);
+			return samples[sampleIndex(x, z)];
+		}
+
+		// Bilinear height at a terrain local position, positions outside the terrain are clamped to its edge
+		float heightAt(float x, float z) const
+		{
+			if(samples.empty()) return 0.0f;
+			return sampleBilinear(x / scale.x, z / scale.z);
+		}
+
+		// Height gradient (dh/dx, dh/dz) from central differences one sample apart
+		Vector2 gradientAt(float x, float z) const
+		{
+			if(samples.empty()) return { 0.0f, 0.0f };
+
+			float sx = x / scale.x, sz = z / scale.z;
+			float dx = (sampleBilinear(sx + 1.0f, sz) - sampleBilinear(sx - 1.0f, sz)) / (2.0f * scale.x);
+			float dz = (sampleBilinear(sx, sz + 1.0f) - sampleBilinear(sx, sz - 1.0f)) / (2.0f * scale.z);
+			return { dx, dz };
+		}
+
+		// Slope angle in radians, 0 is flat
+		float slopeAt(float x, float z) const
+		{
+			Vector2 g = gradientAt(x, z);
+			return atanf(sqrtf(g.x * g.x + g.y * g.y));
+		}
+
+		Vector3 normalAt(float x, float z) const
+		{
+			Vector2 g = gradientAt(x, z);
+			return Vector3Normalize({ -g.x, 1.0f, -g.y });
+		}
+
+		// Heights of count points (x, z) into out, large batches are split between worker threads
+		void heightsAt(const Vector2 *points, float *out, int count) const
+		{
+			if(samples.empty())
+			{
+				fill(out, out + count, 0.0f);
+				return;
+			}
+
+			const float invX = 1.0f / scale.x, invZ = 1.0f / scale.z;
+
+			parallelFor(0, count, [&](int begin, int end)
+			{
+				for(int i = begin; i < end; i++) out[i] = sampleBilinear(points[i].x * invX, points[i].y * invZ);
+			}, 4096);
+		}
+
+		// Slope angles in radians of count points (x, z) into out
+		void slopesAt(const Vector2 *points, float *out, int count) const
+		{
+			parallelFor(0, count, [&](int begin, int end)
+			{
+				for(int i = begin; i < end; i++) out[i] = slopeAt(points[i].x, points[i].y);
+			}, 2048);
+		}
+
+		// First intersection of a terrain local ray with the heightfield. Marches one sample at a time and refines
+		// the hit by bisection, tiles the ray passes above are skipped in one step.
+		bool raycast(Ray ray, Vector3 *hit) const
+		{
+			if(samples.empty()) return false;
+
+			// Clip the ray against the terrain box
+			float tmin = 0.0f, tmax = 1e30f;
+			const float boxMin[3] = { 0.0f, 0.0f, 0.0f };
+			const float boxMax[3] = { size.x, size.y, size.z };
+			const float origin[3] = { ray.position.x, ray.position.y, ray.position.z };
+			const float dir[3] = { ray.direction.x, ray.direction.y, ray.direction.z };
+
+			for(int axis = 0; axis < 3; axis++)
+			{
+				if(fabsf(dir[axis]) < 1e-9f)
+				{
+					if(origin[axis] < boxMin[axis] || origin[axis] > boxMax[axis]) return false;
+					continue;
+				}
+
+				float t0 = (boxMin[axis] - origin[axis]) / dir[axis];
+				float t1 = (boxMax[axis] - origin[axis]) / dir[axis];
+				if(t0 > t1) swap(t0, t1);
+
+				tmin = max(tmin, t0);
+				tmax = min(tmax, t1);
+				if(tmin > tmax) return false;
+			}
+
+			auto pointAt = [&](float t) { return Vector3Add(ray.position, Vector3Scale(ray.direction, t)); };
+			auto above = [&](float t) { Vector3 p = pointAt(t); return p.y > heightAt(p.x, p.z); };
+
+			float horizontal = sqrtf(dir[0] * dir[0] + dir[2] * dir[2]);
+			float stepT = horizontal > 1e-9f ? min(scale.x, scale.z) / horizontal : (tmax - tmin);
+
+			if(!above(tmin))
+			{
+				if(hit) *hit = pointAt(tmin);
+				return true;
+			}
+
+			float t = tmin;
+			while(t < tmax)
+			{
+				// Skip the rest of the tile when the ray stays above its highest sample
+				Vector3 p = pointAt(t);
+				int tx = min(max((int)(p.x / scale.x), 0), width - 1) >> TILE_BITS;
+				int tz = min(max((int)(p.z / scale.z), 0), height - 1) >> TILE_BITS;
+
+				float exitT = tmax;
+				if(dir[0] > 0) exitT = min(exitT, (((tx + 1) << TILE_BITS) * scale.x - origin[0]) / dir[0]);
+				if(dir[0] < 0) exitT = min(exitT, ((tx << TILE_BITS) * scale.x - origin[0]) / dir[0]);
+				if(dir[2] > 0) exitT = min(exitT, (((tz + 1) << TILE_BITS) * scale.z - origin[2]) / dir[2]);
+				if(dir[2] < 0) exitT = min(exitT, ((tz << TILE_BITS) * scale.z - origin[2]) / dir[2]);
+
+				// Bilinear heights never exceed the samples of the tile plus its one sample border
+				float tileTop = tileMax[(size_t)tz * tilesX + tx] * scale.y;
+				if(tx + 1 < tilesX) tileTop = max(tileTop, tileMax[(size_t)tz * tilesX + tx + 1] * scale.y);
+				if(tz + 1 < tilesZ) tileTop = max(tileTop, tileMax[(size_t)(tz + 1) * tilesX + tx] * scale.y);
+				if(tx + 1 < tilesX && tz + 1 < tilesZ) tileTop = max(tileTop, tileMax[(size_t)(tz + 1) * tilesX + tx + 1] * scale.y);
+
+				if(min(p.y, pointAt(exitT).y) > tileTop)
+				{
+					t = max(exitT, t + stepT * 0.01f);
+					continue;
+				}
+
+				float next = min(t + stepT, tmax);
+				if(!above(next))
+				{
+					// Crossed the surface between t and next
+					float lo = t, hi = next;
+					for(int i = 0; i < 12; i++)
+					{
+						float mid = (lo + hi) * 0.5f;
+						if(above(mid)) lo = mid;
+						else hi = mid;
+					}
+
+					if(hit) *hit = pointAt(hi);
+					return true;
+				}
+
+				t = next;
+			}
+
+			return false;
+		}
+};
+
+#endif
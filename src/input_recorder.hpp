@@ -0,0 +1,269 @@
+#ifndef ARPADICA_INPUT_RECORDER_H
+#define ARPADICA_INPUT_RECORDER_H
+
+#include "raylib.h"
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+#define INPUTRECORDER_ERR "Arpadica::InputRecorder::Error: "
+
+using namespace std;
+
+// GUI widgets whose clicks are recorded, a bit each
+enum GuiAction
+{
+	GUI_ADD_TO_COUNTRY = 1 << 0,
+	GUI_CLEAR_SELECTION = 1 << 1
+};
+
+enum InputMode
+{
+	INPUT_LIVE = 0,  // straight from raylib
+	INPUT_RECORD,    // from raylib, and written to a file
+	INPUT_REPLAY     // from a file, raylib input is ignored
+};
+
+struct InputFileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+};
+
+static constexpr uint32_t INPUT_FILE_MAGIC = 0x4E495241; // "ARIN"
+static constexpr uint32_t INPUT_FILE_VERSION = 1;
+
+// Fixed part of a recorded frame, followed by keysDown + keysPressed key codes (uint16_t)
+struct InputFrameHeader
+{
+	double time;           // seconds since the recording started
+	float dt;              // frame time the game ran with
+	Vector2 mouse;
+	Vector2 mouseDelta;
+	float wheel;
+	uint8_t buttonsDown;   // bit per MouseButton
+	uint8_t buttonsPressed;
+	uint8_t gui;           // GuiAction bits
+	uint8_t padding;
+	int32_t listScroll;    // country list view state after the frame
+	int32_t listActive;
+	uint16_t keysDown;
+	uint16_t keysPressed;
+};
+
+// Everything the main loop reads from input in one frame
+struct FrameInput
+{
+	InputFrameHeader header = {};
+	vector<uint16_t> keysDown;    // sorted
+	vector<uint16_t> keysPressed; // sorted
+};
+
+// Source of the main loop's input. Live, it forwards raylib. Recording, it also streams every frame to a file:
+// mouse, wheel, buttons, keys and the GUI clicks, with the frame time and a timestamp. Replaying, every frame
+// comes from the file instead, the recorded dt included, so the game steps through exactly the frames the player
+// saw no matter how fast the replay runs. Fast replays run without a frame cap and report their throughput.
+//
+// GUI widgets still poll raylib themselves, so their results go through guiClicked() / guiList() to be recorded
+// and replaced on replay.
+class InputRecorder
+{
+	private:
+		InputMode mode = INPUT_LIVE;
+		FrameInput current;
+		bool haveFrame = false;
+
+		ofstream out;
+		ifstream in;
+		string path;
+		bool fast = false;
+		bool finished = false;
+
+		long frames = 0;
+		double recordedSeconds = 0.0;
+		chrono::steady_clock::time_point start;
+
+		static bool contains(const vector<uint16_t>& keys, int key)
+		{
+			return binary_search(keys.begin(), keys.end(), (uint16_t)key);
+		}
+
+		void capture()
+		{
+			InputFrameHeader& h = current.header;
+			h.time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+			h.dt = GetFrameTime();
+			h.mouse = GetMousePosition();
+			h.mouseDelta = GetMouseDelta();
+			h.wheel = GetMouseWheelMove();
+			h.buttonsDown = h.buttonsPressed = 0;
+			h.gui = 0;
+
+			for(int button = MOUSE_BUTTON_LEFT; button <= MOUSE_BUTTON_BACK; button++)
+			{
+				if(IsMouseButtonDown(button)) h.buttonsDown |= 1 << button;
+				if(IsMouseButtonPressed(button)) h.buttonsPressed |= 1 << button;
+			}
+
+			// Polling every key keeps the char queue intact for raygui
+			current.keysDown.clear();
+			current.keysPressed.clear();
+			for(int key = 1; key < 512; key++)
+			{
+				if(IsKeyDown(key)) current.keysDown.push_back((uint16_t)key);
+				if(IsKeyPressed(key)) current.keysPressed.push_back((uint16_t)key);
+			}
+		}
+
+		void writeFrame()
+		{
+			current.header.keysDown = (uint16_t)current.keysDown.size();
+			current.header.keysPressed = (uint16_t)current.keysPressed.size();
+
+			out.write((const char *)&current.header, sizeof(current.header));
+			out.write((const char *)current.keysDown.data(), current.keysDown.size() * sizeof(uint16_t));
+			out.write((const char *)current.keysPressed.data(), current.keysPressed.size() * sizeof(uint16_t));
+		}
+
+		bool readFrame()
+		{
+			if(!in.read((char *)&current.header, sizeof(current.header))) return false;
+
+			current.keysDown.resize(current.header.keysDown);
+			current.keysPressed.resize(current.header.keysPressed);
+			in.read((char *)current.keysDown.data(), current.keysDown.size() * sizeof(uint16_t));
+			in.read((char *)current.keysPressed.data(), current.keysPressed.size() * sizeof(uint16_t));
+			return (bool)in;
+		}
+
+	public:
+		InputRecorder() {}
+		~InputRecorder() { close(); }
+
+		InputRecorder(const InputRecorder&) = delete;
+		InputRecorder& operator=(const InputRecorder&) = delete;
+
+		bool record(const string& file_path)
+		{
+			out.open(file_path, ios::binary | ios::trunc);
+			if(!out)
+			{
+				cerr << INPUTRECORDER_ERR << "Could not write input recording: " << file_path << endl;
+				return false;
+			}
+
+			InputFileHeader header = { INPUT_FILE_MAGIC, INPUT_FILE_VERSION };
+			out.write((const char *)&header, sizeof(header));
+
+			path = file_path;
+			mode = INPUT_RECORD;
+			start = chrono::steady_clock::now();
+			return true;
+		}
+
+		// Replay a recording, fast drops the frame cap and only counts throughput
+		bool replay(const string& file_path, bool fast_replay)
+		{
+			in.open(file_path, ios::binary);
+
+			InputFileHeader header = {};
+			if(!in || !in.read((char *)&header, sizeof(header)) || header.magic != INPUT_FILE_MAGIC || header.version != INPUT_FILE_VERSION)
+			{
+				cerr << INPUTRECORDER_ERR << "Not an input recording: " << file_path << endl;
+				in.close();
+				return false;
+			}
+
+			path = file_path;
+			mode = INPUT_REPLAY;
+			fast = fast_replay;
+			start = chrono::steady_clock::now();
+			return true;
+		}
+
+		// Read the input of the next frame, call once at the start of the frame. A replay that ran out of frames
+		// returns false.
+		bool beginFrame()
+		{
+			if(mode == INPUT_REPLAY)
+			{
+				if(finished || !readFrame())
+				{
+					finished = true;
+					return false;
+				}
+
+				frames++;
+				recordedSeconds += current.header.dt;
+				return true;
+			}
+
+			// The GUI results of the previous frame are known by now
+			if(mode == INPUT_RECORD && haveFrame) writeFrame();
+
+			capture();
+			haveFrame = true;
+			frames++;
+			return true;
+		}
+
+		void close()
+		{
+			if(mode == INPUT_RECORD && haveFrame)
+			{
+				writeFrame();
+				haveFrame = false;
+			}
+
+			if(out.is_open()) out.close();
+			if(in.is_open()) in.close();
+		}
+
+		InputMode getMode() const { return mode; }
+		bool isReplaying() const { return mode == INPUT_REPLAY; }
+		bool isFast() const { return fast; }
+		bool isFinished() const { return finished; }
+		const string& getPath() const { return path; }
+
+		long getFrameCount() const { return frames; }
+		double getRecordedSeconds() const { return recordedSeconds; }
+		double getElapsedSeconds() const { return chrono::duration<double>(chrono::steady_clock::now() - start).count(); }
+
+		float getFrameTime() const { return current.header.dt; }
+		Vector2 getMousePosition() const { return current.header.mouse; }
+		Vector2 getMouseDelta() const { return current.header.mouseDelta; }
+		float getMouseWheelMove() const { return current.header.wheel; }
+		bool isMouseButtonDown(int button) const { return (current.header.buttonsDown >> button) & 1; }
+		bool isMouseButtonPressed(int button) const { return (current.header.buttonsPressed >> button) & 1; }
+		bool isKeyDown(int key) const { return contains(current.keysDown, key); }
+		bool isKeyPressed(int key) const { return contains(current.keysPressed, key); }
+
+		// Result of a GUI button, clicked is what raygui reported this frame
+		bool guiClicked(GuiAction action, bool clicked)
+		{
+			if(mode == INPUT_REPLAY) return (current.header.gui & action) != 0;
+
+			if(clicked) current.header.gui |= action;
+			return clicked;
+		}
+
+		// State of a list view after raygui handled it
+		void guiList(int& scroll, int& active)
+		{
+			if(mode == INPUT_REPLAY)
+			{
+				scroll = current.header.listScroll;
+				active = current.header.listActive;
+				return;
+			}
+
+			current.header.listScroll = scroll;
+			current.header.listActive = active;
+		}
+};
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef ARPADICA_LIGHTMAP_H
+#define ARPADICA_LIGHTMAP_H
+
+#include "raylib.h"
+#include "raymath.h"
+#include "heightfield.hpp"
+#include "map_cache.hpp"
+#include "parallel.hpp"
+#include "trace.hpp"
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+static constexpr uint32_t LIGHTMAP_VERSION = 1;
+
+static constexpr int LIGHTMAP_AO_DIRECTIONS = 8;   // horizon directions per texel
+static constexpr int LIGHTMAP_AO_STEPS = 10;       // samples per direction, spaced further apart with every step
+static constexpr int LIGHTMAP_SHADOW_STEPS = 16;   // samples towards the sun
+static constexpr float LIGHTMAP_STEP_GROWTH = 1.5f;
+static constexpr float LIGHTMAP_PENUMBRA = 0.05f;  // width of the shadow edge, as a slope
+
+// Highest slope (rise / distance) towards the horizon seen from position along dir, or 0 when nothing rises above it
+inline float traceHorizon(const Heightfield& heightfield, Vector2 position, float base, Vector2 dir, float first_step, int steps)
+{
+	float horizon = 0.0f;
+	float distance = first_step;
+
+	for(int s = 0; s < steps; s++)
+	{
+		float h = heightfield.heightAt(position.x + dir.x * distance, position.y + dir.y * distance);
+		horizon = max(horizon, (h - base) / distance);
+		distance *= LIGHTMAP_STEP_GROWTH;
+	}
+
+	return horizon;
+}
+
+// Bake ambient occlusion and sun shadows of the heightfield into a GRAYSCALE + ALPHA image of w x h texels,
+// gray = ambient occlusion (1 = open sky), alpha = sun visibility (1 = lit). Texel centers are spread evenly over the
+// terrain, so the image lines up with the terrain texture coordinates. Both terms are horizon based: the AO of a texel
+// is how much of the sky the terrain around it blocks, the texel is shadowed when the terrain towards the sun rises
+// above the sun. sun_direction points towards the sun. Rows are baked in parallel.
+inline Image bakeTerrainLightmap(const Heightfield& heightfield, Vector3 sun_direction, int w, int h)
+{
+	TRACE_SCOPE("bakeTerrainLightmap");
+	Image lightmap = { 0 };
+	if(!heightfield.isLoaded() || w <= 0 || h <= 0) return lightmap;
+
+	lightmap.width = w;
+	lightmap.height = h;
+	lightmap.mipmaps = 1;
+	lightmap.format = PIXELFORMAT_UNCOMPRESSED_GRAY_ALPHA;
+	lightmap.data = MemAlloc((unsigned int)((size_t)w * h * 2));
+
+	const Vector3 size = heightfield.getSize();
+	const Vector3 scale = heightfield.getScale();
+	const float firstStep = min(scale.x, scale.z);
+
+	// Sun azimuth and elevation, as the slope the terrain has to exceed to cast a shadow
+	Vector3 sun = Vector3Normalize(sun_direction);
+	float sunHorizontal = sqrtf(sun.x * sun.x + sun.z * sun.z);
+	Vector2 sunDir = sunHorizontal > 1e-6f ? Vector2{ sun.x / sunHorizontal, sun.z / sunHorizontal } : Vector2{ 1.0f, 0.0f };
+	float sunSlope = sunHorizontal > 1e-6f ? sun.y / sunHorizontal : 1e30f;
+
+	Vector2 aoDirs[LIGHTMAP_AO_DIRECTIONS];
+	for(int d = 0; d < LIGHTMAP_AO_DIRECTIONS; d++)
+	{
+		float angle = (d + 0.5f) * 2.0f * PI / LIGHTMAP_AO_DIRECTIONS;
+		aoDirs[d] = { cosf(angle), sinf(angle) };
+	}
+
+	unsigned char *pixels = (unsigned char *)lightmap.data;
+
+	parallelFor(0, h, [&](int rowBegin, int rowEnd)
+	{
+		for(int y = rowBegin; y < rowEnd; y++)
+		{
+			for(int x = 0; x < w; x++)
+			{
+				Vector2 position = { (x + 0.5f) / w * size.x, (y + 0.5f) / h * size.z };
+				float base = heightfield.heightAt(position.x, position.y);
+
+				// Share of the sky above the horizon, averaged over the directions
+				float open = 0.0f;
+				for(int d = 0; d < LIGHTMAP_AO_DIRECTIONS; d++)
+				{
+					float horizon = traceHorizon(heightfield, position, base, aoDirs[d], firstStep, LIGHTMAP_AO_STEPS);
+					open += 1.0f - horizon / sqrtf(1.0f + horizon * horizon); // 1 - sin(horizon angle)
+				}
+				open /= LIGHTMAP_AO_DIRECTIONS;
+
+				// Soft edged shadow, lit while the sun stays above the horizon towards it
+				float visibility = 1.0f;
+				if(sunSlope < 1e29f)
+				{
+					float horizon = traceHorizon(heightfield, position, base, sunDir, firstStep, LIGHTMAP_SHADOW_STEPS);
+					visibility = Clamp((sunSlope - horizon) / LIGHTMAP_PENUMBRA + 0.5f, 0.0f, 1.0f);
+				}
+
+				unsigned char *texel = pixels + ((size_t)y * w + x) * 2;
+				texel[0] = (unsigned char)(open * 255.0f + 0.5f);
+				texel[1] = (unsigned char)(visibility * 255.0f + 0.5f);
+			}
+		}
+	}, 8);
+
+	return lightmap;
+}
+
+// Load the lightmap from the cache, or bake and cache it when the sources or the sun changed (source_key)
+inline Image loadTerrainLightmap(const Heightfield& heightfield, Vector3 sun_direction, int w, int h, const MapCache& cache, uint64_t source_key)
+{
+	TRACE_SCOPE("loadTerrainLightmap");
+	uint64_t key = MapCache::combine(source_key, LIGHTMAP_VERSION);
+	key = MapCache::combine(key, ((uint64_t)w << 32) | (uint32_t)h);
+	key = MapCache::hashBytes(&sun_direction, sizeof(sun_direction), key);
+
+	const size_t bytes = (size_t)w * h * 2;
+
+	vector<unsigned char> blob;
+	if(cache.read("terrain_lightmap", key, blob) && blob.size() == bytes)
+	{
+		Image lightmap = { 0 };
+		lightmap.width = w;
+		lightmap.height = h;
+		lightmap.mipmaps = 1;
+		lightmap.format = PIXELFORMAT_UNCOMPRESSED_GRAY_ALPHA;
+		lightmap.data = MemAlloc((unsigned int)bytes);
+		memcpy(lightmap.data, blob.data(), bytes);
+		return lightmap;
+	}
+
+	Image lightmap = bakeTerrainLightmap(heightfield, sun_direction, w, h);
+	if(lightmap.data != NULL) cache.write("terrain_lightmap", key, lightmap.data, bytes);
+
+	return lightmap;
+}
+
+#endif
@@ -0,0 +1,150 @@
+#ifndef ARPADICA_LOGGER_H
+#define ARPADICA_LOGGER_H
+
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <string>
+#include <iostream>
+#include <cstdio>
+#include <cstdarg>
+#include <cstring>
+#include "memory_stats.hpp"
+
+using namespace std;
+
+// raylib already has LOG_DEBUG, LOG_INFO and friends
+enum LoggerLevel
+{
+	LOGGER_DEBUG = 0,
+	LOGGER_INFO,
+	LOGGER_WARNING,
+	LOGGER_ERROR,
+	LOGGER_NONE
+};
+
+static const char *loggerLevelNames[LOGGER_NONE] = { "debug", "info", "warning", "error" };
+
+// "debug", "info", "warning", "error" or "none", anything else keeps fallback
+inline LoggerLevel parseLoggerLevel(const char *name, LoggerLevel fallback = LOGGER_INFO)
+{
+	if(name == NULL) return fallback;
+	for(int level = 0; level < LOGGER_NONE; level++) if(strcmp(name, loggerLevelNames[level]) == 0) return (LoggerLevel)level;
+	if(strcmp(name, "none") == 0) return LOGGER_NONE;
+	return fallback;
+}
+
+// Leveled, buffered console log. Lines below the level are dropped before they are formatted, the rest collect in
+// a buffer that goes to cout in one write when it fills up, on flush() and at exit. Warnings and errors flush
+// what came before them and go to cerr right away, so they never show up out of order or get lost.
+//
+// printf style, lines get their newline added. Safe to call from any thread.
+class Logger
+{
+	private:
+		static constexpr size_t BUFFER_SIZE = 64 * 1024;
+
+		mutex bufferMutex;
+		string buffer;
+		atomic<int> level{ LOGGER_INFO };
+
+		Logger()
+		{
+			MemoryScope memory(MEMORY_PROFILING);
+			buffer.reserve(BUFFER_SIZE);
+		}
+
+		~Logger() { flush(); }
+
+		void flushLocked()
+		{
+			if(buffer.empty()) return;
+			cout.write(buffer.data(), (streamsize)buffer.size());
+			cout.flush();
+			buffer.clear();
+		}
+
+	public:
+		static Logger& instance()
+		{
+			static Logger logger;
+			return logger;
+		}
+
+		Logger(const Logger&) = delete;
+		Logger& operator=(const Logger&) = delete;
+
+		void setLevel(LoggerLevel minimum) { level.store(minimum, memory_order_relaxed); }
+		LoggerLevel getLevel() const { return (LoggerLevel)level.load(memory_order_relaxed); }
+		bool isEnabled(LoggerLevel line_level) const { return line_level >= getLevel() && line_level < LOGGER_NONE; }
+
+		void vprint(LoggerLevel line_level, const char *format, va_list args)
+		{
+			if(!isEnabled(line_level)) return;
+
+			char line[1024];
+			int length = vsnprintf(line, sizeof(line), format, args);
+			if(length < 0) return;
+			length = min(length, (int)sizeof(line) - 1);
+
+			lock_guard<mutex> lock(bufferMutex);
+			if(line_level >= LOGGER_WARNING)
+			{
+				flushLocked();
+				cerr << line << endl;
+				return;
+			}
+
+			if(buffer.size() + length + 1 > BUFFER_SIZE) flushLocked();
+			buffer.append(line, length);
+			buffer.push_back('\n');
+		}
+
+		void print(LoggerLevel line_level, const char *format, ...)
+		{
+			va_list args;
+			va_start(args, format);
+			vprint(line_level, format, args);
+			va_end(args);
+		}
+
+		void flush()
+		{
+			lock_guard<mutex> lock(bufferMutex);
+			flushLocked();
+		}
+};
+
+inline void logDebug(const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	Logger::instance().vprint(LOGGER_DEBUG, format, args);
+	va_end(args);
+}
+
+inline void logInfo(const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	Logger::instance().vprint(LOGGER_INFO, format, args);
+	va_end(args);
+}
+
+inline void logWarning(const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	Logger::instance().vprint(LOGGER_WARNING, format, args);
+	va_end(args);
+}
+
+inline void logError(const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	Logger::instance().vprint(LOGGER_ERROR, format, args);
+	va_end(args);
+}
+
+#endif
@@ -1,4 +1,5 @@
 #define RAYGUI_IMPLEMENTATION
+#define MEMORY_STATS_IMPLEMENTATION
 #include "raylib.h"
 #include "raymath.h"
 #include "raygui.h"
@@ -12,6 +13,21 @@
 
 #include "map_engine.hpp"
 #include "country.hpp"
+#include "state_layers.hpp"
+#include "overlay_builder.hpp"
+#include "terrain.hpp"
+#include "map_cache.hpp"
+#include "terrain_stats.hpp"
+#include "lightmap.hpp"
+#include "asset_cache.hpp"
+#include "terrain_streamer.hpp"
+#include "state_drape.hpp"
+#include "profiler.hpp"
+#include "flythrough.hpp"
+#include "input_recorder.hpp"
+#include "memory_stats.hpp"
+#include "render_stats.hpp"
+#include "logger.hpp"
 
 #define TITLE "Arpadica"
 #define VERSION_NUM "0.3.0"
@@ -28,20 +44,67 @@ string colormap = "./assets/maps/colormap.jpg";
 
 const int mainMapTexWidth = 16384;
 const int mainMapTexHeight = 8192;
+const int borderFieldWidth = 8192;     // Border distance field, half the overlay resolution
+const int borderFieldHeight = 4096;
+const float borderMaxDistance = 8.0f;  // Furthest border distance stored in the field, in overlay pixels
+const float borderWidth = 1.5f;        // Half width of the drawn borders, in overlay pixels
+const double overlayFrameBudget = 0.002; // Seconds per frame spent rebuilding the overlay
+const int lightmapWidth = 4096;        // Baked terrain ambient occlusion and sun shadows
+const int lightmapHeight = 2048;
+const Vector3 sunDirection = { -0.5f, 0.8f, -0.5f }; // World-space direction TO the sun, shared by the shader and the lightmap bake
 const string overlayShader_fs = "assets/shaders/map_overlay.fs";
 const string overlayShader_vs = "assets/shaders/map_overlay.vs";
+const string drapeShader_fs = "assets/shaders/state_drape.fs";
+const string drapeShader_vs = "assets/shaders/state_drape.vs";
+const string borderShader_fs = "assets/shaders/state_border.fs";
+const string borderShader_vs = "assets/shaders/state_border.vs";
+const float overlayMix = 0.85f;        // Strength of the state colors over the terrain
+const char *traceVariable = "ARPADICA_TRACE"; // Environment variable naming a Chrome trace file to record into
+const char *flythroughVariable = "ARPADICA_FLYTHROUGH";        // Environment variable naming a camera script to benchmark, see flythrough.hpp
+const char *flythroughCsvVariable = "ARPADICA_FLYTHROUGH_CSV"; // Where the benchmark frames go, flythrough.csv by default
+const char *recordVariable = "ARPADICA_RECORD";           // Environment variable naming a file to record all input into
+const char *replayVariable = "ARPADICA_REPLAY";           // Environment variable naming an input recording to replay
+const char *replayFastVariable = "ARPADICA_REPLAY_FAST";  // Set to replay without a frame cap and report the throughput
+const char *allocCheckVariable = "ARPADICA_ALLOC_CHECK";  // Set to report every steady frame that allocates on the heap
+const char *logLevelVariable = "ARPADICA_LOG_LEVEL";      // debug, info, warning, error or none, info by default
+const string cacheDirectory = "./cache";  // Baked map data, safe to delete
+const string heightTiles = "./assets/maps/heightmap.aht"; // Optional high resolution 16 bit heights, streamed around the camera
+const int maxResidentHeightTiles = 128;   // Streamed tile pool, 128 tiles of 256x256 samples = 16 MB
+const float heightTileRadius = 0.5f;      // Streaming radius around the camera target, relative to the camera distance
+
+// Material map slots used to bind the overlay textures (slot 0 is the colormap)
+#define OVERLAY_SLOT_STATE_INDEX   MATERIAL_MAP_METALNESS
+#define OVERLAY_SLOT_BORDER_FIELD  MATERIAL_MAP_NORMAL
+#define OVERLAY_SLOT_STATE_PALETTE MATERIAL_MAP_ROUGHNESS
+#define OVERLAY_SLOT_STATE_FLAGS   MATERIAL_MAP_OCCLUSION
+#define OVERLAY_SLOT_HEIGHTMAP     MATERIAL_MAP_HEIGHT
+#define OVERLAY_SLOT_LIGHTMAP      MATERIAL_MAP_EMISSION
+#define OVERLAY_SLOT_DETAIL        MATERIAL_MAP_BRDF
 
 int CountrySelectorScrollIndex = 0;
 int CountrySelectorActive = 0;
 
 std::string getTitle(float fps = -1);
 
-void renderMapOverlay(MapEngine& mapEngine, RenderTexture2D& targetTex, Camera2D& camera, int screenWidth, int screenHeight);
-void setupOverlayShader(Model& mapModel, Shader& overlayShader, RenderTexture2D& mainMapTex, Vector3 mapPosition, float sizeX, float sizeZ);
-Vector2 mouseToMap(Ray ray, Vector3 mapPosition, float sizeX, float sizeZ, MapEngine& mapEngine);
+void setupOverlayShader(Material& mapMaterial, Shader& overlayShader, const Texture2D& mainMapTex, Texture2D& borderFieldTex, StateLayers& stateLayers, Vector3 mapPosition, float sizeX, float sizeZ);
+void setupDrapeShaders(Material& drapeMaterial, Shader& drapeShader, Material& borderMaterial, Shader& borderShader, StateLayers& stateLayers, const Texture2D& lightmapTex, Vector3 mapPosition, float sizeX, float sizeZ);
+void setSharedOverlayUniforms(Shader& shader, Vector3 mapPosition, float sizeX, float sizeZ);
+void bindOverlayTexture(Material& mapMaterial, Shader& overlayShader, int slot, const char *uniformName, const Texture2D& texture);
+Vector2 mouseToMap(Ray ray, Vector3 mapPosition, float sizeX, float sizeZ, const Heightfield& heightfield, const TerrainStreamer& terrainStreamer);
 
 int main() 
 {
+	// Debug also lists every state as it loads
+	Logger::instance().setLevel(parseLoggerLevel(getenv(logLevelVariable)));
+
+	// Startup and frame timeline, open the file in Perfetto or chrome://tracing
+	const char *tracePath = getenv(traceVariable);
+	if(tracePath != NULL && tracePath[0] != '\0')
+	{
+		Tracer::instance().setEnabled(true);
+		Tracer::instance().setThreadName("Main");
+	}
+
 	InitWindow(screenWidth, screenHeight, getTitle().c_str());
 	SetTargetFPS(165);
 
@@ -140,6 +203,17 @@ int main()
 	countries.push_back(czechia);
 	countries.push_back(romania);
 
+	// GuiListView that contains all countries, the list does not change while playing
+	std::string countryListStr = "";
+	for (size_t i = 0; i < countries.size(); i++)
+	{
+		countryListStr += countries[i].getId();
+		if (i < countries.size() - 1)
+		{
+			countryListStr += ";";
+		}
+	}
+
 	/* MAIN MAP */
 	MapEngine mapEngine(mainMapTexWidth, mainMapTexHeight);
 
@@ -150,13 +224,26 @@ int main()
 
 	if(!mapEngine.LoadMap(map_file))
 	{
-		cerr << ERROR << "Failed to load map data! Exiting." << endl;
+		logError(ERROR "Failed to load map data! Exiting.");
 		CloseWindow();
 		return 1;
 	}
 
-	RenderTexture2D mainMapTex = LoadRenderTexture(mainMapTexWidth, mainMapTexHeight);
-	SetTextureFilter(mainMapTex.texture, TEXTURE_FILTER_ANISOTROPIC_16X);
+	// State index overlay, rasterized on the CPU and uploaded progressively over the first frames
+	OverlayBuilder overlayBuilder;
+	overlayBuilder.load(mainMapTexWidth, mainMapTexHeight, true);
+
+	// Political colors, selection and hover live in small per-state layers composited by the shader
+	StateLayers stateLayers;
+	stateLayers.load(mapEngine);
+	stateLayers.setChoropleth(mapEngine.getColumn("area"), Color{ 255, 245, 200, 220 }, Color{ 180, 30, 30, 220 });
+
+	// Borders are drawn by the overlay shader from a distance field instead of being rasterized into the overlay
+	Image borderField = mapEngine.bakeBorderField(borderFieldWidth, borderFieldHeight, borderMaxDistance);
+	Texture2D borderFieldTex = LoadTextureFromImage(borderField);
+	SetTextureFilter(borderFieldTex, TEXTURE_FILTER_BILINEAR);
+	SetTextureWrap(borderFieldTex, TEXTURE_WRAP_CLAMP);
+	UnloadImage(borderField);
 
 	Camera2D mapCam = { 0 }; // Camera for main 2D map
 	mapCam.target = { 0, 0 };
@@ -170,43 +257,243 @@ int main()
 	DrawTextEx(baseFont, "Generating map model...", {(float)(screenWidth - MeasureText("Generating map model...", 20)) / 2, screenHeight / 2}, 20, 1, WHITE);
 	EndDrawing();
 
-	Image image = LoadImage(heightmap.c_str());     // Earth heightmap image (RAM)
-	Texture2D heightmap = LoadTextureFromImage(image);        // Convert image to texture (VRAM)
-	Texture2D colormapTex = LoadTexture(colormap.c_str());
+	MapCache mapCache(cacheDirectory);
+	TraceScope hashTrace("Hash map sources");
+	uint64_t mapSourceKey = MapCache::combine(MapCache::hashFile(map_file), MapCache::hashFile(heightmap));
+	hashTrace.end();
+
+	// Decoded textures and heightfield tiles come from the cache when the source images are unchanged
+	AssetCache assetCache(mapCache);
+
+	Texture2D heightmapTex = assetCache.loadTexture(heightmap);   // Earth heightmap texture (VRAM)
+	SetTextureFilter(heightmapTex, TEXTURE_FILTER_BILINEAR);
+	SetTextureWrap(heightmapTex, TEXTURE_WRAP_CLAMP);
+	Texture2D colormapTex = assetCache.loadTexture(colormap, true, true); // BC1 compressed, a fraction of the VRAM
+	SetTextureFilter(colormapTex, TEXTURE_FILTER_TRILINEAR);
 
 	float sizeX = 200.0f;
 	float sizeZ = 100.0f;
-	Mesh mapMesh = GenMeshHeightmap(image, (Vector3){ sizeX, 0.75f, sizeZ }); // Generate heightmap mesh from image
-	Model mapModel = LoadModelFromMesh(mapMesh);                  // Load model from generated mesh
+	Heightfield heightfield;                                      // Earth heights (RAM)
+	{
+		MemoryScope memory(MEMORY_TERRAIN);
+		assetCache.loadHeightfield(heightmap, (Vector3){ sizeX, 0.75f, sizeZ }, heightfield);
+	}
 
-	mapModel.materials[0].maps[MATERIAL_MAP_DIFFUSE].texture = colormapTex; // Set map diffuse heightmap
-	Vector3 mapPosition = { -sizeX * 0.5f, 0.0f, -sizeZ * 0.5f };
+	Terrain terrain;                                              // Chunked LOD terrain, displaced on the GPU from the heightmap texture
+	terrain.load(move(heightfield), TERRAIN_MODE_DISPLACED);
 
+	// Detail heights stream in around the camera target when a tiled height file is present
+	TerrainStreamer terrainStreamer;
+	if(terrainStreamer.open(heightTiles, maxResidentHeightTiles))
+	{
+		cout << "Streaming " << terrainStreamer.getTileCount() << " height tiles from " << heightTiles << endl;
+	}
 
-	UnloadImage(image);             // Unload heightmap image from RAM, already uploaded to VRAM
+	// Elevation, slope and roughness per state, baked once and then read from the cache
+	loadStateTerrainStats(mapEngine, terrain.getHeightfield(), mapCache, mapSourceKey);
+
+	// Relief lighting, baked on the CPU once and then read from the cache
+	Image lightmap = loadTerrainLightmap(terrain.getHeightfield(), sunDirection, lightmapWidth, lightmapHeight, mapCache, mapSourceKey);
+	Texture2D lightmapTex = LoadTextureFromImage(lightmap);
+	SetTextureFilter(lightmapTex, TEXTURE_FILTER_BILINEAR);
+	SetTextureWrap(lightmapTex, TEXTURE_WRAP_CLAMP);
+	UnloadImage(lightmap);
+
+	Material mapMaterial = LoadMaterialDefault();
+	mapMaterial.maps[MATERIAL_MAP_DIFFUSE].texture = colormapTex; // Set map diffuse heightmap
+	Vector3 mapPosition = { -sizeX * 0.5f, 0.0f, -sizeZ * 0.5f };
 
 
 	/* SHADERS */
 	DrawTextEx(baseFont, "Setting up shaders...", {(float)(screenWidth - MeasureText("Setting up shaders...", 20)) / 2, screenHeight / 2}, 20, 1, WHITE);
 
 	Shader overlayShader = LoadShader(overlayShader_vs.c_str(), overlayShader_fs.c_str());
-	setupOverlayShader(mapModel, overlayShader, mainMapTex, mapPosition, sizeX, sizeZ);
+	setupOverlayShader(mapMaterial, overlayShader, overlayBuilder.getTexture(), borderFieldTex, stateLayers, mapPosition, sizeX, sizeZ);
+
+	bindOverlayTexture(mapMaterial, overlayShader, OVERLAY_SLOT_HEIGHTMAP, "heightMap", heightmapTex);
+	bindOverlayTexture(mapMaterial, overlayShader, OVERLAY_SLOT_LIGHTMAP, "lightMap", lightmapTex);
+	if(terrainStreamer.isOpen()) bindOverlayTexture(mapMaterial, overlayShader, OVERLAY_SLOT_DETAIL, "detailHeights", terrainStreamer.getDetailTexture());
+	terrain.setupShader(overlayShader, mapPosition);
+
+	// Draped states, the alternative to the overlay texture (O toggles). Built on the first switch.
+	Shader drapeShader = LoadShader(drapeShader_vs.c_str(), drapeShader_fs.c_str());
+	Shader borderShader = LoadShader(borderShader_vs.c_str(), borderShader_fs.c_str());
+	Material drapeMaterial = LoadMaterialDefault();
+	Material borderMaterial = LoadMaterialDefault();
+	setupDrapeShaders(drapeMaterial, drapeShader, borderMaterial, borderShader, stateLayers, lightmapTex, mapPosition, sizeX, sizeZ);
+
+	StateDrape stateDrape;
+	stateDrape.setupShaders(drapeShader, borderShader);
+	bool drapeStates = false;
+
+	Profiler profiler;  // F3 shows the frame phase timings
+
+	// Info line of the last clicked state, only formatted when the state changes
+	int infoState = -1;
+	char stateInfo[256] = "";
+	auto showStateInfo = [&](int stateIndex) {
+		if(stateIndex < 0 || stateIndex == infoState) return;
+
+		const State& state = mapEngine.getStates()[stateIndex];
+		snprintf(stateInfo, sizeof(stateInfo), "State ID: %s | Name: %s", state.id.c_str(), state.name_en.c_str());
+		infoState = stateIndex;
+	};
+
+	vector<int> selectedStates;
+	int hoveredState = -1;
+
+	// Left click on a state, selects it or takes it out of the selection
+	auto selectStateAt = [&](Vector2 mouse) {
+		ProfileScope scope(profiler, PROFILE_PICKING);
+
+		Ray ray = GetMouseRay(mouse, camera);
 
-	State selectedState;
-	string stateInfo = "";
+		Vector2 worldPos = mouseToMap(ray, mapPosition, sizeX, sizeZ, terrain.getHeightfield(), terrainStreamer);
 
-	vector<State> selectedStates;
+		int stateIndex = mapEngine.getStateIndexAt((int)worldPos.x, (int)worldPos.y);
+		if (stateIndex >= 0) 
+		{
+			showStateInfo(stateIndex);
+
+			// Set color based on selected country
+			/*Color countryColor = countries[selectedCountry].getColor();
+			mapEngine.setStateColor(selectedState.id, countryColor);
+			renderMapOverlay(mapEngine, mainMapTex, mapCam, mainMapTexWidth, mainMapTexHeight);*/
+
+			// Selection only flips a flag in the selection layer, political colors stay untouched
+			if(!stateLayers.hasFlag(stateIndex, STATE_FLAG_SELECTED)) 
+			{
+				// Select if not yet selected
+				selectedStates.push_back(stateIndex);
+				stateLayers.setFlag(stateIndex, STATE_FLAG_SELECTED, true);
+			}
+			else
+			{
+				// Deselect if already selected
+				selectedStates.erase(std::remove(selectedStates.begin(), selectedStates.end(), stateIndex), selectedStates.end());
+				stateLayers.setFlag(stateIndex, STATE_FLAG_SELECTED, false);
+			}
+		}
+	};
+
+	// Paint the selected states and clear the selection
+	auto assignSelection = [&](Color color) {
+		for(int stateIndex : selectedStates)
+		{
+			mapEngine.setStateColor(stateIndex, color);
+			stateLayers.setPoliticalColor(stateIndex, color);
+		}
+		selectedStates.clear();
+		stateLayers.clearFlag(STATE_FLAG_SELECTED);
+	};
 
-	renderMapOverlay(mapEngine, mainMapTex, mapCam, mainMapTexWidth, mainMapTexHeight);
+	auto toggleDrape = [&]() {
+		drapeStates = !drapeStates;
+
+		if(drapeStates)
+		{
+			if(!stateDrape.isBuilt()) stateDrape.build(mapEngine, terrain.getHeightfield());
+
+			// The full size overlay render texture is not needed while the states are draped
+			overlayBuilder.unload();
+			cout << "States draped, " << stateDrape.getGpuBytes() / (1024 * 1024) << " MB of geometry instead of the "
+				<< (size_t)mainMapTexWidth * mainMapTexHeight * 4 / (1024 * 1024) << " MB overlay" << endl;
+		}
+		else
+		{
+			overlayBuilder.load(mainMapTexWidth, mainMapTexHeight, true);
+			overlayBuilder.begin(mapEngine);
+		}
+
+		bindOverlayTexture(mapMaterial, overlayShader, OVERLAY_SLOT_STATE_INDEX, "stateIndexMap", overlayBuilder.getTexture());
+
+		float terrainOverlayMix = drapeStates ? 0.0f : overlayMix;
+		SetShaderValue(overlayShader, GetShaderLocation(overlayShader, "overlayMix"), &terrainOverlayMix, SHADER_UNIFORM_FLOAT);
+	};
+
+	// Benchmark mode, replays a camera script as fast as the GPU allows and writes the frame times
+	Flythrough flythrough;
+	const char *flythroughPath = getenv(flythroughVariable);
+	if(flythroughPath != NULL && flythroughPath[0] != '\0' && flythrough.load(flythroughPath))
+	{
+		SetTargetFPS(0);
+		cout << "Running flythrough " << flythroughPath << endl;
+	}
+	Vector2 flythroughPointer = { screenWidth * 0.5f, screenHeight * 0.5f }; // hover position, the last scripted pick
+	bool flythroughRunning = false; // script time is moving, it waits for the overlay
+
+	// Input recording and replay, to turn a reported slowdown into something that can be run again
+	InputRecorder input;
+	const char *recordPath = getenv(recordVariable);
+	const char *replayPath = getenv(replayVariable);
+	const char *replayFast = getenv(replayFastVariable);
+	if(replayPath != NULL && replayPath[0] != '\0')
+	{
+		bool fast = replayFast != NULL && replayFast[0] != '\0' && replayFast[0] != '0';
+		if(input.replay(replayPath, fast))
+		{
+			if(fast) SetTargetFPS(0);
+			cout << "Replaying input from " << replayPath << (fast ? " as fast as possible" : "") << endl;
+		}
+	}
+	else if(recordPath != NULL && recordPath[0] != '\0' && input.record(recordPath))
+	{
+		cout << "Recording input to " << recordPath << endl;
+	}
+
+	// Heap is counted per subsystem as it is allocated, what raylib allocates itself and the VRAM is estimated here
+	MemoryStats memoryStats;
+	float memoryRefresh = 0.0f;
+	const char *allocCheck = getenv(allocCheckVariable);
+	memoryStats.setAllocationCheck(allocCheck != NULL && allocCheck[0] != '\0' && allocCheck[0] != '0');
+
+	char windowTitle[64] = "";
+	int titleFps = -1;
+	auto updateMemoryEstimates = [&]() {
+		memoryStats.setEstimate("Fonts", MemoryStats::RAM, fontCpuBytes(baseFont) + fontCpuBytes(baseFontI) + fontCpuBytes(baseFontB) + fontCpuBytes(baseFontBI));
+		memoryStats.setEstimate("Terrain indices", MemoryStats::RAM, terrain.getIndexBytes());
+
+		memoryStats.setEstimate("Heightmap", MemoryStats::VRAM, textureBytes(heightmapTex));
+		memoryStats.setEstimate("Colormap", MemoryStats::VRAM, textureBytes(colormapTex));
+		memoryStats.setEstimate("Lightmap", MemoryStats::VRAM, textureBytes(lightmapTex));
+		memoryStats.setEstimate("Detail heights", MemoryStats::VRAM, textureBytes(terrainStreamer.getDetailTexture()));
+		memoryStats.setEstimate("Border field", MemoryStats::VRAM, textureBytes(borderFieldTex));
+		memoryStats.setEstimate("State layers", MemoryStats::VRAM, textureBytes(stateLayers.getPaletteTexture()) + textureBytes(stateLayers.getFlagsTexture()));
+		memoryStats.setEstimate("Overlay", MemoryStats::VRAM, overlayBuilder.getGpuBytes());
+		memoryStats.setEstimate("Terrain chunks", MemoryStats::VRAM, terrain.getGpuBytes());
+		memoryStats.setEstimate("Drape", MemoryStats::VRAM, stateDrape.getGpuBytes());
+		memoryStats.setEstimate("Fonts", MemoryStats::VRAM, fontGpuBytes(baseFont) + fontGpuBytes(baseFontI) + fontGpuBytes(baseFontB) + fontGpuBytes(baseFontBI));
+	};
+
+	overlayBuilder.begin(mapEngine);
 	while (!WindowShouldClose())
 	{
+		profiler.beginFrame();
+		renderCounters().beginFrame();
+		memoryStats.beginFrame();
+
+		if(flythroughRunning)
+		{
+			flythrough.record(profiler, renderCounters().last);
+			if(flythrough.isFinished()) break;
+		}
 
-		SetWindowTitle(getTitle((float)GetFPS()).c_str());
+		if(!input.beginFrame()) break; // replay finished
 
-		float dt = GetFrameTime();
+		ProfileScope inputScope(profiler, PROFILE_INPUT);
+
+		// Only when the FPS changed, the title is formatted into a fixed buffer
+		if(GetFPS() != titleFps)
+		{
+			titleFps = GetFPS();
+			snprintf(windowTitle, sizeof(windowTitle), "%s %s - %d FPS", TITLE, VERSION_NUM, titleFps);
+			SetWindowTitle(windowTitle);
+		}
+
+		float dt = input.getFrameTime();
 
 		// Zoom
-		float wheel = GetMouseWheelMove();
+		float wheel = input.getMouseWheelMove();
 		float t = 1.0f - powf(0.001f, dt * ZOOM_SMOOTHNESS);
 		if (wheel != 0.0f)
 		{
@@ -220,67 +507,52 @@ int main()
 		camera.position = Vector3Subtract(camera.target, Vector3Scale(forward, camDistance));
 
 		// Pan with mouse
-		if (IsMouseButtonDown(MOUSE_BUTTON_RIGHT))
+		if (input.isMouseButtonDown(MOUSE_BUTTON_RIGHT))
 		{
-			Vector2 delta = GetMouseDelta();
+			Vector2 delta = input.getMouseDelta();
 			camera.position.x += delta.x * 0.1f;
 			camera.position.z += delta.y * 0.1f;
 			camera.target.x += delta.x * 0.1f;
 			camera.target.z += delta.y * 0.1f;
 		}
 
-		// State info
-		if(IsMouseButtonDown(MOUSE_BUTTON_MIDDLE))
+		inputScope.stop();
+
+		// Hover highlight
 		{
-			Vector2 mouse = GetMousePosition();
+			ProfileScope scope(profiler, PROFILE_PICKING);
+
+			Vector2 mouse = flythrough.isActive() ? flythroughPointer : input.getMousePosition();
 			Ray ray = GetMouseRay(mouse, camera);
 
-			Vector2 worldPos = mouseToMap(ray, mapPosition, sizeX, sizeZ, mapEngine);
+			Vector2 worldPos = mouseToMap(ray, mapPosition, sizeX, sizeZ, terrain.getHeightfield(), terrainStreamer);
 
-			selectedState = mapEngine.getStateAt((int)worldPos.x, (int)worldPos.y);
-			if (selectedState.id != "") {
-				stateInfo = "State ID: " + selectedState.id + " | Name: " + selectedState.name_en;
+			int stateIndex = mapEngine.getStateIndexAt((int)worldPos.x, (int)worldPos.y);
+			if(stateIndex != hoveredState)
+			{
+				stateLayers.setFlag(hoveredState, STATE_FLAG_HOVERED, false);
+				stateLayers.setFlag(stateIndex, STATE_FLAG_HOVERED, true);
+				hoveredState = stateIndex;
 			}
 		}
 
-		if(IsMouseButtonPressed(MOUSE_BUTTON_LEFT))
+		// State info
+		if(input.isMouseButtonDown(MOUSE_BUTTON_MIDDLE))
 		{
-			Vector2 mouse = GetMousePosition();
-			Ray ray = GetMouseRay(mouse, camera);
-
-			Vector2 worldPos = mouseToMap(ray, mapPosition, sizeX, sizeZ, mapEngine);
-
-			selectedState = mapEngine.getStateAt((int)worldPos.x, (int)worldPos.y);
-			if (selectedState.id != "") 
-			{
-
-				stateInfo = "State ID: " + selectedState.id + " | Name: " + selectedState.name_en;
+			ProfileScope scope(profiler, PROFILE_PICKING);
 
-				// Set color based on selected country
-				/*Color countryColor = countries[selectedCountry].getColor();
-				mapEngine.setStateColor(selectedState.id, countryColor);
-				renderMapOverlay(mapEngine, mainMapTex, mapCam, mainMapTexWidth, mainMapTexHeight);*/
-
-				if(std::find(selectedStates.begin(), selectedStates.end(), selectedState) == selectedStates.end()) 
-				{
-					// Select if not yet selected
+			Vector2 mouse = input.getMousePosition();
+			Ray ray = GetMouseRay(mouse, camera);
 
-					selectedStates.push_back(selectedState);
+			Vector2 worldPos = mouseToMap(ray, mapPosition, sizeX, sizeZ, terrain.getHeightfield(), terrainStreamer);
 
-					mapEngine.setStateColor(selectedState.id, YELLOW);
-					renderMapOverlay(mapEngine, mainMapTex, mapCam, mainMapTexWidth, mainMapTexHeight);
-				}
-				else
-				{
-					// Deselect if already selected
-					selectedStates.erase(std::remove(selectedStates.begin(), selectedStates.end(), selectedState), selectedStates.end());
-					mapEngine.setStateColor(selectedState.id, defaultStateColor);
-					renderMapOverlay(mapEngine, mainMapTex, mapCam, mainMapTexWidth, mainMapTexHeight);
-				}
-			}
+			showStateInfo(mapEngine.getStateIndexAt((int)worldPos.x, (int)worldPos.y));
 		}
 
+		if(input.isMouseButtonPressed(MOUSE_BUTTON_LEFT)) selectStateAt(input.getMousePosition());
+
 		// Camera controls
+		ProfileScope controlsScope(profiler, PROFILE_INPUT);
 
 		auto RecomputeBasis = [&](Camera& cam) {
 			Vector3 forward = Vector3Normalize(Vector3Subtract(cam.target, cam.position));
@@ -289,9 +561,9 @@ int main()
 		};
 
 		// Yaw left and right
-		if (IsKeyDown(KEY_LEFT) || IsKeyDown(KEY_RIGHT))
+		if (input.isKeyDown(KEY_LEFT) || input.isKeyDown(KEY_RIGHT))
 		{
-			float yaw = (IsKeyDown(KEY_LEFT) ? -1.0f : 1.0f) * 1.5f * dt;
+			float yaw = (input.isKeyDown(KEY_LEFT) ? -1.0f : 1.0f) * 1.5f * dt;
 			Vector3 offset = Vector3Subtract(camera.position, camera.target);
 
 			offset = Vector3RotateByAxisAngle(offset, (Vector3){0,1,0}, yaw);
@@ -301,9 +573,9 @@ int main()
 		}
 
 		// Pitch up and down
-		if (IsKeyDown(KEY_UP) || IsKeyDown(KEY_DOWN))
+		if (input.isKeyDown(KEY_UP) || input.isKeyDown(KEY_DOWN))
 		{
-			float pitch = (IsKeyDown(KEY_UP) ? -1.0f : 1.0f) * 1.5f * dt;
+			float pitch = (input.isKeyDown(KEY_UP) ? -1.0f : 1.0f) * 1.5f * dt;
 			Vector3 offset = Vector3Subtract(camera.position, camera.target);
 
 			Vector3 forward = Vector3Normalize(Vector3Negate(offset));
@@ -316,8 +588,18 @@ int main()
 			RecomputeBasis(camera);
 		}
 
+		// Map modes, only swaps the per-state palette
+		if(input.isKeyPressed(KEY_ONE)) stateLayers.setMapMode(MAP_MODE_POLITICAL);
+		if(input.isKeyPressed(KEY_TWO)) stateLayers.setMapMode(MAP_MODE_TERRAIN);
+		if(input.isKeyPressed(KEY_THREE)) stateLayers.setMapMode(MAP_MODE_URBAN);
+		if(input.isKeyPressed(KEY_FOUR)) stateLayers.setMapMode(MAP_MODE_COASTAL);
+		if(input.isKeyPressed(KEY_FIVE)) stateLayers.setMapMode(MAP_MODE_CHOROPLETH);
+
+		// Switch between the overlay texture and the draped state geometry
+		if(input.isKeyPressed(KEY_O)) toggleDrape();
+
 		// Reset
-		if(IsKeyPressed(KEY_R))
+		if(input.isKeyPressed(KEY_R))
 		{
 			float dist = Vector3Length(Vector3Subtract(camera.position, camera.target));
 			if (dist <= 1e-6f) dist = camDistance > 0 ? camDistance : 100.0f;
@@ -331,6 +613,55 @@ int main()
 			RecomputeBasis(camera);
 		}
 
+		if(input.isKeyPressed(KEY_F3)) profiler.toggle();
+		if(input.isKeyPressed(KEY_F4)) memoryStats.toggle();
+		if(input.isKeyPressed(KEY_F5))
+		{
+			updateMemoryEstimates();
+			memoryStats.dump(cout);
+		}
+
+		controlsScope.stop();
+
+		// The script owns the camera during a flythrough, whatever the input did above is replaced
+		if(flythrough.isActive())
+		{
+			flythrough.applyCamera(camera, camDistance);
+			targetDistance = camDistance;
+
+			FlythroughEvent event;
+			while(flythroughRunning && flythrough.pollEvent(event))
+			{
+				if(event.type == FLYTHROUGH_PICK)
+				{
+					flythroughPointer = event.point;
+					selectStateAt(event.point);
+				}
+				else if(event.type == FLYTHROUGH_COLOR) assignSelection(event.color);
+				else if(event.type == FLYTHROUGH_MODE) stateLayers.setMapMode((MapMode)(event.mode - 1));
+				else if(event.type == FLYTHROUGH_DRAPE) toggleDrape();
+			}
+		}
+
+		ProfileScope overlayScope(profiler, PROFILE_OVERLAY);
+
+		stateLayers.update();
+
+		// Queue the detail tiles around the camera target, the loader thread reads them in the background.
+		// The loaded ones go into the detail texture the terrain is displaced with.
+		Vector2 streamFocus = { camera.target.x - mapPosition.x, camera.target.z - mapPosition.z };
+		terrainStreamer.update(streamFocus, camDistance * heightTileRadius);
+		terrainStreamer.updateDetail(streamFocus);
+		terrain.setDetail(terrainStreamer.getDetailWindow(), terrainStreamer.getDetailSpacing(), terrainStreamer.getDetailSlots(),
+			terrainStreamer.getDetailSlotSize());
+
+		// Continue any pending overlay rebuild, the old overlay stays bound until the new one is finished
+		if(!overlayBuilder.isComplete() && overlayBuilder.step(mapEngine, mapCam, overlayFrameBudget))
+		{
+			bindOverlayTexture(mapMaterial, overlayShader, OVERLAY_SLOT_STATE_INDEX, "stateIndexMap", overlayBuilder.getTexture());
+		}
+
+		overlayScope.stop();
 
 		BeginDrawing();
 
@@ -338,53 +669,43 @@ int main()
 
 
 		BeginMode3D(camera);
-			DrawModel(mapModel, mapPosition, 1.0f, WHITE);
+		{
+			ProfileScope scope(profiler, PROFILE_TERRAIN);
+			terrain.draw(camera, mapMaterial, mapPosition);
+		}
+		if(drapeStates)
+		{
+			ProfileScope scope(profiler, PROFILE_DRAPE);
+			stateDrape.draw(camera, drapeMaterial, borderMaterial, mapPosition);
+		}
 		EndMode3D();
 
+		ProfileScope guiScope(profiler, PROFILE_GUI);
+
 
-		if (!stateInfo.empty()) {
-            //DrawText(stateInfo.c_str(), 10, screenHeight - 30, 16, YELLOW);
-			DrawTextEx(baseFont, stateInfo.c_str(), {10, (float)(screenHeight - 30)}, 28, 1, YELLOW);
+		if (infoState >= 0) {
+            //DrawText(stateInfo, 10, screenHeight - 30, 16, YELLOW);
+			DrawTextEx(baseFont, stateInfo, {10, (float)(screenHeight - 30)}, 28, 1, YELLOW);
         }
 
 
 		GuiStatusBar((Rectangle){ 0, 00, screenWidth, 48 }, NULL);
 		GuiLabel((Rectangle){ 152, 12, 200, 24 }, "Selected Country");
 
-		// GuiListView that contains all countries
-		std::string countryListStr = "";
-		for (size_t i = 0; i < countries.size(); i++)
-		{
-			countryListStr += countries[i].getId();
-			if (i < countries.size() - 1)
-			{
-				countryListStr += ";";
-			}
-		}
-
 		GuiListView((Rectangle){ 24, 8, 120, 72 }, countryListStr.c_str(), &CountrySelectorScrollIndex, &CountrySelectorActive);
+		input.guiList(CountrySelectorScrollIndex, CountrySelectorActive);
 
-		if(GuiButton((Rectangle){ 500, 10, 200, 28 }, "Add to Country"))
+		if(input.guiClicked(GUI_ADD_TO_COUNTRY, GuiButton((Rectangle){ 500, 10, 200, 28 }, "Add to Country")))
 		{
 			// Set color based on selected country
-			Color countryColor = countries[selectedCountry].getColor();
-			for(const auto& state : selectedStates)
-			{
-				mapEngine.setStateColor(state.id, countryColor);
-			}
-			selectedStates.clear();
-			renderMapOverlay(mapEngine, mainMapTex, mapCam, mainMapTexWidth, mainMapTexHeight);
+			assignSelection(countries[selectedCountry].getColor());
 		}
 
-		if(GuiButton((Rectangle){ 720, 10, 200, 28 }, "Clear Selection"))
+		if(input.guiClicked(GUI_CLEAR_SELECTION, GuiButton((Rectangle){ 720, 10, 200, 28 }, "Clear Selection")))
 		{
 			// Clear all selected states
-			for(const auto& state : selectedStates)
-			{
-				mapEngine.setStateColor(state.id, defaultStateColor);
-			}
 			selectedStates.clear();
-			renderMapOverlay(mapEngine, mainMapTex, mapCam, mainMapTexWidth, mainMapTexHeight);
+			stateLayers.clearFlag(STATE_FLAG_SELECTED);
 		}
 
 		// Set selected country based on active index
@@ -398,42 +719,127 @@ int main()
 		//DrawTexture(heightmap, screenWidth - heightmap.width - 20, 20, WHITE);
 
 		DrawFPS(screenWidth - 100, 15);
+		profiler.draw(screenWidth - 340, 56);
+		if(profiler.isVisible()) drawRenderStats(renderCounters().last, screenWidth - 340, 56 + profiler.getHeight() + 6);
+
+		// A few refreshes a second are plenty, the estimates walk every chunk
+		memoryRefresh -= input.getFrameTime();
+		if(memoryStats.isVisible() && memoryRefresh <= 0.0f)
+		{
+			updateMemoryEstimates();
+			memoryRefresh = 0.25f;
+		}
+		memoryStats.draw(10, 90); // below the country list
+
+		guiScope.stop();
+
+		{
+			ProfileScope scope(profiler, PROFILE_PRESENT);
+			EndDrawing();
+		}
+
+		// Frames still building the overlay allocate its bands, everything else should not touch the heap
+		memoryStats.endFrame(overlayBuilder.isComplete());
+
+		// Script time only starts once the overlay is complete, so the startup upload stays out of the numbers
+		if(flythrough.isActive())
+		{
+			flythroughRunning = flythroughRunning || overlayBuilder.isComplete();
+			if(flythroughRunning) flythrough.advance();
+		}
+	}
+
+	if(input.isReplaying())
+	{
+		double seconds = input.getElapsedSeconds();
+		cout << "Replayed " << input.getFrameCount() << " frames (" << input.getRecordedSeconds() << " s recorded) in " << seconds << " s, "
+			<< (seconds > 0.0 ? input.getFrameCount() / seconds : 0.0) << " frames/s" << endl;
+	}
+	input.close();
 
-		EndDrawing();
+	if(flythrough.isActive())
+	{
+		const char *csvPath = getenv(flythroughCsvVariable);
+		string csv = (csvPath != NULL && csvPath[0] != '\0') ? csvPath : "flythrough.csv";
+
+		PhaseStats frameStats = flythrough.frameStats();
+		cout << "Flythrough frame time p50 " << frameStats.p50 << " ms, p99 " << frameStats.p99 << " ms, max " << frameStats.max
+			<< " ms over " << frameStats.samples << " frames" << endl;
+		if(flythrough.writeCsv(csv)) cout << "Flythrough frames written to " << csv << endl;
 	}
 
-	UnloadTexture(heightmap);
-	UnloadModel(mapModel);
+	terrainStreamer.close();
+	UnloadTexture(heightmapTex);
+	UnloadTexture(lightmapTex);
+	UnloadTexture(colormapTex);
+	terrain.unload();
+	MemFree(mapMaterial.maps); // Shader and textures are unloaded one by one, UnloadMaterial would unload them again
 	UnloadShader(overlayShader);
-	UnloadRenderTexture(mainMapTex);
+	stateDrape.unload();
+	UnloadShader(drapeShader);
+	UnloadShader(borderShader);
+	MemFree(drapeMaterial.maps); // Shares its textures with mapMaterial, UnloadMaterial would unload them twice
+	MemFree(borderMaterial.maps);
+	overlayBuilder.unload();
+	UnloadTexture(borderFieldTex);
+	stateLayers.unload();
 
 	CloseWindow();
+
+	if(Tracer::instance().isEnabled())
+	{
+		Tracer::instance().setEnabled(false);
+		if(Tracer::instance().write(tracePath)) cout << "Trace written to " << tracePath << endl;
+	}
+
 	return 0;
 }
 
-void renderMapOverlay(MapEngine& mapEngine, RenderTexture2D& targetTex, Camera2D& camera, int screenWidth, int screenHeight)
+void setupOverlayShader(Material& mapMaterial, Shader& overlayShader, const Texture2D& mainMapTex, Texture2D& borderFieldTex, StateLayers& stateLayers, Vector3 mapPosition, float sizeX, float sizeZ)
 {
-	BeginTextureMode(targetTex);
-		ClearBackground(BLANK);
-		BeginMode2D(camera);
-			mapEngine.render(camera);
-			mapEngine.render_outline(camera);
-		EndMode2D();
-	EndTextureMode();
+	// Overlay textures are bound through material map slots, so DrawModel binds them on every draw
+	bindOverlayTexture(mapMaterial, overlayShader, OVERLAY_SLOT_STATE_INDEX, "stateIndexMap", mainMapTex);
+	bindOverlayTexture(mapMaterial, overlayShader, OVERLAY_SLOT_BORDER_FIELD, "borderField", borderFieldTex);
+	bindOverlayTexture(mapMaterial, overlayShader, OVERLAY_SLOT_STATE_PALETTE, "statePalette", stateLayers.getPaletteTexture());
+	bindOverlayTexture(mapMaterial, overlayShader, OVERLAY_SLOT_STATE_FLAGS, "stateFlags", stateLayers.getFlagsTexture());
+
+	int locBorderParams = GetShaderLocation(overlayShader, "borderParams");
+
+	float borderParams[2] = { borderMaxDistance, borderWidth };
+	SetShaderValue(overlayShader, locBorderParams, borderParams, SHADER_UNIFORM_VEC2);
+
+	setSharedOverlayUniforms(overlayShader, mapPosition, sizeX, sizeZ);
+
+	mapMaterial.shader = overlayShader;
 }
 
-void setupOverlayShader(Model& mapModel, Shader& overlayShader, RenderTexture2D& mainMapTex, Vector3 mapPosition, float sizeX, float sizeZ)
+void setupDrapeShaders(Material& drapeMaterial, Shader& drapeShader, Material& borderMaterial, Shader& borderShader, StateLayers& stateLayers, const Texture2D& lightmapTex, Vector3 mapPosition, float sizeX, float sizeZ)
 {
-	int locOverlay = GetShaderLocation(overlayShader, "politicalMap");
-	int locOverlayMix  = GetShaderLocation(overlayShader, "overlayMix");
-	int locWorldMinMax = GetShaderLocation(overlayShader, "worldMinMax");
+	// Same slots as the terrain material, the fill reads the state layers, both are lit like the terrain
+	bindOverlayTexture(drapeMaterial, drapeShader, OVERLAY_SLOT_STATE_PALETTE, "statePalette", stateLayers.getPaletteTexture());
+	bindOverlayTexture(drapeMaterial, drapeShader, OVERLAY_SLOT_STATE_FLAGS, "stateFlags", stateLayers.getFlagsTexture());
+	bindOverlayTexture(drapeMaterial, drapeShader, OVERLAY_SLOT_LIGHTMAP, "lightMap", lightmapTex);
+	bindOverlayTexture(borderMaterial, borderShader, OVERLAY_SLOT_LIGHTMAP, "lightMap", lightmapTex);
 
-	// Bind the overlay texture to sampler slot 1
-	SetShaderValueTexture(overlayShader, locOverlay, mainMapTex.texture);
+	// Border width in pixels, and in world units for fading out like the distance field borders
+	float borderParams[2] = { borderWidth, borderWidth * sizeX / mainMapTexWidth };
+	SetShaderValue(borderShader, GetShaderLocation(borderShader, "borderParams"), borderParams, SHADER_UNIFORM_VEC2);
+
+	setSharedOverlayUniforms(drapeShader, mapPosition, sizeX, sizeZ);
+	setSharedOverlayUniforms(borderShader, mapPosition, sizeX, sizeZ);
+
+	drapeMaterial.shader = drapeShader;
+	borderMaterial.shader = borderShader;
+}
+
+// Blend strength, map extent and lighting, shared by the terrain and the draped states
+void setSharedOverlayUniforms(Shader& shader, Vector3 mapPosition, float sizeX, float sizeZ)
+{
+	int locOverlayMix  = GetShaderLocation(shader, "overlayMix");
+	int locWorldMinMax = GetShaderLocation(shader, "worldMinMax");
 
 	// Blend strength
-	float overlayMix = 0.85f;
-	SetShaderValue(overlayShader, locOverlayMix, &overlayMix, SHADER_UNIFORM_FLOAT);
+	SetShaderValue(shader, locOverlayMix, &overlayMix, SHADER_UNIFORM_FLOAT);
 
 	// Setting map size
 	float worldMinMax[4] = {
@@ -442,50 +848,44 @@ void setupOverlayShader(Model& mapModel, Shader& overlayShader, RenderTexture2D&
 		mapPosition.z,          // minZ
 		mapPosition.z + sizeZ   // maxZ
 	};
-	SetShaderValue(overlayShader, locWorldMinMax, worldMinMax, SHADER_UNIFORM_VEC4);
+	SetShaderValue(shader, locWorldMinMax, worldMinMax, SHADER_UNIFORM_VEC4);
 
 	// Lighting uniforms
-	int locLightDir   = GetShaderLocation(overlayShader, "lightDir");
-	int locLightColor = GetShaderLocation(overlayShader, "lightColor");
-	int locAmbient    = GetShaderLocation(overlayShader, "ambient");
+	int locLightDir   = GetShaderLocation(shader, "lightDir");
+	int locLightColor = GetShaderLocation(shader, "lightColor");
+	int locAmbient    = GetShaderLocation(shader, "ambient");
 
-	// Direction TO light 
-	Vector3 lightDir = Vector3Normalize((Vector3){ 0.2f, 1.0f, 0.2f });
+	// Direction TO light, the baked shadows were cast from the same sun
+	Vector3 lightDir = Vector3Normalize(sunDirection);
 	float lightDirV[3] = { lightDir.x, lightDir.y, lightDir.z };
 	float lightColorV[3] = { 1.0f, 1.0f, 1.0f };
 	float ambient = 0.25f; 
 
-	SetShaderValue(overlayShader, locLightDir,   lightDirV,   SHADER_UNIFORM_VEC3);
-	SetShaderValue(overlayShader, locLightColor, lightColorV, SHADER_UNIFORM_VEC3);
-	SetShaderValue(overlayShader, locAmbient,    &ambient,    SHADER_UNIFORM_FLOAT);
+	SetShaderValue(shader, locLightDir,   lightDirV,   SHADER_UNIFORM_VEC3);
+	SetShaderValue(shader, locLightColor, lightColorV, SHADER_UNIFORM_VEC3);
+	SetShaderValue(shader, locAmbient,    &ambient,    SHADER_UNIFORM_FLOAT);
+}
 
-	mapModel.materials[0].shader = overlayShader;
+void bindOverlayTexture(Material& mapMaterial, Shader& overlayShader, int slot, const char *uniformName, const Texture2D& texture)
+{
+	overlayShader.locs[SHADER_LOC_MAP_DIFFUSE + slot] = GetShaderLocation(overlayShader, uniformName);
+	mapMaterial.maps[slot].texture = texture;
 }
 
-Vector2 mouseToMap(Ray ray, Vector3 mapPosition, float sizeX, float sizeZ, MapEngine& mapEngine)
+Vector2 mouseToMap(Ray ray, Vector3 mapPosition, float sizeX, float sizeZ, const Heightfield& heightfield, const TerrainStreamer& terrainStreamer)
 {
-	float denom = ray.direction.y;
-	if (fabsf(denom) > 1e-6f) {
-		float t = -ray.position.y / denom; // since plane point is (0,0,0) and normal is (0,1,0)
-		if (t >= 0.0f) {
-			Vector3 hit = Vector3Add(ray.position, Vector3Scale(ray.direction, t)); // world-space hit
-
-			// Convert world hit to map texture/local coordinates
-			// Your map spans [mapPosition.x, mapPosition.x + sizeX] in X and [mapPosition.z, mapPosition.z + sizeZ] in Z
-			float localX = hit.x - mapPosition.x; // 0..sizeX
-			float localZ = hit.z - mapPosition.z; // 0..sizeZ
-
-			// Optionally clamp
-			if (localX >= 0 && localX <= sizeX && localZ >= 0 && localZ <= sizeZ) {
-				// If your mapEngine expects pixel coords matching heightmap/colormap resolution:
-				float u = localX / sizeX;              // 0..1
-				float v = localZ / sizeZ;              // 0..1
-				int px = (int)(u * mainMapTexWidth);   // or use the geojson pixel space
-				int py = (int)(v * mainMapTexHeight);
-
-				return Vector2{ (float)px, (float)py };
-			}
-		}
+	// Hit the terrain surface itself, so picking stays under the cursor on mountains and at low camera angles.
+	// Where detail tiles are loaded that is the streamed surface the terrain is drawn with.
+	Ray localRay = { Vector3Subtract(ray.position, mapPosition), ray.direction };
+	Vector3 localHit;
+	if (terrainStreamer.raycast(localRay, heightfield, &localHit)) {
+		// Your map spans [0, sizeX] in X and [0, sizeZ] in Z in terrain local space
+		float u = localHit.x / sizeX;              // 0..1
+		float v = localHit.z / sizeZ;              // 0..1
+		int px = (int)(u * mainMapTexWidth);       // or use the geojson pixel space
+		int py = (int)(v * mainMapTexHeight);
+
+		return Vector2{ (float)px, (float)py };
 	}
 
 	return Vector2{};
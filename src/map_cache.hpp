@@ -0,0 +1,245 @@
+#ifndef ARPADICA_MAPCACHE_H
+#define ARPADICA_MAPCACHE_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <cstdint>
+#include <cstring>
+
+#if !defined(_WIN32)
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+	#define ARPADICA_CACHE_MMAP
+#endif
+
+#define MAPCACHE_ERR "Arpadica::MapCache::Error: "
+
+using namespace std;
+
+// Read-only view of the blob of a cache entry. Memory mapped where available, so large entries are paged in straight
+// from the file cache instead of being copied. On Windows the blob is read into memory instead (windows.h clashes
+// with raylib, so no MapViewOfFile).
+class CacheView
+{
+	private:
+		const unsigned char *blob = nullptr;
+		size_t blobSize = 0;
+
+		void *mapping = nullptr;  // whole file, header included
+		size_t mappingSize = 0;
+		vector<unsigned char> buffer;
+
+		friend class MapCache;
+
+	public:
+		CacheView() {}
+		~CacheView() { release(); }
+
+		CacheView(const CacheView&) = delete;
+		CacheView& operator=(const CacheView&) = delete;
+
+		void release()
+		{
+#ifdef ARPADICA_CACHE_MMAP
+			if(mapping != nullptr) munmap(mapping, mappingSize);
+#endif
+			mapping = nullptr;
+			mappingSize = 0;
+			buffer.clear();
+			buffer.shrink_to_fit();
+			blob = nullptr;
+			blobSize = 0;
+		}
+
+		const unsigned char *data() const { return blob; }
+		size_t size() const { return blobSize; }
+		bool isMapped() const { return mapping != nullptr; }
+};
+
+// On-disk cache for data baked or decoded from the map sources (terrain statistics, lightmaps, textures...).
+// Every entry is one file holding a small header and a blob. The header carries a key the caller derives from
+// whatever the data was baked from (usually hashFile of the sources), an entry with a different key is stale
+// and simply gets rebaked and overwritten.
+class MapCache
+{
+	private:
+		static constexpr uint32_t MAGIC = 0x43505241; // "ARPC"
+		static constexpr uint32_t FORMAT_VERSION = 1;
+
+		struct Header
+		{
+			uint32_t magic;
+			uint32_t version;
+			uint64_t key;
+			uint64_t size;
+		};
+
+		string directory;
+
+	public:
+		static constexpr uint64_t HASH_SEED = 14695981039346656037ull; // FNV-1a offset basis
+
+		MapCache(const string& cache_directory = "./cache") : directory(cache_directory) {}
+
+		// FNV-1a over 64 bit words (bytes for the tail), fast enough to hash the map sources on every launch
+		static uint64_t hashBytes(const void *data, size_t size, uint64_t hash = HASH_SEED)
+		{
+			const uint64_t prime = 1099511628211ull;
+			const unsigned char *bytes = (const unsigned char *)data;
+
+			size_t i = 0;
+			for(; i + 8 <= size; i += 8)
+			{
+				uint64_t word;
+				memcpy(&word, bytes + i, sizeof(word));
+				hash = (hash ^ word) * prime;
+			}
+			for(; i < size; i++) hash = (hash ^ bytes[i]) * prime;
+
+			return hash;
+		}
+
+		// Hash of a whole file, 0 when it can not be read
+		static uint64_t hashFile(const string& path)
+		{
+			ifstream file(path, ios::binary);
+			if(!file) return 0;
+
+			uint64_t hash = HASH_SEED;
+			vector<char> buffer(1 << 20);
+			while(file)
+			{
+				file.read(buffer.data(), buffer.size());
+				streamsize got = file.gcount();
+				if(got <= 0) break;
+
+				// Keep whole words together across reads, the buffer size is a multiple of 8
+				hash = hashBytes(buffer.data(), (size_t)got, hash);
+			}
+
+			return hash;
+		}
+
+		// Mix another value (a hash, a version, a resolution...) into a key
+		static uint64_t combine(uint64_t key, uint64_t value)
+		{
+			return hashBytes(&value, sizeof(value), key);
+		}
+
+		string entryPath(const string& name) const
+		{
+			return directory + "/" + name + ".bin";
+		}
+
+		// Read the blob of an entry, fails when it is missing, damaged or was stored under another key
+		bool read(const string& name, uint64_t key, vector<unsigned char>& blob) const
+		{
+			ifstream file(entryPath(name), ios::binary);
+			if(!file) return false;
+
+			Header header;
+			if(!file.read((char *)&header, sizeof(header))) return false;
+			if(header.magic != MAGIC || header.version != FORMAT_VERSION || header.key != key) return false;
+
+			blob.resize((size_t)header.size);
+			if(!file.read((char *)blob.data(), (streamsize)header.size))
+			{
+				blob.clear();
+				return false;
+			}
+
+			return true;
+		}
+
+		// Open the blob of an entry without copying it, fails like read()
+		bool view(const string& name, uint64_t key, CacheView& out) const
+		{
+			out.release();
+			string path = entryPath(name);
+
+#ifdef ARPADICA_CACHE_MMAP
+			int fd = open(path.c_str(), O_RDONLY);
+			if(fd < 0) return false;
+
+			struct stat info;
+			if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(Header))
+			{
+				close(fd);
+				return false;
+			}
+
+			void *mapping = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			close(fd); // the mapping keeps the file alive
+			if(mapping == MAP_FAILED) return false;
+
+			Header header;
+			memcpy(&header, mapping, sizeof(header));
+			if(header.magic != MAGIC || header.version != FORMAT_VERSION || header.key != key || header.size > (uint64_t)info.st_size - sizeof(Header))
+			{
+				munmap(mapping, (size_t)info.st_size);
+				return false;
+			}
+
+			// Entries are read front to back right away, let the kernel start reading ahead
+			madvise(mapping, (size_t)info.st_size, MADV_WILLNEED);
+
+			out.mapping = mapping;
+			out.mappingSize = (size_t)info.st_size;
+			out.blob = (const unsigned char *)mapping + sizeof(Header);
+			out.blobSize = (size_t)header.size;
+			return true;
+#else
+			if(!read(name, key, out.buffer)) return false;
+
+			out.blob = out.buffer.data();
+			out.blobSize = out.buffer.size();
+			return true;
+#endif
+		}
+
+		// Store a blob, written to a temporary file first so a crash never leaves a half written entry behind
+		bool write(const string& name, uint64_t key, const void *data, size_t size) const
+		{
+			error_code ec;
+			filesystem::create_directories(directory, ec);
+
+			string path = entryPath(name);
+			string tempPath = path + ".tmp";
+
+			{
+				ofstream file(tempPath, ios::binary | ios::trunc);
+				if(!file)
+				{
+					cerr << MAPCACHE_ERR << "Could not write cache entry: " << path << endl;
+					return false;
+				}
+
+				Header header = { MAGIC, FORMAT_VERSION, key, (uint64_t)size };
+				file.write((const char *)&header, sizeof(header));
+				file.write((const char *)data, (streamsize)size);
+
+				if(!file)
+				{
+					cerr << MAPCACHE_ERR << "Could not write cache entry: " << path << endl;
+					return false;
+				}
+			}
+
+			filesystem::rename(tempPath, path, ec);
+			if(ec)
+			{
+				cerr << MAPCACHE_ERR << "Could not replace cache entry: " << path << endl;
+				filesystem::remove(tempPath, ec);
+				return false;
+			}
+
+			return true;
+		}
+};
+
+#endif
@@ -5,11 +5,20 @@
 #include "rlgl.h"
 #include "json.hpp"
 #include "earcut.hpp"
+#include "parallel.hpp"
+#include "trace.hpp"
+#include "memory_stats.hpp"
+#include "render_stats.hpp"
+#include "logger.hpp"
 #include <vector>
 #include <string>
 #include <fstream>
 #include <iostream>
 #include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include <cstdint>
+#include <chrono>
 
 #define MAPENGINE_ERR "Arpadica::MapEngine::Error: "
 
@@ -49,16 +58,97 @@ inline bool operator==(const State& a, const State& b)
     return a.id == b.id;
 }
 
+// What loading one feature cost, the slowest ones are worth simplifying
+struct FeatureLoadCost
+{
+	string id;
+	int rings = 0;
+	int vertices = 0;
+	double projectSeconds = 0.0;
+	double triangulateSeconds = 0.0;
+};
+
+// Where LoadMap spent its time. Projection and triangulation are summed over all features, the feature loop
+// includes them plus reading the properties.
+struct MapLoadReport
+{
+	double readSeconds = 0.0;          // file into memory
+	double parseSeconds = 0.0;         // JSON DOM
+	double boundsSeconds = 0.0;        // lon / lat bounds pass
+	double featuresSeconds = 0.0;      // feature loop
+	double projectSeconds = 0.0;       // geo_to_screen of every vertex
+	double triangulateSeconds = 0.0;   // earcut
+	double polygonBoundsSeconds = 0.0; // calculatePolygonBounds
+	double columnsSeconds = 0.0;       // buildAttributeColumns
+	double totalSeconds = 0.0;
+	vector<FeatureLoadCost> features;
+
+	// Indices of the top features by a cost, most expensive first
+	template<typename Cost>
+	vector<size_t> slowest(int top, Cost cost) const
+	{
+		vector<size_t> order(features.size());
+		for(size_t i = 0; i < order.size(); i++) order[i] = i;
+
+		size_t count = min(order.size(), (size_t)max(0, top));
+		partial_sort(order.begin(), order.begin() + count, order.end(), [&](size_t a, size_t b) { return cost(features[a]) > cost(features[b]); });
+		order.resize(count);
+		return order;
+	}
+
+	// Phase table and the top features by triangulation time and by vertex count
+	void log(LoggerLevel level, int top = 10) const
+	{
+		Logger& logger = Logger::instance();
+		if(!logger.isEnabled(level)) return;
+
+		auto phase = [&](const char *name, double seconds) {
+			logger.print(level, "  %-22s %9.1f ms %5.1f %%", name, seconds * 1000.0, totalSeconds > 0.0 ? seconds / totalSeconds * 100.0 : 0.0);
+		};
+
+		logger.print(level, "Map load, %zu features in %.1f ms", features.size(), totalSeconds * 1000.0);
+		phase("Read file", readSeconds);
+		phase("Parse JSON", parseSeconds);
+		phase("Bounds pass", boundsSeconds);
+		phase("Features", featuresSeconds);
+		phase("  Projection", projectSeconds);
+		phase("  Triangulation", triangulateSeconds);
+		phase("Polygon bounds", polygonBoundsSeconds);
+		phase("Attribute columns", columnsSeconds);
+
+		auto list = [&](const char *title, const vector<size_t>& order) {
+			logger.print(level, "%s", title);
+			for(size_t i : order)
+			{
+				const FeatureLoadCost& f = features[i];
+				logger.print(level, "  %-16s %8d vertices %4d rings %9.3f ms triangulate %9.3f ms project", f.id.c_str(), f.vertices, f.rings,
+					f.triangulateSeconds * 1000.0, f.projectSeconds * 1000.0);
+			}
+		};
+
+		list("Slowest to triangulate:", slowest(top, [](const FeatureLoadCost& f) { return f.triangulateSeconds; }));
+		list("Most vertices:", slowest(top, [](const FeatureLoadCost& f) { return (double)f.vertices; }));
+	}
+};
+
 class MapEngine
 {
 	private:
 		vector<State> states;
 
+		// Numeric per-state attributes stored column-wise (one value per state, same order as states)
+		unordered_map<string, vector<float>> columns;
+
 		float min_lat, max_lat;
 		float min_lon, max_lon;
 
 		int screen_width, screen_height;
 
+		MapLoadReport loadReport;
+
+		using LoadClock = chrono::steady_clock;
+		static double secondsSince(LoadClock::time_point start) { return chrono::duration<double>(LoadClock::now() - start).count(); }
+
 		// Convert lat/lon to Web Mercator coordinates (EPSG:3857)
 		pair<double, double> latlon_to_mercator(double lat, double lon)
 		{
@@ -149,25 +239,55 @@ class MapEngine
 
 		bool LoadMap(const string& jsonPath)
 		{
+			TRACE_SCOPE("MapEngine::LoadMap");
+			MemoryScope jsonMemory(MEMORY_MAP_JSON); // the DOM, the state data below is charged to its own tags
 
-			cout << "Loading map definition from " << jsonPath << "..." << endl;
+			logInfo("Loading map definition from %s...", jsonPath.c_str());
+
+			loadReport = MapLoadReport();
+			LoadClock::time_point loadStart = LoadClock::now();
 
 			// Load JSON
-			ifstream file(jsonPath);
+			ifstream file(jsonPath, ios::binary);
 			if(!file.is_open())
 			{
-				cerr << MAPENGINE_ERR << "Failed to open map definition JSON with filename " << jsonPath << endl;
+				logError(MAPENGINE_ERR "Failed to open map definition JSON with filename %s", jsonPath.c_str());
 				return false;
 			}
 
+			// Read and parse separately, so the report tells disk from parser
+			TraceScope readTrace("LoadMap: read JSON");
+			file.seekg(0, ios::end);
+			string text((size_t)max((streamoff)0, (streamoff)file.tellg()), '\0');
+			file.seekg(0, ios::beg);
+			file.read(&text[0], (streamsize)text.size());
+			file.close();
+			loadReport.readSeconds = secondsSince(loadStart);
+			readTrace.end();
+
+			LoadClock::time_point phaseStart = LoadClock::now();
+			TraceScope parseTrace("LoadMap: parse JSON");
 			json geo_data;
-			file >> geo_data;
+			try
+			{
+				geo_data = json::parse(text);
+			}
+			catch(const exception& e)
+			{
+				logError(MAPENGINE_ERR "Failed to parse map definition JSON %s: %s", jsonPath.c_str(), e.what());
+				return false;
+			}
+			string().swap(text);
+			loadReport.parseSeconds = secondsSince(phaseStart);
+			parseTrace.end();
 
-			cout << "Map definition loaded!" << endl;
+			logInfo("Map definition loaded!");
 
 			try
 			{
 				// Calculate bounds
+				phaseStart = LoadClock::now();
+				TraceScope boundsTrace("LoadMap: bounds");
 				for(const auto& feature : geo_data.value("features", json::array()))
 				{
 
@@ -187,7 +307,7 @@ class MapEngine
 
 
 					// Print feature being processed
-					cout << "Calculating bounds for state " << feature["properties"].value("region_id", "") << endl;
+					if(Logger::instance().isEnabled(LOGGER_DEBUG)) logDebug("Calculating bounds for state %s", properties.value("region_id", "").c_str());
 
 					auto geometry = feature.value("geometry", json{});
 					auto coordinates = geometry.value("coordinates", json{});
@@ -239,13 +359,20 @@ class MapEngine
 					}
 				}
 
+				boundsTrace.end();
+				loadReport.boundsSeconds = secondsSince(phaseStart);
+
 				// Parse features and convert coordinates
+				phaseStart = LoadClock::now();
+				TraceScope featuresTrace("LoadMap: features");
 				for(const auto& feature : geo_data["features"])
 				{
+					TRACE_SCOPE("LoadMap: feature");
 
-					cout << "Parsing features for state " << feature["properties"].value("region_id", "") << endl;
+					if(Logger::instance().isEnabled(LOGGER_DEBUG)) logDebug("Parsing features for state %s", feature["properties"].value("region_id", "").c_str());
 
 					State state;
+					FeatureLoadCost cost;
 
 					auto properties = feature["properties"];
 
@@ -272,6 +399,7 @@ class MapEngine
 
 					//cout << "NUTS level check passed, loading state ID..." << endl;
 
+					MemoryScope stringsMemory(MEMORY_STATE_STRINGS);
 					state.id = properties.value("region_id", "");
 
 					//cout << "Checking state name..." << endl;
@@ -307,6 +435,7 @@ class MapEngine
 
 					//cout << "Loading geometry..." << endl;
 
+					MemoryScope geometryMemory(MEMORY_STATE_GEOMETRY);
 					auto geometry = feature["geometry"];
 					auto coordinates = geometry["coordinates"];
 					auto geom_type = geometry.value("type", "");
@@ -322,6 +451,7 @@ class MapEngine
 						// Single polygon
 						for(const auto& ring : coordinates)
 						{
+							LoadClock::time_point projectStart = LoadClock::now();
 							vector<Vector2> screen_points;
 							for(const auto& coord : ring)
 							{
@@ -330,6 +460,9 @@ class MapEngine
 
 									screen_points.push_back(geo_to_screen(lat, lon));
 							}
+							cost.projectSeconds += secondsSince(projectStart);
+							cost.vertices += (int)screen_points.size();
+							cost.rings++;
 
 							// Triangulate polygons (so that we can render concave polygons yippeee)
 
@@ -365,7 +498,10 @@ class MapEngine
 									rings[0].push_back({ (double)p.x, (double)p.y });
 								}
 
+								TRACE_SCOPE("LoadMap: triangulate");
+								LoadClock::time_point triangulateStart = LoadClock::now();
 								vector<uint32_t> indices = mapbox::earcut<uint32_t>(rings);
+								cost.triangulateSeconds += secondsSince(triangulateStart);
 								state.polygon_indices.push_back(move(indices));
 							}
 
@@ -379,6 +515,7 @@ class MapEngine
 						{
 							for(const auto& ring : polygon)
 							{
+								LoadClock::time_point projectStart = LoadClock::now();
 								vector<Vector2> screen_points;
 								for(const auto& coord : ring)
 								{
@@ -387,6 +524,9 @@ class MapEngine
 
 										screen_points.push_back(geo_to_screen(lat, lon));
 								}
+								cost.projectSeconds += secondsSince(projectStart);
+								cost.vertices += (int)screen_points.size();
+								cost.rings++;
 
 								// Triangulate polygons (so that we can render concave polygons yippeee)
 
@@ -422,27 +562,58 @@ class MapEngine
 										rings[0].push_back({ (double)p.x, (double)p.y });
 									}
 
+									TRACE_SCOPE("LoadMap: triangulate");
+									LoadClock::time_point triangulateStart = LoadClock::now();
 									vector<uint32_t> indices = mapbox::earcut<uint32_t>(rings);
+									cost.triangulateSeconds += secondsSince(triangulateStart);
 									state.polygon_indices.push_back(move(indices));
 								}
 							}
 						}
 					}
 
-					if(!state.polygons.empty())
+					logDebug("Loaded state %s with %zu polygons.", state.id.c_str(), state.polygons.size());
+
 					{
-						states.push_back(state);
+						MemoryScope reportMemory(MEMORY_PROFILING);
+						cost.id = state.id;
+						loadReport.projectSeconds += cost.projectSeconds;
+						loadReport.triangulateSeconds += cost.triangulateSeconds;
+						loadReport.features.push_back(move(cost));
 					}
 
-					cout << "Loaded state " << state.id << " with " << state.polygons.size() << " polygons." << endl;
+					// Moved, a copy would charge the strings to the geometry
+					if(!state.polygons.empty())
+					{
+						states.push_back(move(state));
+					}
+					else
+					{
+						logWarning("Arpadica::MapEngine: State %s has no polygons (geometry type %s), skipped", state.id.c_str(), geom_type.c_str());
+					}
 
 				}
 
 
 
-				cout << "Sucessfully loaded " << states.size() << " states!" << endl;
+				featuresTrace.end();
+				loadReport.featuresSeconds = secondsSince(phaseStart);
 
+				logInfo("Sucessfully loaded %zu states!", states.size());
+
+				TraceScope finishTrace("LoadMap: bounds and columns");
+				phaseStart = LoadClock::now();
 				calculatePolygonBounds();
+				loadReport.polygonBoundsSeconds = secondsSince(phaseStart);
+
+				phaseStart = LoadClock::now();
+				buildAttributeColumns();
+				loadReport.columnsSeconds = secondsSince(phaseStart);
+				finishTrace.end();
+
+				loadReport.totalSeconds = secondsSince(loadStart);
+				loadReport.log(LOGGER_INFO);
+				Logger::instance().flush();
 
 				return true;
 				
@@ -451,7 +622,7 @@ class MapEngine
 			}
 			catch(const exception& e)
 			{
-				cerr << MAPENGINE_ERR << e.what() << endl;
+				logError(MAPENGINE_ERR "%s", e.what());
 				return false;
 			}
 			
@@ -460,8 +631,72 @@ class MapEngine
 
 		const vector<State>& getStates() const { return states; }
 
+		// Timings of the last LoadMap
+		const MapLoadReport& getLoadReport() const { return loadReport; }
+
+		// Size of the map coordinate space the state geometry lives in
+		int getMapWidth() const { return screen_width; }
+		int getMapHeight() const { return screen_height; }
+
+		// Rebuild the built-in attribute columns from the loaded states
+		void buildAttributeColumns()
+		{
+			MemoryScope columnsMemory(MEMORY_OTHER); // called while LoadMap charges the DOM
+
+			vector<float> mountain(states.size()), urban(states.size()), coast(states.size()), area(states.size());
+
+			for(size_t i = 0; i < states.size(); i++)
+			{
+				mountain[i] = states[i].mountain_type;
+				urban[i] = states[i].urban_type;
+				coast[i] = states[i].coast_type;
+
+				// Shoelace area of all rings, in map pixels
+				double total = 0.0;
+				for(const auto& polygon : states[i].polygons)
+				{
+					double ring = 0.0;
+					for(size_t a = 0, b = polygon.size() - 1; a < polygon.size(); b = a++)
+					{
+						ring += (double)polygon[b].x * polygon[a].y - (double)polygon[a].x * polygon[b].y;
+					}
+					total += fabs(ring) * 0.5;
+				}
+				area[i] = (float)total;
+			}
+
+			columns["mountain_type"] = move(mountain);
+			columns["urban_type"] = move(urban);
+			columns["coast_type"] = move(coast);
+			columns["area"] = move(area);
+		}
+
+		// Get an attribute column, empty if it does not exist
+		const vector<float>& getColumn(const string& name) const
+		{
+			static const vector<float> empty;
+
+			auto it = columns.find(name);
+			return it != columns.end() ? it->second : empty;
+		}
+
+		// Add or replace an attribute column, values must be in state order
+		bool setColumn(const string& name, vector<float> values)
+		{
+			if(values.size() != states.size())
+			{
+				logError(MAPENGINE_ERR "Column %s has %zu values, expected %zu", name.c_str(), values.size(), states.size());
+				return false;
+			}
+
+			columns[name] = move(values);
+			return true;
+		}
+
 		void calculatePolygonBounds()
 		{
+			MemoryScope geometryMemory(MEMORY_STATE_GEOMETRY);
+
 			for(auto& state : states)
 			{
 				state.polygon_bounds.clear();
@@ -507,7 +742,12 @@ class MapEngine
 			};
 			
 			// Check if polygon bounds intersect with view rectangle
-			return CheckCollisionRecs(bounds, viewRect);
+			bool visible = CheckCollisionRecs(bounds, viewRect);
+
+			RenderStats& stats = renderCounters().current;
+			stats.polygonsTested++;
+			if(!visible) stats.polygonsCulled++;
+			return visible;
 		}
 
 		void render_old()
@@ -561,6 +801,7 @@ class MapEngine
 							if(indexA >= poly.size() || indexB >= poly.size() || indexC >= poly.size()) continue;
 
 							DrawTriangle(poly[indexA], poly[indexC], poly[indexB], fill_color);
+							renderCounters().current.overlayTriangles++;
 							//DrawTriangleLines(poly[indexA], poly[indexB], poly[indexC], edge_color);
 						}
 					}
@@ -570,17 +811,32 @@ class MapEngine
 						for(size_t k = 0; k < poly.size(); ++k)
 						{
 							DrawLineV(poly[k], poly[(k+1) % poly.size()], edge_color);
+							renderCounters().current.outlineSegments++;
 						}
 					}
 				}
 			}
 		}
 
-		void render(Camera2D camera) {
+		// Render visible states in [first_state, last_state). With encode_index every state is drawn with its index + 1
+		// packed into the RGB channels instead of its color, producing the state index overlay.
+		void render(Camera2D camera, bool encode_index = false, size_t first_state = 0, size_t last_state = SIZE_MAX) {
+			RenderStats& stats = renderCounters().current;
 			rlBegin(RL_TRIANGLES);
 			
-			for(const auto& state : states) {
-				rlColor4ub(state.color.r, state.color.g, state.color.b, state.color.a);
+			last_state = min(last_state, states.size());
+			for(size_t state_index = first_state; state_index < last_state; ++state_index) {
+				const auto& state = states[state_index];
+
+				if(encode_index)
+				{
+					uint32_t encoded = (uint32_t)state_index + 1;
+					rlColor4ub(encoded & 0xFF, (encoded >> 8) & 0xFF, (encoded >> 16) & 0xFF, 255);
+				}
+				else
+				{
+					rlColor4ub(state.color.r, state.color.g, state.color.b, state.color.a);
+				}
 				
 				for(size_t poly_index = 0; poly_index < state.polygons.size(); ++poly_index) {
 					const auto& poly = state.polygons[poly_index];
@@ -602,6 +858,10 @@ class MapEngine
 						uint32_t idxA = indices[i], idxB = indices[i+1], idxC = indices[i+2];
 						if(idxA >= poly.size() || idxB >= poly.size() || idxC >= poly.size()) continue;
 						
+						// Flush a full batch here rather than inside rlVertex, so it shows up in the stats
+						reserveRenderBatch(3);
+						stats.overlayTriangles++;
+
 						rlVertex2f(poly[idxA].x, poly[idxA].y);
 						rlVertex2f(poly[idxC].x, poly[idxC].y);
 						rlVertex2f(poly[idxB].x, poly[idxB].y);
@@ -612,49 +872,129 @@ class MapEngine
 			rlEnd();
 		}
 
-		void render_outline(Camera2D camera)
+		// Bake the distance to the nearest state border into a grayscale field of field_w x field_h texels.
+		// Distances are measured in map pixels, clamped to max_distance and stored as 0..255.
+		// The overlay shader uses this to draw antialiased borders at any zoom level.
+		Image bakeBorderField(int field_w, int field_h, float max_distance)
 		{
-			const Color edge_color = WHITE;
+			TRACE_SCOPE("MapEngine::bakeBorderField");
+			struct Segment { Vector2 a, b; };
 
-			for (const auto& state : states) {
-				for (size_t poly_index = 0; poly_index < state.polygons.size(); ++poly_index)
+			// Work in field texel space
+			float scale_x = (float)field_w / screen_width;
+			float scale_y = (float)field_h / screen_height;
+			float radius = max_distance * max(scale_x, scale_y);
+
+			// Bucket every border segment into horizontal bands so each worker only looks at nearby segments
+			const int band_height = 32;
+			int band_count = (field_h + band_height - 1) / band_height;
+			vector<vector<Segment>> bands(band_count);
+
+			for(const auto& state : states)
+			{
+				for(const auto& polygon : state.polygons)
 				{
-					const auto& polygon = state.polygons[poly_index];
-					if (polygon.size() < 3) continue;
+					if(polygon.size() < 2) continue;
 
-					if(poly_index < state.polygon_bounds.size())
+					for(size_t i = 0; i < polygon.size(); i++)
 					{
-						if(!isVisibleInCamera(state.polygon_bounds[poly_index], camera, screen_width, screen_height))
+						const Vector2& p = polygon[i];
+						const Vector2& q = polygon[(i + 1) % polygon.size()];
+
+						Segment seg = { { p.x * scale_x, p.y * scale_y }, { q.x * scale_x, q.y * scale_y } };
+
+						int first_band = (int)floorf((min(seg.a.y, seg.b.y) - radius) / band_height);
+						int last_band = (int)floorf((max(seg.a.y, seg.b.y) + radius) / band_height);
+						first_band = max(first_band, 0);
+						last_band = min(last_band, band_count - 1);
+
+						for(int b = first_band; b <= last_band; b++)
 						{
-							continue; 
+							bands[b].push_back(seg);
 						}
 					}
-					else
+				}
+			}
+
+			unsigned char *field = (unsigned char *)MemAlloc(field_w * field_h);
+			memset(field, 255, field_w * field_h);
+
+			float inv_radius = 1.0f / radius;
+
+			parallelFor(0, band_count, [&](int band_begin, int band_end)
+			{
+				for(int b = band_begin; b < band_end; b++)
+				{
+					int row_begin = b * band_height;
+					int row_end = min(row_begin + band_height, field_h);
+
+					for(const auto& seg : bands[b])
 					{
-						continue;
-					}
-					
-					// Draw outline
-					for (size_t i = 0; i < polygon.size() - 1; i++) {
-						DrawLineV(polygon[i], polygon[i + 1], edge_color);
-					}
-					// Close the polygon
-					if (polygon.size() > 2) {
-						DrawLineV(polygon.back(), polygon[0], edge_color);
-					}
+						// Texel rectangle the segment can reach, clipped to this band
+						int x0 = max(0, (int)floorf(min(seg.a.x, seg.b.x) - radius));
+						int x1 = min(field_w - 1, (int)ceilf(max(seg.a.x, seg.b.x) + radius));
+						int y0 = max(row_begin, (int)floorf(min(seg.a.y, seg.b.y) - radius));
+						int y1 = min(row_end - 1, (int)ceilf(max(seg.a.y, seg.b.y) + radius));
 
+						Vector2 ab = { seg.b.x - seg.a.x, seg.b.y - seg.a.y };
+						float len_sq = ab.x * ab.x + ab.y * ab.y;
+						float inv_len_sq = len_sq > 1e-12f ? 1.0f / len_sq : 0.0f;
+
+						for(int y = y0; y <= y1; y++)
+						{
+							unsigned char *row = field + (size_t)y * field_w;
+							float py = y + 0.5f - seg.a.y;
+
+							for(int x = x0; x <= x1; x++)
+							{
+								float px = x + 0.5f - seg.a.x;
+
+								// Closest point on the segment
+								float t = (px * ab.x + py * ab.y) * inv_len_sq;
+								t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+
+								float dx = px - ab.x * t;
+								float dy = py - ab.y * t;
+								float dist = sqrtf(dx * dx + dy * dy) * inv_radius;
+								if(dist >= 1.0f) continue;
+
+								unsigned char encoded = (unsigned char)(dist * 255.0f);
+								if(encoded < row[x]) row[x] = encoded;
+							}
+						}
+					}
 				}
-			}
+			});
+
+			Image image = { 0 };
+			image.data = field;
+			image.width = field_w;
+			image.height = field_h;
+			image.mipmaps = 1;
+			image.format = PIXELFORMAT_UNCOMPRESSED_GRAYSCALE;
+
+			return image;
 		}
 
-		State getStateAt(int x, int y)
+		// Index of the state under a map position, -1 if there is none
+		int getStateIndexAt(int x, int y) const
 		{
 			Vector2 point = {(float)x, (float)y};
 
-			for(const auto& state : states)
+			for(size_t state_index = 0; state_index < states.size(); ++state_index)
 			{
-				for(const auto& polygon : state.polygons)
+				const auto& state = states[state_index];
+
+				for(size_t poly_index = 0; poly_index < state.polygons.size(); ++poly_index)
 				{
+					const auto& polygon = state.polygons[poly_index];
+
+					// Cheap bounds rejection before the full test
+					if(poly_index < state.polygon_bounds.size() && !CheckCollisionPointRec(point, state.polygon_bounds[poly_index]))
+					{
+						continue;
+					}
+
 					// Simplified point-in-polygon check
 					bool inside = false;
 					for (size_t i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++) {
@@ -665,12 +1005,38 @@ class MapEngine
 						}
 					}
 					if (inside) {
-						return state;
+						return (int)state_index;
 					}
 				}
 			}
 
-			return State{};
+			return -1;
+		}
+
+		State getStateAt(int x, int y)
+		{
+			int state_index = getStateIndexAt(x, y);
+			return state_index >= 0 ? states[state_index] : State{};
+		}
+
+		int getStateIndex(const string& id) const
+		{
+			for(size_t i = 0; i < states.size(); i++)
+			{
+				if(states[i].id == id)
+				{
+					return (int)i;
+				}
+			}
+
+			return -1;
+		}
+
+		void setStateColor(int state_index, const Color& color)
+		{
+			if(state_index < 0 || state_index >= (int)states.size()) return;
+
+			states[state_index].color = color;
 		}
 
 		void setStateColor(const string& id, const Color& color)
@@ -0,0 +1,371 @@
+#ifndef ARPADICA_MEMORY_STATS_H
+#define ARPADICA_MEMORY_STATS_H
+
+#include "raylib.h"
+#include <atomic>
+#include <new>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+
+using namespace std;
+
+// Subsystems heap allocations are charged to. The tag is per thread, set with MemoryScope.
+enum MemoryTag
+{
+	MEMORY_OTHER = 0,
+	MEMORY_MAP_JSON,        // nlohmann DOM of the map while it loads
+	MEMORY_STATE_GEOMETRY,  // polygons, triangulation and bounds of the states
+	MEMORY_STATE_STRINGS,   // ids and names of the states
+	MEMORY_TERRAIN,         // heightfields, chunk geometry and streamed tiles
+	MEMORY_OVERLAY,         // overlay bands, rasterizer and per-state layers
+	MEMORY_DRAPE,           // draped state geometry while it is built
+	MEMORY_PROFILING,       // trace buffers and benchmark records
+
+	MEMORY_TAG_COUNT
+};
+
+static const char *memoryTagNames[MEMORY_TAG_COUNT] = {
+	"Other", "Map JSON", "State geometry", "State strings", "Terrain", "Overlay", "Drape", "Profiling"
+};
+
+// Heap bytes per tag, counted by the operator new / delete replacements below. Only atomics, so it is usable from
+// the first allocation of the program to the last.
+struct MemoryCounters
+{
+	atomic<int64_t> current[MEMORY_TAG_COUNT];
+	atomic<int64_t> peak[MEMORY_TAG_COUNT];
+	atomic<int64_t> allocations[MEMORY_TAG_COUNT];
+	atomic<int64_t> totalCurrent;
+	atomic<int64_t> totalPeak;
+
+	static void raisePeak(atomic<int64_t>& peak, int64_t value)
+	{
+		int64_t seen = peak.load(memory_order_relaxed);
+		while(value > seen && !peak.compare_exchange_weak(seen, value, memory_order_relaxed)) {}
+	}
+
+	void allocated(MemoryTag tag, int64_t bytes)
+	{
+		raisePeak(peak[tag], current[tag].fetch_add(bytes, memory_order_relaxed) + bytes);
+		raisePeak(totalPeak, totalCurrent.fetch_add(bytes, memory_order_relaxed) + bytes);
+		allocations[tag].fetch_add(1, memory_order_relaxed);
+	}
+
+	void freed(MemoryTag tag, int64_t bytes)
+	{
+		current[tag].fetch_sub(bytes, memory_order_relaxed);
+		totalCurrent.fetch_sub(bytes, memory_order_relaxed);
+	}
+};
+
+// Zero initialized before anything runs and never destroyed, allocations during static destruction still count
+inline MemoryCounters& memoryCounters()
+{
+	static MemoryCounters counters;
+	return counters;
+}
+
+inline MemoryTag& currentMemoryTag()
+{
+	thread_local MemoryTag tag = MEMORY_OTHER;
+	return tag;
+}
+
+// Heap allocations made by this thread, those for profiling left out
+inline int64_t& threadAllocationCount()
+{
+	thread_local int64_t count = 0;
+	return count;
+}
+
+// Charge the heap allocations of this thread to a tag until the scope closes. Frees are always charged to the tag
+// the block was allocated under.
+class MemoryScope
+{
+	private:
+		MemoryTag previous;
+
+	public:
+		MemoryScope(MemoryTag tag) : previous(currentMemoryTag()) { currentMemoryTag() = tag; }
+		~MemoryScope() { currentMemoryTag() = previous; }
+
+		MemoryScope(const MemoryScope&) = delete;
+		MemoryScope& operator=(const MemoryScope&) = delete;
+};
+
+// Estimated bytes of a texture with all its mip levels
+inline size_t textureBytes(Texture2D texture)
+{
+	size_t bytes = 0;
+	int w = texture.width, h = texture.height;
+	for(int level = 0; level < max(1, texture.mipmaps) && texture.id > 0; level++)
+	{
+		bytes += (size_t)GetPixelDataSize(max(1, w), max(1, h), texture.format);
+		w /= 2;
+		h /= 2;
+	}
+	return bytes;
+}
+
+// Color texture plus the 32 bit depth buffer raylib attaches
+inline size_t renderTextureBytes(RenderTexture2D target)
+{
+	if(target.id == 0) return 0;
+	return textureBytes(target.texture) + (size_t)target.texture.width * target.texture.height * 4;
+}
+
+// GPU buffers of an uploaded mesh, 16 bit indices
+inline size_t meshGpuBytes(const Mesh& mesh)
+{
+	if(mesh.vaoId == 0) return 0;
+
+	size_t floatsPerVertex = 3 + 3 + 2; // positions, normals, texcoords are always allocated by UploadMesh
+	if(mesh.tangents != NULL || mesh.vboId[4] != 0) floatsPerVertex += 4;
+	if(mesh.colors != NULL || mesh.vboId[3] != 0) floatsPerVertex += 1;
+
+	return (size_t)mesh.vertexCount * floatsPerVertex * sizeof(float) + (size_t)mesh.triangleCount * 3 * sizeof(unsigned short);
+}
+
+// Atlas and glyph images of a font, on the GPU and on the CPU
+inline size_t fontGpuBytes(const Font& font) { return textureBytes(font.texture); }
+
+inline size_t fontCpuBytes(const Font& font)
+{
+	size_t bytes = (size_t)font.glyphCount * (sizeof(GlyphInfo) + sizeof(Rectangle));
+	for(int i = 0; i < font.glyphCount && font.glyphs != NULL; i++)
+	{
+		const Image& image = font.glyphs[i].image;
+		if(image.data != NULL) bytes += (size_t)GetPixelDataSize(image.width, image.height, image.format);
+	}
+	return bytes;
+}
+
+// Memory report: tagged heap from the counters, plus named estimates for what raylib allocates itself (RAM) and
+// for textures and meshes (VRAM). Estimates are set by the owner with setEstimate(), main thread only.
+//
+// It also counts the heap allocations of every main loop frame. Once loading is over an idle frame should not
+// allocate at all, frames that do are counted and, with the check on, reported on cerr.
+class MemoryStats
+{
+	public:
+		enum Pool { RAM = 0, VRAM };
+
+	private:
+		struct Estimate
+		{
+			const char *name; // string literal
+			Pool pool;
+			size_t bytes;
+			size_t peak;
+		};
+
+		vector<Estimate> estimates;
+		bool visible = false;
+
+		// Allocation check
+		int64_t frameStartAllocations = 0;
+		int64_t lastFrameAllocations = 0;
+		long frames = 0;
+		long allocatingFrames = 0;
+		bool allocationCheck = false;
+
+		// TextFormat buffer, valid for the next few TextFormat calls
+		static const char *megabytes(double bytes)
+		{
+			return TextFormat("%.1f", bytes / (1024.0 * 1024.0));
+		}
+
+	public:
+		// Current size of a named estimate, the peak is kept. name has to outlive the report, a literal.
+		void setEstimate(const char *name, Pool pool, size_t bytes)
+		{
+			for(auto& estimate : estimates)
+			{
+				if(estimate.pool == pool && strcmp(estimate.name, name) == 0)
+				{
+					estimate.bytes = bytes;
+					estimate.peak = max(estimate.peak, bytes);
+					return;
+				}
+			}
+
+			estimates.push_back({ name, pool, bytes, bytes });
+		}
+
+		size_t getEstimateTotal(Pool pool) const
+		{
+			size_t total = 0;
+			for(const auto& estimate : estimates) if(estimate.pool == pool) total += estimate.bytes;
+			return total;
+		}
+
+		void toggle() { visible = !visible; }
+		bool isVisible() const { return visible; }
+
+		// Report every allocating steady frame on cerr
+		void setAllocationCheck(bool enabled) { allocationCheck = enabled; }
+
+		// Bracket a main loop frame, on the main thread. steady is false while the frame is still expected to
+		// allocate, like while loading or rebuilding the overlay.
+		void beginFrame() { frameStartAllocations = threadAllocationCount(); }
+
+		void endFrame(bool steady)
+		{
+			lastFrameAllocations = threadAllocationCount() - frameStartAllocations;
+			if(!steady) return;
+
+			frames++;
+			if(lastFrameAllocations == 0) return;
+
+			allocatingFrames++;
+			if(allocationCheck) cerr << "Arpadica::MemoryStats: steady frame " << frames << " made " << lastFrameAllocations << " heap allocations" << endl;
+		}
+
+		int64_t getLastFrameAllocations() const { return lastFrameAllocations; }
+		long getAllocatingFrames() const { return allocatingFrames; }
+
+		void dump(ostream& out) const
+		{
+			const MemoryCounters& counters = memoryCounters();
+			out << left;
+
+			out << "Heap (tracked)           current MB   peak MB   allocations" << endl;
+			for(int tag = 0; tag < MEMORY_TAG_COUNT; tag++)
+			{
+				out << "  " << setw(22) << memoryTagNames[tag] << " " << setw(12) << megabytes((double)counters.current[tag].load())
+					<< " " << setw(9) << megabytes((double)counters.peak[tag].load()) << " " << counters.allocations[tag].load() << endl;
+			}
+			out << "  " << setw(22) << "Total" << " " << setw(12) << megabytes((double)counters.totalCurrent.load())
+				<< " " << megabytes((double)counters.totalPeak.load()) << endl;
+
+			for(int pool = RAM; pool <= VRAM; pool++)
+			{
+				out << (pool == RAM ? "Untracked RAM (est.)     " : "VRAM (est.)              ") << "current MB   peak MB" << endl;
+				for(const auto& estimate : estimates)
+				{
+					if(estimate.pool != pool) continue;
+					out << "  " << setw(22) << estimate.name << " " << setw(12) << megabytes((double)estimate.bytes) << " " << megabytes((double)estimate.peak) << endl;
+				}
+				out << "  " << setw(22) << "Total" << " " << megabytes((double)getEstimateTotal((Pool)pool)) << endl;
+			}
+
+			out << "Steady frames allocating: " << allocatingFrames << " of " << frames << endl;
+
+			out << right;
+		}
+
+		// Current / peak MB per tag and estimate
+		void draw(int x, int y) const
+		{
+			if(!visible) return;
+
+			const MemoryCounters& counters = memoryCounters();
+			const int rowHeight = 18;
+			int rows = MEMORY_TAG_COUNT + (int)estimates.size() + 7;
+
+			DrawRectangle(x, y, 330, rowHeight * rows + 8, Fade(BLACK, 0.7f));
+
+			int rowY = y + 4;
+			auto row = [&](const char *name, double current, double peak, Color color) {
+				DrawText(name, x + 6, rowY, 16, color);
+				DrawText(megabytes(current), x + 190, rowY, 16, color);
+				if(peak >= 0.0) DrawText(megabytes(peak), x + 260, rowY, 16, color);
+				rowY += rowHeight;
+			};
+
+			DrawText("Heap MB", x + 6, rowY, 16, LIGHTGRAY);
+			DrawText("now", x + 190, rowY, 16, LIGHTGRAY);
+			DrawText("peak", x + 260, rowY, 16, LIGHTGRAY);
+			rowY += rowHeight;
+
+			for(int tag = 0; tag < MEMORY_TAG_COUNT; tag++)
+			{
+				row(memoryTagNames[tag], (double)counters.current[tag].load(), (double)counters.peak[tag].load(), RAYWHITE);
+			}
+			row("Total", (double)counters.totalCurrent.load(), (double)counters.totalPeak.load(), YELLOW);
+
+			for(int pool = RAM; pool <= VRAM; pool++)
+			{
+				DrawText(pool == RAM ? "Untracked RAM MB" : "VRAM MB", x + 6, rowY, 16, LIGHTGRAY);
+				rowY += rowHeight;
+
+				for(const auto& estimate : estimates)
+				{
+					if(estimate.pool == pool) row(estimate.name, (double)estimate.bytes, (double)estimate.peak, RAYWHITE);
+				}
+				row("Total", (double)getEstimateTotal((Pool)pool), -1.0, YELLOW);
+			}
+
+			// Allocations of the last frame and how many steady frames allocated so far
+			DrawText(TextFormat("Frame allocs %lld, bad frames %ld", (long long)lastFrameAllocations, allocatingFrames), x + 6, rowY, 16,
+				allocatingFrames > 0 ? ORANGE : LIGHTGRAY);
+		}
+};
+
+// The replacements of the global operator new and delete, define MEMORY_STATS_IMPLEMENTATION in exactly one
+// translation unit. Every block gets a 16 byte header with its size and tag, which keeps the alignment malloc gives.
+#ifdef MEMORY_STATS_IMPLEMENTATION
+
+struct alignas(16) MemoryBlockHeader
+{
+	uint64_t size;
+	uint32_t tag;
+};
+
+static_assert(sizeof(MemoryBlockHeader) == 16, "Memory block header must keep malloc alignment");
+
+inline void *trackedAllocate(size_t size)
+{
+	MemoryBlockHeader *header = (MemoryBlockHeader *)malloc(size + sizeof(MemoryBlockHeader));
+	if(header == nullptr) return nullptr;
+
+	MemoryTag tag = currentMemoryTag();
+	header->size = size;
+	header->tag = tag;
+	memoryCounters().allocated(tag, (int64_t)size);
+	if(tag != MEMORY_PROFILING) threadAllocationCount()++;
+	return header + 1;
+}
+
+inline void trackedFree(void *pointer)
+{
+	if(pointer == nullptr) return;
+
+	MemoryBlockHeader *header = (MemoryBlockHeader *)pointer - 1;
+	memoryCounters().freed((MemoryTag)header->tag, (int64_t)header->size);
+	free(header);
+}
+
+void *operator new(size_t size)
+{
+	void *pointer = trackedAllocate(size);
+	if(pointer == nullptr) throw bad_alloc();
+	return pointer;
+}
+
+void *operator new[](size_t size)
+{
+	void *pointer = trackedAllocate(size);
+	if(pointer == nullptr) throw bad_alloc();
+	return pointer;
+}
+
+void *operator new(size_t size, const nothrow_t&) noexcept { return trackedAllocate(size); }
+void *operator new[](size_t size, const nothrow_t&) noexcept { return trackedAllocate(size); }
+
+void operator delete(void *pointer) noexcept { trackedFree(pointer); }
+void operator delete[](void *pointer) noexcept { trackedFree(pointer); }
+void operator delete(void *pointer, size_t) noexcept { trackedFree(pointer); }
+void operator delete[](void *pointer, size_t) noexcept { trackedFree(pointer); }
+void operator delete(void *pointer, const nothrow_t&) noexcept { trackedFree(pointer); }
+void operator delete[](void *pointer, const nothrow_t&) noexcept { trackedFree(pointer); }
+
+#endif
+
+#endif
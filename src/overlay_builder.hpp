@@ -0,0 +1,291 @@
+#ifndef ARPADICA_OVERLAYBUILDER_H
+#define ARPADICA_OVERLAYBUILDER_H
+
+#include "raylib.h"
+#include "rlgl.h"
+#include "map_engine.hpp"
+#include "rasterizer.hpp"
+#include "trace.hpp"
+#include "memory_stats.hpp"
+#include "render_stats.hpp"
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+
+// Rebuilds the state index overlay under a per-frame time budget.
+// The previous overlay stays on screen until the new one is complete, then the two are swapped.
+// Until the very first build completes there is nothing to keep, so it renders straight into the visible texture.
+//
+// Two ways to build:
+//  - GPU: states are drawn through rlgl a batch at a time on the GL thread
+//  - software: a background thread rasterizes row bands with SoftwareRasterizer, the GL thread only uploads them
+class OverlayBuilder
+{
+	private:
+		static constexpr int BAND_ROWS = 64;    // rows per uploaded band (4 MB at 16k wide)
+		static constexpr size_t MAX_QUEUED = 8; // bands waiting for upload, bounds the memory in flight
+
+		struct Band
+		{
+			int row_begin, row_end;
+			vector<uint32_t> pixels; // bottom-up rows, ready for uploadRasterRows
+			RasterStats stats;
+		};
+
+		int width = 0, height = 0;
+		bool software = false;
+
+		RenderTexture2D front = { 0 }; // visible overlay
+		RenderTexture2D back = { 0 };  // overlay under construction, only allocated while rebuilding
+
+		bool hasContent = false; // front holds a finished overlay
+		bool building = false;
+
+		// GPU path
+		size_t nextState = 0;
+		size_t totalStates = 0;
+		double secondsPerState = 0.0; // running estimate used to size the next batch
+
+		// Software path
+		SoftwareRasterizer rasterizer;
+		thread worker;
+		mutex queueMutex;
+		condition_variable queueSpace;
+		deque<Band> readyBands;
+		atomic<bool> cancelWorker{ false };
+		int uploadedRows = 0;
+
+		RenderTexture2D loadTarget()
+		{
+			RenderTexture2D target = LoadRenderTexture(width, height);
+			SetTextureFilter(target.texture, TEXTURE_FILTER_POINT); // Holds state indices, must never be blended
+			SetTextureWrap(target.texture, TEXTURE_WRAP_CLAMP);
+			return target;
+		}
+
+		RenderTexture2D& target() { return hasContent ? back : front; }
+
+		void stopWorker()
+		{
+			if(worker.joinable())
+			{
+				cancelWorker = true;
+				queueSpace.notify_all();
+				worker.join();
+			}
+
+			cancelWorker = false;
+			readyBands.clear();
+		}
+
+		void rasterizeBands()
+		{
+			Tracer::instance().setThreadName("Overlay rasterizer");
+			MemoryScope memory(MEMORY_OVERLAY);
+
+			for(int row = 0; row < height && !cancelWorker; row += BAND_ROWS)
+			{
+				TRACE_SCOPE("OverlayBuilder: rasterize band");
+
+				Band band;
+				band.row_begin = row;
+				band.row_end = min(row + BAND_ROWS, height);
+				band.pixels.resize((size_t)width * (band.row_end - band.row_begin));
+
+				rasterizer.rasterizeIndices(band.row_begin, band.row_end, band.pixels.data(), true, &band.stats);
+
+				unique_lock<mutex> lock(queueMutex);
+				queueSpace.wait(lock, [&]() { return readyBands.size() < MAX_QUEUED || cancelWorker; });
+				if(cancelWorker) return;
+
+				readyBands.push_back(move(band));
+			}
+		}
+
+		// Finish a build, swapping in the new overlay and releasing the old one
+		bool complete()
+		{
+			building = false;
+
+			if(hasContent)
+			{
+				swap(front, back);
+				UnloadRenderTexture(back);
+				back = { 0 };
+			}
+			hasContent = true;
+
+			return true;
+		}
+
+		bool stepGPU(MapEngine& mapEngine, Camera2D camera, double budget_seconds)
+		{
+			double start = GetTime();
+
+			BeginTextureMode(target());
+				BeginMode2D(camera);
+
+				while(nextState < totalStates)
+				{
+					double elapsed = GetTime() - start;
+					if(elapsed >= budget_seconds) break;
+
+					// Size the batch so it is expected to fit into the remaining budget, at least one state
+					size_t batch = 1;
+					if(secondsPerState > 0.0)
+					{
+						batch = (size_t)max(1.0, (budget_seconds - elapsed) / secondsPerState);
+					}
+					batch = min(batch, totalStates - nextState);
+
+					double batchStart = GetTime();
+					mapEngine.render(camera, true, nextState, nextState + batch);
+					flushRenderBatch();
+					double batchSeconds = GetTime() - batchStart;
+
+					// Exponential moving average of the per-state cost
+					double perState = batchSeconds / batch;
+					secondsPerState = secondsPerState > 0.0 ? secondsPerState * 0.75 + perState * 0.25 : perState;
+
+					nextState += batch;
+				}
+
+				EndMode2D();
+			EndTextureMode();
+
+			return nextState >= totalStates ? complete() : false;
+		}
+
+		bool stepSoftware(double budget_seconds)
+		{
+			double start = GetTime();
+
+			// Upload whatever bands are ready, never waiting for the worker
+			while(uploadedRows < height && GetTime() - start < budget_seconds)
+			{
+				Band band;
+				{
+					unique_lock<mutex> lock(queueMutex, try_to_lock);
+					if(!lock.owns_lock() || readyBands.empty()) break;
+
+					band = move(readyBands.front());
+					readyBands.pop_front();
+				}
+				queueSpace.notify_one();
+
+				uploadRasterRows(target().texture, band.row_begin, band.row_end, band.pixels.data());
+				uploadedRows = band.row_end;
+
+				// Counted in the frame the band shows up, the worker can't touch the render counters
+				RenderStats& stats = renderCounters().current;
+				stats.polygonsTested += band.stats.ringsTested;
+				stats.polygonsCulled += band.stats.ringsCulled;
+				stats.overlayEdges += band.stats.edges;
+				stats.overlaySpans += band.stats.spans;
+			}
+
+			if(uploadedRows < height) return false;
+
+			worker.join();
+			return complete();
+		}
+
+	public:
+		OverlayBuilder() {}
+		~OverlayBuilder() { stopWorker(); }
+
+		OverlayBuilder(const OverlayBuilder&) = delete;
+		OverlayBuilder& operator=(const OverlayBuilder&) = delete;
+
+		// With use_software the overlay is rasterized on the CPU off the GL thread
+		void load(int overlay_w, int overlay_h, bool use_software = false)
+		{
+			unload();
+
+			width = overlay_w;
+			height = overlay_h;
+			software = use_software;
+			front = loadTarget();
+
+			BeginTextureMode(front);
+				ClearBackground(BLANK);
+			EndTextureMode();
+		}
+
+		// Visible overlay, and the one under construction while rebuilding
+		size_t getGpuBytes() const { return renderTextureBytes(front) + renderTextureBytes(back); }
+
+		void unload()
+		{
+			stopWorker();
+
+			if(front.id > 0) UnloadRenderTexture(front);
+			if(back.id > 0) UnloadRenderTexture(back);
+
+			front = { 0 };
+			back = { 0 };
+			hasContent = false;
+			building = false;
+		}
+
+		// Start a full rebuild, restarts any rebuild already in progress.
+		// The software path reads the state geometry from a background thread until the build completes.
+		void begin(const MapEngine& mapEngine)
+		{
+			MemoryScope memory(MEMORY_OVERLAY);
+			stopWorker();
+
+			if(hasContent && back.id == 0) back = loadTarget();
+
+			building = true;
+
+			if(software)
+			{
+				// Every row gets uploaded, no clear needed
+				uploadedRows = 0;
+				rasterizer.prepare(mapEngine, width, height);
+				worker = thread(&OverlayBuilder::rasterizeBands, this);
+				return;
+			}
+
+			BeginTextureMode(target());
+				ClearBackground(BLANK);
+			EndTextureMode();
+
+			nextState = 0;
+			totalStates = mapEngine.getStates().size();
+		}
+
+		// Work on the rebuild until budget_seconds are used up. Returns true on the frame the rebuild completes,
+		// after which getTexture() returns the new overlay.
+		bool step(MapEngine& mapEngine, Camera2D camera, double budget_seconds)
+		{
+			TRACE_SCOPE("OverlayBuilder::step");
+			if(!building) return false;
+
+			return software ? stepSoftware(budget_seconds) : stepGPU(mapEngine, camera, budget_seconds);
+		}
+
+		// Rebuild everything right away, ignoring the budget
+		void buildNow(MapEngine& mapEngine, Camera2D camera)
+		{
+			begin(mapEngine);
+			while(!step(mapEngine, camera, 1e9)) this_thread::yield();
+		}
+
+		bool isComplete() const { return !building; }
+
+		float getProgress() const
+		{
+			if(!building) return 1.0f;
+			if(software) return height > 0 ? (float)uploadedRows / height : 1.0f;
+			return totalStates > 0 ? (float)nextState / totalStates : 1.0f;
+		}
+
+		const Texture2D& getTexture() const { return front.texture; }
+};
+
+#endif
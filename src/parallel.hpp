@@ -0,0 +1,173 @@
+#ifndef ARPADICA_PARALLEL_H
+#define ARPADICA_PARALLEL_H
+
+#include "trace.hpp"
+#include "memory_stats.hpp"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <string>
+#include <functional>
+#include <algorithm>
+
+// Number of worker threads used by the CPU bake steps
+inline int workerCount()
+{
+	unsigned int hw = std::thread::hardware_concurrency();
+	return hw == 0 ? 1 : (int)hw;
+}
+
+// workerCount() - 1 threads started once and reused by every parallelFor, the calling thread is the last worker.
+// Starting threads costs tens of microseconds each, more than the small batches some callers hand out.
+//
+// Calls are queued as jobs of a few ranges each. Idle workers claim ranges from the oldest job, the caller claims
+// ranges of its own job until none are left and then waits for the ones still running. A parallelFor inside a
+// range, or from another thread at the same time, just queues another job, the caller always works on its own.
+class WorkerPool
+{
+	private:
+		struct Job
+		{
+			const std::function<void(int, int)> *fn;
+			int begin, end, chunk, ranges;
+			int next = 0;       // next unclaimed range, guarded by queueMutex
+			int remaining;      // ranges not finished yet, guarded by queueMutex
+			MemoryTag memoryTag;
+		};
+
+		std::mutex queueMutex;
+		std::condition_variable wake;
+		std::condition_variable finished;
+		std::deque<Job *> jobs;
+		std::vector<std::thread> threads;
+		bool stopping = false;
+
+		// Next range of job, queueMutex held. The job leaves the queue with its last range.
+		int claim(Job& job)
+		{
+			int range = job.next++;
+			if(job.next == job.ranges) jobs.erase(std::find(jobs.begin(), jobs.end(), &job));
+			return range;
+		}
+
+		void run(Job& job, int range)
+		{
+			int rangeBegin = job.begin + range * job.chunk;
+			int rangeEnd = std::min(job.end, rangeBegin + job.chunk);
+
+			if(rangeBegin < rangeEnd)
+			{
+				TRACE_SCOPE("parallelFor range");
+				(*job.fn)(rangeBegin, rangeEnd);
+			}
+
+			std::lock_guard<std::mutex> lock(queueMutex);
+			if(--job.remaining == 0) finished.notify_all();
+		}
+
+		void workerLoop(int index)
+		{
+			Tracer::instance().setThreadName("Worker " + std::to_string(index));
+
+			while(true)
+			{
+				Job *job;
+				int range;
+				{
+					std::unique_lock<std::mutex> lock(queueMutex);
+					wake.wait(lock, [&]() { return stopping || !jobs.empty(); });
+					if(stopping) return;
+
+					job = jobs.front();
+					range = claim(*job);
+				}
+
+				// Workers charge their allocations to whatever the caller is charged to
+				MemoryScope memory(job->memoryTag);
+				run(*job, range);
+			}
+		}
+
+		WorkerPool()
+		{
+			// The tracer has to outlive the workers, their trace buffers go back to it when they exit
+			Tracer::instance();
+
+			for(int i = 1; i < workerCount(); i++) threads.emplace_back(&WorkerPool::workerLoop, this, i);
+		}
+
+	public:
+		~WorkerPool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(queueMutex);
+				stopping = true;
+			}
+			wake.notify_all();
+			for(auto& thread : threads) thread.join();
+		}
+
+		WorkerPool(const WorkerPool&) = delete;
+		WorkerPool& operator=(const WorkerPool&) = delete;
+
+		static WorkerPool& instance()
+		{
+			static WorkerPool pool;
+			return pool;
+		}
+
+		// Run fn over ranges chunks of [begin, end), returns once all of them are done
+		void execute(int begin, int end, int ranges, const std::function<void(int, int)>& fn)
+		{
+			Job job;
+			job.fn = &fn;
+			job.begin = begin;
+			job.end = end;
+			job.ranges = ranges;
+			job.chunk = (end - begin + ranges - 1) / ranges;
+			job.remaining = ranges;
+			job.memoryTag = currentMemoryTag();
+
+			{
+				std::lock_guard<std::mutex> lock(queueMutex);
+				jobs.push_back(&job);
+			}
+			wake.notify_all();
+
+			// Work on our own job while it has ranges left
+			while(true)
+			{
+				int range;
+				{
+					std::lock_guard<std::mutex> lock(queueMutex);
+					if(job.next >= job.ranges) break;
+					range = claim(job);
+				}
+				run(job, range);
+			}
+
+			std::unique_lock<std::mutex> lock(queueMutex);
+			finished.wait(lock, [&]() { return job.remaining == 0; });
+		}
+};
+
+// Split [begin, end) into contiguous ranges and run fn(rangeBegin, rangeEnd) on each one in parallel.
+// Ranges never overlap, so fn can write to its own slice of an output buffer without locking.
+inline void parallelFor(int begin, int end, const std::function<void(int, int)>& fn, int minRange = 1)
+{
+	int count = end - begin;
+	if(count <= 0) return;
+
+	int ranges = std::min(workerCount(), std::max(1, count / std::max(1, minRange)));
+	if(ranges <= 1)
+	{
+		fn(begin, end);
+		return;
+	}
+
+	WorkerPool::instance().execute(begin, end, ranges, fn);
+}
+
+#endif
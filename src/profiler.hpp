@@ -0,0 +1,212 @@
+#ifndef ARPADICA_PROFILER_H
+#define ARPADICA_PROFILER_H
+
+#include "raylib.h"
+#include "trace.hpp"
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+
+using namespace std;
+
+// Main loop phases timed every frame
+enum ProfilePhase
+{
+	PROFILE_FRAME = 0,   // whole frame, beginFrame to beginFrame
+	PROFILE_INPUT,       // camera and keyboard handling
+	PROFILE_PICKING,     // mouseToMap and the state lookups under the cursor
+	PROFILE_OVERLAY,     // state layer uploads and overlay rebuild steps
+	PROFILE_TERRAIN,     // terrain draw
+	PROFILE_DRAPE,       // draped states draw
+	PROFILE_GUI,         // raygui and text
+	PROFILE_PRESENT,     // EndDrawing, includes the swap and any vsync wait
+
+	PROFILE_PHASE_COUNT
+};
+
+static const char *profilePhaseNames[PROFILE_PHASE_COUNT] = {
+	"Frame", "Input", "Picking", "Overlay", "Terrain", "Drape", "GUI", "Present"
+};
+
+// Percentiles of a phase, in milliseconds
+struct PhaseStats
+{
+	float p50 = 0.0f, p95 = 0.0f, p99 = 0.0f, max = 0.0f;
+	int samples = 0;
+};
+
+// Percentiles of count values, sorts them in place
+inline PhaseStats computePhaseStats(float *values, int count)
+{
+	PhaseStats result;
+	result.samples = count;
+	if(count == 0) return result;
+
+	sort(values, values + count);
+	auto percentile = [&](float p) { return values[min(count - 1, (int)(p * (count - 1) + 0.5f))]; };
+
+	result.p50 = percentile(0.50f);
+	result.p95 = percentile(0.95f);
+	result.p99 = percentile(0.99f);
+	result.max = values[count - 1];
+	return result;
+}
+
+// Fixed size ring of the latest samples. Writers claim a slot with one atomic increment and never wait,
+// so timers can be recorded from any thread. A reader may see a slot that is being overwritten, which only
+// swaps one sample for a newer one.
+class SampleRing
+{
+	public:
+		static constexpr uint32_t CAPACITY = 512; // power of two
+
+	private:
+		atomic<float> samples[CAPACITY];
+		atomic<uint32_t> head{ 0 };
+
+	public:
+		SampleRing() { for(auto& sample : samples) sample.store(0.0f, memory_order_relaxed); }
+
+		void push(float value)
+		{
+			uint32_t slot = head.fetch_add(1, memory_order_relaxed) & (CAPACITY - 1);
+			samples[slot].store(value, memory_order_relaxed);
+		}
+
+		PhaseStats stats() const
+		{
+			float sorted[CAPACITY];
+			int count = (int)min(head.load(memory_order_relaxed), CAPACITY);
+			for(int i = 0; i < count; i++) sorted[i] = samples[i].load(memory_order_relaxed);
+
+			return computePhaseStats(sorted, count);
+		}
+};
+
+// CPU time per main loop phase over the last SampleRing::CAPACITY frames, with an overlay to show it.
+// Phases that run several times in a frame are summed and pushed once by the next beginFrame().
+class Profiler
+{
+	private:
+		using Clock = chrono::steady_clock;
+
+		SampleRing rings[PROFILE_PHASE_COUNT];
+		double frameTotals[PROFILE_PHASE_COUNT] = { 0.0 }; // main thread only
+		double lastTotals[PROFILE_PHASE_COUNT] = { 0.0 };  // totals of the previous frame
+		Clock::time_point frameStart;
+		bool frameStarted = false;
+		bool visible = false;
+
+		// Stats are only recomputed a few times a second, sorting every frame would show up in the numbers
+		PhaseStats shown[PROFILE_PHASE_COUNT];
+		double lastRefresh = -1.0;
+
+	public:
+		static double now()
+		{
+			return chrono::duration<double>(Clock::now().time_since_epoch()).count();
+		}
+
+		// Add seconds to a phase of the current frame
+		void add(ProfilePhase phase, double seconds) { frameTotals[phase] += seconds; }
+
+		// Close the previous frame and start timing the next one, call once per frame at the same spot
+		void beginFrame()
+		{
+			Clock::time_point start = Clock::now();
+
+			if(frameStarted)
+			{
+				Tracer::instance().end(profilePhaseNames[PROFILE_FRAME]);
+
+				frameTotals[PROFILE_FRAME] = chrono::duration<double>(start - frameStart).count();
+				for(int phase = 0; phase < PROFILE_PHASE_COUNT; phase++)
+				{
+					rings[phase].push((float)(frameTotals[phase] * 1000.0));
+					lastTotals[phase] = frameTotals[phase];
+					frameTotals[phase] = 0.0;
+				}
+			}
+
+			frameStart = start;
+			frameStarted = true;
+			Tracer::instance().begin(profilePhaseNames[PROFILE_FRAME]);
+		}
+
+		PhaseStats stats(ProfilePhase phase) const { return rings[phase].stats(); }
+
+		// Milliseconds of a phase in the frame closed by the last beginFrame()
+		double getLastFrame(ProfilePhase phase) const { return lastTotals[phase] * 1000.0; }
+
+		void toggle() { visible = !visible; }
+		bool isVisible() const { return visible; }
+
+		// Height of the overlay in pixels
+		int getHeight() const { return 18 * (PROFILE_PHASE_COUNT + 1) + 8; }
+
+		// Table of p50 / p95 / p99 / max per phase
+		void draw(int x, int y)
+		{
+			if(!visible) return;
+
+			if(lastRefresh < 0.0 || GetTime() - lastRefresh > 0.25)
+			{
+				for(int phase = 0; phase < PROFILE_PHASE_COUNT; phase++) shown[phase] = rings[phase].stats();
+				lastRefresh = GetTime();
+			}
+
+			const int rowHeight = 18;
+			const int columns[5] = { x + 6, x + 110, x + 165, x + 220, x + 275 };
+			const char *headers[5] = { "ms", "p50", "p95", "p99", "max" };
+
+			DrawRectangle(x, y, 330, getHeight(), Fade(BLACK, 0.7f));
+			for(int c = 0; c < 5; c++) DrawText(headers[c], columns[c], y + 4, 16, LIGHTGRAY);
+
+			for(int phase = 0; phase < PROFILE_PHASE_COUNT; phase++)
+			{
+				const PhaseStats& s = shown[phase];
+				float values[4] = { s.p50, s.p95, s.p99, s.max };
+				int rowY = y + 4 + rowHeight * (phase + 1);
+
+				// Spikes past a 60 Hz frame stand out
+				Color color = s.max > 1000.0f / 60.0f ? ORANGE : RAYWHITE;
+
+				DrawText(profilePhaseNames[phase], columns[0], rowY, 16, color);
+				for(int c = 0; c < 4; c++) DrawText(TextFormat("%.2f", values[c]), columns[c + 1], rowY, 16, color);
+			}
+		}
+};
+
+// Times the enclosing scope into a phase of the current frame, or up to stop() when that comes first.
+// The phase also shows up in the trace.
+class ProfileScope
+{
+	private:
+		Profiler& profiler;
+		ProfilePhase phase;
+		double start;
+		bool running = true;
+
+	public:
+		ProfileScope(Profiler& frame_profiler, ProfilePhase scope_phase) : profiler(frame_profiler), phase(scope_phase), start(Profiler::now())
+		{
+			Tracer::instance().begin(profilePhaseNames[phase]);
+		}
+
+		~ProfileScope() { stop(); }
+
+		void stop()
+		{
+			if(!running) return;
+			running = false;
+
+			profiler.add(phase, Profiler::now() - start);
+			Tracer::instance().end(profilePhaseNames[phase]);
+		}
+
+		ProfileScope(const ProfileScope&) = delete;
+		ProfileScope& operator=(const ProfileScope&) = delete;
+};
+
+#endif
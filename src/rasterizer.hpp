@@ -0,0 +1,358 @@
+#ifndef ARPADICA_RASTERIZER_H
+#define ARPADICA_RASTERIZER_H
+
+#include "raylib.h"
+#include "map_engine.hpp"
+#include "parallel.hpp"
+#include "render_stats.hpp"
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <atomic>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define ARPADICA_RASTER_SSE2
+#endif
+
+// Fill count 32 bit pixels with the same value, 16 pixels per iteration with SSE2
+inline void fillSpan(uint32_t *dst, int count, uint32_t value)
+{
+	int i = 0;
+
+#ifdef ARPADICA_RASTER_SSE2
+	__m128i v = _mm_set1_epi32((int)value);
+	for(; i + 16 <= count; i += 16)
+	{
+		_mm_storeu_si128((__m128i *)(dst + i), v);
+		_mm_storeu_si128((__m128i *)(dst + i + 4), v);
+		_mm_storeu_si128((__m128i *)(dst + i + 8), v);
+		_mm_storeu_si128((__m128i *)(dst + i + 12), v);
+	}
+	for(; i + 4 <= count; i += 4)
+	{
+		_mm_storeu_si128((__m128i *)(dst + i), v);
+	}
+#endif
+
+	for(; i < count; i++) dst[i] = value;
+}
+
+// Work done by one rasterizeIndices call, what the overlay builder reports as render counters
+struct RasterStats
+{
+	long ringsTested = 0;
+	long ringsCulled = 0; // outside the rows, skipped
+	long edges = 0;       // edges set up, once per ring and worker range it spans
+	long spans = 0;
+};
+
+// CPU scanline rasterizer for state polygons. Produces the same state index overlay as MapEngine::render with
+// encode_index (index + 1 per pixel, 0 = no state), or an RGBA image colored from a per-state palette.
+// Rows are split between worker threads, so it can run off the GL thread, in tools and without a GPU.
+class SoftwareRasterizer
+{
+	private:
+		struct Ring
+		{
+			uint32_t state_index;
+			const vector<Vector2> *points;
+			float min_x, max_x, min_y, max_y; // raster space bounds
+		};
+
+		struct Edge
+		{
+			float y0, y1;  // y0 < y1
+			float x0;      // x at y0
+			float dxdy;
+		};
+
+		int width = 0, height = 0;
+		float scale_x = 1.0f, scale_y = 1.0f;
+
+		vector<Ring> rings; // painter order, later rings overwrite earlier ones like on the GPU
+
+		// Scanline setup of one ring over the rows it covers in [row_begin, row_end)
+		void buildEdges(const Ring& ring, vector<Edge>& edges) const
+		{
+			edges.clear();
+
+			const auto& points = *ring.points;
+			for(size_t i = 0, j = points.size() - 1; i < points.size(); j = i++)
+			{
+				float ax = points[j].x * scale_x, ay = points[j].y * scale_y;
+				float bx = points[i].x * scale_x, by = points[i].y * scale_y;
+				if(ay == by) continue;
+
+				if(ay > by) { swap(ax, bx); swap(ay, by); }
+				edges.push_back({ ay, by, ax, (bx - ax) / (by - ay) });
+			}
+
+			sort(edges.begin(), edges.end(), [](const Edge& a, const Edge& b) { return a.y0 < b.y0; });
+		}
+
+		// Walk the sample rows sy = row + (s + 0.5) / samples and hand every covered span [xa, xb) to emit.
+		// Uses an active edge list, edges cover y0 <= sy < y1 (top-left fill rule).
+		template<typename EmitSpan>
+		void scanRing(const Ring& ring, int row_begin, int row_end, int samples, vector<Edge>& edges, vector<const Edge *>& active, vector<float>& crossings, EmitSpan emit) const
+		{
+			buildEdges(ring, edges);
+			active.clear();
+
+			int first_row = max(row_begin, (int)floorf(ring.min_y));
+			int last_row = min(row_end, (int)ceilf(ring.max_y) + 1);
+
+			size_t next_edge = 0;
+			for(int row = first_row; row < last_row; row++)
+			{
+				for(int s = 0; s < samples; s++)
+				{
+					float sy = row + (s + 0.5f) / samples;
+
+					while(next_edge < edges.size() && edges[next_edge].y0 <= sy)
+					{
+						active.push_back(&edges[next_edge++]);
+					}
+
+					crossings.clear();
+					size_t kept = 0;
+					for(const Edge *edge : active)
+					{
+						if(edge->y1 <= sy) continue;
+
+						active[kept++] = edge;
+						if(edge->y0 <= sy) crossings.push_back(edge->x0 + (sy - edge->y0) * edge->dxdy);
+					}
+					active.resize(kept);
+
+					if(crossings.size() < 2) continue;
+					sort(crossings.begin(), crossings.end());
+
+					for(size_t c = 0; c + 1 < crossings.size(); c += 2)
+					{
+						emit(row, s, crossings[c], crossings[c + 1]);
+					}
+				}
+			}
+		}
+
+	public:
+		SoftwareRasterizer() {}
+
+		// Collect the rings of every state and map them into a raster of raster_w x raster_h pixels.
+		// Keeps pointers into mapEngine, its geometry must not change while the rasterizer is in use.
+		void prepare(const MapEngine& mapEngine, int raster_w, int raster_h)
+		{
+			width = raster_w;
+			height = raster_h;
+			scale_x = (float)raster_w / mapEngine.getMapWidth();
+			scale_y = (float)raster_h / mapEngine.getMapHeight();
+
+			rings.clear();
+
+			const auto& states = mapEngine.getStates();
+			for(size_t state_index = 0; state_index < states.size(); state_index++)
+			{
+				const auto& state = states[state_index];
+				for(size_t poly_index = 0; poly_index < state.polygons.size(); poly_index++)
+				{
+					const auto& polygon = state.polygons[poly_index];
+					if(polygon.size() < 3) continue;
+
+					Ring ring = { (uint32_t)state_index, &polygon, 1e30f, -1e30f, 1e30f, -1e30f };
+					for(const auto& p : polygon)
+					{
+						ring.min_x = min(ring.min_x, p.x * scale_x);
+						ring.max_x = max(ring.max_x, p.x * scale_x);
+						ring.min_y = min(ring.min_y, p.y * scale_y);
+						ring.max_y = max(ring.max_y, p.y * scale_y);
+					}
+
+					if(ring.max_x < 0 || ring.min_x >= width || ring.max_y < 0 || ring.min_y >= height) continue;
+					rings.push_back(ring);
+				}
+			}
+		}
+
+		int getWidth() const { return width; }
+		int getHeight() const { return height; }
+
+		// Rasterize rows [row_begin, row_end) as state indices (index + 1, 0 = no state) into out, which holds
+		// width * (row_end - row_begin) pixels. With flip_rows the rows are stored bottom-up, the layout
+		// OpenGL expects when uploading into a render texture. stats, if given, gets what was processed added to it.
+		void rasterizeIndices(int row_begin, int row_end, uint32_t *out, bool flip_rows = false, RasterStats *stats = nullptr) const
+		{
+			row_begin = max(row_begin, 0);
+			row_end = min(row_end, height);
+			if(row_begin >= row_end) return;
+
+			atomic<long> edge_count{ 0 }, span_count{ 0 };
+
+			parallelFor(row_begin, row_end, [&](int band_begin, int band_end)
+			{
+				vector<Edge> edges;
+				vector<const Edge *> active;
+				vector<float> crossings;
+				long range_edges = 0, range_spans = 0;
+
+				for(int row = band_begin; row < band_end; row++)
+				{
+					int local = flip_rows ? (row_end - 1 - row) : (row - row_begin);
+					fillSpan(out + (size_t)local * width, width, 0);
+				}
+
+				for(const auto& ring : rings)
+				{
+					if(ring.max_y < band_begin || ring.min_y >= band_end) continue;
+
+					uint32_t value = ring.state_index + 1;
+					scanRing(ring, band_begin, band_end, 1, edges, active, crossings, [&](int row, int, float xa, float xb)
+					{
+						// Pixel centers inside [xa, xb)
+						int x0 = max(0, (int)ceilf(xa - 0.5f));
+						int x1 = min(width, (int)ceilf(xb - 0.5f));
+						if(x0 >= x1) return;
+
+						int local = flip_rows ? (row_end - 1 - row) : (row - row_begin);
+						fillSpan(out + (size_t)local * width + x0, x1 - x0, value);
+						range_spans++;
+					});
+					range_edges += edges.size();
+				}
+
+				edge_count += range_edges;
+				span_count += range_spans;
+			}, 16);
+
+			if(!stats) return;
+
+			for(const auto& ring : rings)
+			{
+				stats->ringsTested++;
+				if(ring.max_y < row_begin || ring.min_y >= row_end) stats->ringsCulled++;
+			}
+			stats->edges += edge_count;
+			stats->spans += span_count;
+		}
+
+		// Rasterize rows [row_begin, row_end) as colors, palette holds one color per state (state order).
+		// With antialias, edge pixels are blended by their coverage (4 sub-scanlines, exact horizontal coverage).
+		void rasterizeColors(const vector<Color>& palette, int row_begin, int row_end, Color *out, bool antialias = false, bool flip_rows = false) const
+		{
+			row_begin = max(row_begin, 0);
+			row_end = min(row_end, height);
+			if(row_begin >= row_end) return;
+
+			const int samples = antialias ? 4 : 1;
+
+			parallelFor(row_begin, row_end, [&](int band_begin, int band_end)
+			{
+				vector<Edge> edges;
+				vector<const Edge *> active;
+				vector<float> crossings;
+				vector<float> coverage(antialias ? width : 0, 0.0f);
+
+				auto rowPtr = [&](int row) { return out + (size_t)(flip_rows ? (row_end - 1 - row) : (row - row_begin)) * width; };
+
+				for(int row = band_begin; row < band_end; row++)
+				{
+					fillSpan((uint32_t *)rowPtr(row), width, 0);
+				}
+
+				for(const auto& ring : rings)
+				{
+					if(ring.max_y < band_begin || ring.min_y >= band_end) continue;
+					if(ring.state_index >= palette.size()) continue;
+
+					const Color color = palette[ring.state_index];
+
+					if(!antialias)
+					{
+						uint32_t packed;
+						memcpy(&packed, &color, sizeof(packed));
+
+						scanRing(ring, band_begin, band_end, 1, edges, active, crossings, [&](int row, int, float xa, float xb)
+						{
+							int x0 = max(0, (int)ceilf(xa - 0.5f));
+							int x1 = min(width, (int)ceilf(xb - 0.5f));
+							if(x0 < x1) fillSpan((uint32_t *)rowPtr(row) + x0, x1 - x0, packed);
+						});
+						continue;
+					}
+
+					// Accumulate coverage per row, then blend the touched pixels once the row is finished
+					int current_row = -1;
+					int touched_min = width, touched_max = -1;
+
+					auto flushRow = [&]()
+					{
+						if(current_row < 0 || touched_max < touched_min) return;
+
+						Color *dst = rowPtr(current_row);
+						for(int x = touched_min; x <= touched_max; x++)
+						{
+							float a = min(coverage[x], 1.0f) * (color.a / 255.0f);
+							coverage[x] = 0.0f;
+							if(a <= 0.0f) continue;
+
+							dst[x].r = (unsigned char)(dst[x].r + (color.r - dst[x].r) * a);
+							dst[x].g = (unsigned char)(dst[x].g + (color.g - dst[x].g) * a);
+							dst[x].b = (unsigned char)(dst[x].b + (color.b - dst[x].b) * a);
+							dst[x].a = (unsigned char)(dst[x].a + (255 - dst[x].a) * a);
+						}
+
+						touched_min = width;
+						touched_max = -1;
+					};
+
+					const float weight = 1.0f / samples;
+
+					scanRing(ring, band_begin, band_end, samples, edges, active, crossings, [&](int row, int, float xa, float xb)
+					{
+						if(row != current_row)
+						{
+							flushRow();
+							current_row = row;
+						}
+
+						xa = max(xa, 0.0f);
+						xb = min(xb, (float)width);
+						if(xa >= xb) return;
+
+						int ia = (int)xa;
+						int ib = min((int)xb, width - 1);
+
+						touched_min = min(touched_min, ia);
+						touched_max = max(touched_max, ib);
+
+						if(ia == ib)
+						{
+							coverage[ia] += (xb - xa) * weight;
+							return;
+						}
+
+						coverage[ia] += (ia + 1 - xa) * weight;
+						for(int x = ia + 1; x < ib; x++) coverage[x] += weight;
+						coverage[ib] += (xb - ib) * weight;
+					});
+
+					flushRow();
+				}
+			}, 16);
+		}
+};
+
+// Upload rows [row_begin, row_end) of a full width pixel buffer into texture. Pixel rows must already be in the
+// order OpenGL expects (see flip_rows), row_begin counts from the top of the map.
+inline void uploadRasterRows(Texture2D texture, int row_begin, int row_end, const void *pixels)
+{
+	if(row_begin >= row_end) return;
+
+	// Texture rows start at the bottom in OpenGL, render textures keep the top of the map in the last row
+	Rectangle rec = { 0.0f, (float)(texture.height - row_end), (float)texture.width, (float)(row_end - row_begin) };
+	UpdateTextureRec(texture, rec, pixels);
+	countTextureUpload((size_t)GetPixelDataSize(texture.width, row_end - row_begin, texture.format));
+}
+
+#endif
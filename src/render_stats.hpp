@@ -0,0 +1,96 @@
+#ifndef ARPADICA_RENDER_STATS_H
+#define ARPADICA_RENDER_STATS_H
+
+#include "raylib.h"
+#include "rlgl.h"
+
+// What the renderer submitted in one frame. Polygon, triangle and segment counts tell a geometry bound redraw
+// apart from a fill bound one, flushes and draws are the calls that reach the driver.
+struct RenderStats
+{
+	long polygonsTested = 0;    // state polygons checked by MapEngine::isVisibleInCamera, or against each software overlay band
+	long polygonsCulled = 0;    // ... and skipped as off screen / outside the band
+	long overlayTriangles = 0;  // state triangles submitted by MapEngine::render (GPU overlay)
+	long overlayEdges = 0;      // polygon edges set up by the software overlay, counted when their band is uploaded
+	long overlaySpans = 0;      // ... and the spans it filled
+	long outlineSegments = 0;   // state border segments, draped ribbons and outline fallbacks
+	long batchFlushes = 0;      // rlgl batches we flush, explicitly or when one ran full (not raylib's own at mode changes)
+	long meshDraws = 0;         // DrawMesh calls, every one a draw call of its own
+	long terrainTriangles = 0;
+	int terrainChunks = 0;
+	long drapeTriangles = 0;
+	int textureUploads = 0;     // texture updates, state layers and overlay rows
+	size_t textureUploadBytes = 0;
+	int meshUploads = 0;        // meshes built and sent to the GPU, terrain LODs
+};
+
+// Counters of the current frame and the last finished one. Everything that draws runs on the main thread, so
+// these are plain fields.
+class RenderCounters
+{
+	public:
+		RenderStats current;
+		RenderStats last;
+
+		// Close the previous frame, call once per frame next to Profiler::beginFrame()
+		void beginFrame()
+		{
+			last = current;
+			current = RenderStats();
+		}
+};
+
+inline RenderCounters& renderCounters()
+{
+	static RenderCounters counters;
+	return counters;
+}
+
+// rlDrawRenderBatchActive(), counted
+inline void flushRenderBatch()
+{
+	rlDrawRenderBatchActive();
+	renderCounters().current.batchFlushes++;
+}
+
+// Make room for vertex_count more vertices, flushing a full batch ourselves so it is counted
+inline void reserveRenderBatch(int vertex_count)
+{
+	if(rlCheckRenderBatchLimit(vertex_count)) renderCounters().current.batchFlushes++;
+}
+
+// UpdateTexture / UpdateTextureRec, counted
+inline void countTextureUpload(size_t bytes)
+{
+	renderCounters().current.textureUploads++;
+	renderCounters().current.textureUploadBytes += bytes;
+}
+
+// The counters of the last frame as a table, below the profiler overlay
+inline void drawRenderStats(const RenderStats& stats, int x, int y)
+{
+	const int rowHeight = 18;
+	const int rows = 10;
+
+	DrawRectangle(x, y, 330, rowHeight * rows + 8, Fade(BLACK, 0.7f));
+
+	int rowY = y + 4;
+	auto row = [&](const char *name, const char *value) {
+		DrawText(name, x + 6, rowY, 16, RAYWHITE);
+		DrawText(value, x + 190, rowY, 16, RAYWHITE);
+		rowY += rowHeight;
+	};
+
+	row("Polygons culled", TextFormat("%ld / %ld", stats.polygonsCulled, stats.polygonsTested));
+	row("Overlay triangles", TextFormat("%ld", stats.overlayTriangles));
+	row("Overlay edges / spans", TextFormat("%ld / %ld", stats.overlayEdges, stats.overlaySpans));
+	row("Outline segments", TextFormat("%ld", stats.outlineSegments));
+	row("Terrain triangles", TextFormat("%ld", stats.terrainTriangles));
+	row("Terrain chunks", TextFormat("%d", stats.terrainChunks));
+	row("Drape triangles", TextFormat("%ld", stats.drapeTriangles));
+	row("Batches / meshes", TextFormat("%ld / %ld", stats.batchFlushes, stats.meshDraws));
+	row("Texture uploads", TextFormat("%d, %.1f MB", stats.textureUploads, stats.textureUploadBytes / (1024.0 * 1024.0)));
+	row("Mesh uploads", TextFormat("%d", stats.meshUploads));
+}
+
+#endif
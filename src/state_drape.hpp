@@ -0,0 +1,401 @@
+#ifndef ARPADICA_STATEDRAPE_H
+#define ARPADICA_STATEDRAPE_H
+
+#include "raylib.h"
+#include "raymath.h"
+#include "rlgl.h"
+#include "map_engine.hpp"
+#include "heightfield.hpp"
+#include "terrain.hpp"
+#include "parallel.hpp"
+#include "trace.hpp"
+#include "memory_stats.hpp"
+#include "render_stats.hpp"
+#include <vector>
+#include <unordered_map>
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <algorithm>
+
+// State polygons draped straight onto the terrain, the alternative to sampling the state index overlay.
+//
+// Every state triangle is subdivided until its edges are no longer than a few heightfield samples, and its vertices
+// are lifted onto the heightfield. The fill carries the state index as a vertex attribute, so the shader looks up
+// the palette and flags directly and no overlay render texture is needed. Borders are ribbons along the polygon
+// rings which the shader widens to a fixed number of screen pixels, crisp at any zoom.
+// Both are drawn after the terrain with depth writes off and pulled towards the camera by a bias relative to the
+// view distance, so they stay on top where the terrain LODs do not match the heightfield exactly.
+class StateDrape
+{
+	private:
+		static constexpr int MAX_SUBDIVISIONS = 64;  // per triangle edge
+		static constexpr int MAX_VERTICES = 65535;   // unsigned short indices
+		static constexpr float FILL_BIAS = 0.002f;   // share of the view distance the drape is pulled towards the camera
+		static constexpr float BORDER_BIAS = 0.003f; // borders a little more, they sit on top of the fill
+
+		struct DrapeGeometry
+		{
+			vector<float> vertices, normals, texcoords, tangents;
+			vector<unsigned short> indices;
+			BoundingBox bounds = { { FLT_MAX, FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX, -FLT_MAX } };
+
+			int vertexCount() const { return (int)vertices.size() / 3; }
+
+			void addVertex(Vector3 p, Vector3 n)
+			{
+				vertices.insert(vertices.end(), { p.x, p.y, p.z });
+				normals.insert(normals.end(), { n.x, n.y, n.z });
+				bounds.min = Vector3Min(bounds.min, p);
+				bounds.max = Vector3Max(bounds.max, p);
+			}
+		};
+
+		struct DrapeMesh
+		{
+			Mesh mesh;
+			BoundingBox bounds; // terrain local
+		};
+
+		vector<DrapeMesh> fills;
+		vector<DrapeMesh> borders;
+		size_t gpuBytes = 0;
+		long drawnTriangles = 0;
+
+		int locFillCamera = -1, locFillBias = -1;
+		int locBorderCamera = -1, locBorderBias = -1, locBorderViewport = -1;
+
+		// Map pixels to terrain local x, z
+		float toLocalX = 1.0f, toLocalZ = 1.0f;
+
+		Vector3 surfacePoint(const Heightfield& heightfield, Vector2 mapPoint) const
+		{
+			float x = mapPoint.x * toLocalX, z = mapPoint.y * toLocalZ;
+			return { x, heightfield.heightAt(x, z), z };
+		}
+
+		// Like Terrain::uploadChunkGeometry, only the GPU copy and the indices stay
+		static DrapeMesh upload(DrapeGeometry& geometry)
+		{
+			DrapeMesh drape = { { 0 }, geometry.bounds };
+			Mesh& mesh = drape.mesh;
+
+			mesh.vertexCount = geometry.vertexCount();
+			mesh.triangleCount = (int)geometry.indices.size() / 3;
+			mesh.vertices = geometry.vertices.data();
+			mesh.normals = geometry.normals.data();
+			if(!geometry.texcoords.empty()) mesh.texcoords = geometry.texcoords.data();
+			if(!geometry.tangents.empty()) mesh.tangents = geometry.tangents.data();
+			mesh.indices = (unsigned short *)RL_MALLOC(geometry.indices.size() * sizeof(unsigned short));
+			memcpy(mesh.indices, geometry.indices.data(), geometry.indices.size() * sizeof(unsigned short));
+
+			UploadMesh(&mesh, false);
+
+			mesh.vertices = mesh.normals = mesh.texcoords = mesh.tangents = NULL;
+			geometry = DrapeGeometry();
+
+			return drape;
+		}
+
+		// Fill triangles of the states in [first, last), split into meshes that fit 16 bit indices.
+		// Every triangle edge is split by its own length like the border ribbons, so both triangles on a shared edge
+		// split it the same way. Inside, the triangle is a regular grid as fine as its longest edge, grid vertices on
+		// a coarser edge snap to that edge's split points and the triangles collapsing on the way are dropped.
+		// Vertices on the edges and corners are welded per polygon, the fill has no T-junctions and no cracks.
+		void buildFills(const MapEngine& mapEngine, const Heightfield& heightfield, float max_edge, int first, int last, vector<DrapeGeometry>& out) const
+		{
+			const auto& states = mapEngine.getStates();
+			DrapeGeometry geometry;
+
+			unordered_map<uint64_t, unsigned short> welded; // polygon edge point -> vertex of the current mesh
+			vector<unsigned short> grid;
+
+			for(int s = first; s < last; s++)
+			{
+				const State& state = states[s];
+				float stateIndex = (float)(s + 1); // palette entry, 0 = no state
+
+				for(size_t p = 0; p < state.polygons.size() && p < state.polygon_indices.size(); p++)
+				{
+					const auto& poly = state.polygons[p];
+					const auto& indices = state.polygon_indices[p];
+					welded.clear();
+
+					auto addVertex = [&](Vector2 m)
+					{
+						Vector3 point = surfacePoint(heightfield, m);
+						geometry.addVertex(point, heightfield.normalAt(point.x, point.z));
+						geometry.texcoords.insert(geometry.texcoords.end(), { stateIndex, 0.0f });
+						return (unsigned short)(geometry.vertexCount() - 1);
+					};
+
+					auto splits = [&](uint32_t from, uint32_t to)
+					{
+						float length = Vector2Distance({ poly[from].x * toLocalX, poly[from].y * toLocalZ }, { poly[to].x * toLocalX, poly[to].y * toLocalZ });
+						return min(max((int)ceilf(length / max_edge), 1), MAX_SUBDIVISIONS);
+					};
+
+					// Split point j of k along the polygon edge between from and to, always computed from the lower index
+					// so the triangles on both sides get the same point
+					auto edgeVertex = [&](uint32_t from, uint32_t to, int k, int j)
+					{
+						if(from > to) { swap(from, to); j = k - j; }
+						if(j == 0) to = from;
+						if(j == k) { from = to; j = 0; }
+
+						uint64_t key = ((uint64_t)from * poly.size() + to) * (MAX_SUBDIVISIONS + 1) + j;
+						auto found = welded.find(key);
+						if(found != welded.end()) return found->second;
+
+						Vector2 a = poly[from], b = poly[to];
+						unsigned short vertex = addVertex({ a.x + (b.x - a.x) * j / k, a.y + (b.y - a.y) * j / k });
+						welded.emplace(key, vertex);
+						return vertex;
+					};
+
+					for(size_t i = 0; i + 2 < indices.size(); i += 3)
+					{
+						uint32_t ia = indices[i], ib = indices[i + 1], ic = indices[i + 2];
+						if(ia >= poly.size() || ib >= poly.size() || ic >= poly.size()) continue;
+
+						Vector2 a = poly[ia], b = poly[ib], c = poly[ic];
+
+						int nab = splits(ia, ib), nbc = splits(ib, ic), nca = splits(ic, ia);
+						int n = max(nab, max(nbc, nca));
+						int count = (n + 1) * (n + 2) / 2;
+
+						if(geometry.vertexCount() + count > MAX_VERTICES)
+						{
+							out.push_back(move(geometry));
+							geometry = DrapeGeometry();
+							welded.clear();
+						}
+
+						// Regular grid over the triangle, row u runs from a + (b - a) * u / n towards c. Edge ab is v = 0,
+						// edge ca is u = 0 and edge bc is u + v = n.
+						grid.clear();
+						for(int u = 0; u <= n; u++)
+						{
+							for(int v = 0; v <= n - u; v++)
+							{
+								if(v == 0) grid.push_back(edgeVertex(ia, ib, nab, (int)lroundf((float)u * nab / n)));
+								else if(u == 0) grid.push_back(edgeVertex(ia, ic, nca, (int)lroundf((float)v * nca / n)));
+								else if(u + v == n) grid.push_back(edgeVertex(ib, ic, nbc, (int)lroundf((float)v * nbc / n)));
+								else grid.push_back(addVertex({
+									a.x + ((b.x - a.x) * u + (c.x - a.x) * v) / n,
+									a.y + ((b.y - a.y) * u + (c.y - a.y) * v) / n }));
+							}
+						}
+
+						// Grid vertex v of row u
+						auto at = [&](int u, int v) { return grid[u * (n + 1) - u * (u - 1) / 2 + v]; };
+
+						auto addTriangle = [&](unsigned short i0, unsigned short i1, unsigned short i2)
+						{
+							if(i0 != i1 && i1 != i2 && i2 != i0) geometry.indices.insert(geometry.indices.end(), { i0, i1, i2 });
+						};
+
+						for(int u = 0; u < n; u++)
+						{
+							for(int v = 0; v < n - u; v++)
+							{
+								addTriangle(at(u, v), at(u + 1, v), at(u, v + 1));
+								if(v + 1 < n - u) addTriangle(at(u, v + 1), at(u + 1, v), at(u + 1, v + 1));
+							}
+						}
+					}
+				}
+			}
+
+			if(!geometry.indices.empty()) out.push_back(move(geometry));
+		}
+
+		// Border ribbons of the states in [first, last). Every segment is a quad of two vertices per end, each
+		// carrying the opposite end and a side (+-1) in its tangent, the shader turns that into a screen space width.
+		void buildBorders(const MapEngine& mapEngine, const Heightfield& heightfield, float max_edge, int first, int last, vector<DrapeGeometry>& out) const
+		{
+			const auto& states = mapEngine.getStates();
+			DrapeGeometry geometry;
+
+			auto addEnd = [&](Vector3 self, Vector3 other, float side)
+			{
+				geometry.addVertex(self, heightfield.normalAt(self.x, self.z));
+				geometry.tangents.insert(geometry.tangents.end(), { other.x, other.y, other.z, side });
+			};
+
+			for(int s = first; s < last; s++)
+			{
+				for(const auto& poly : states[s].polygons)
+				{
+					if(poly.size() < 2) continue;
+
+					for(size_t i = 0; i < poly.size(); i++)
+					{
+						Vector2 a = poly[i], b = poly[(i + 1) % poly.size()];
+
+						float length = Vector2Distance({ a.x * toLocalX, a.y * toLocalZ }, { b.x * toLocalX, b.y * toLocalZ });
+						int n = min(max((int)ceilf(length / max_edge), 1), MAX_SUBDIVISIONS);
+
+						Vector3 previous = surfacePoint(heightfield, a);
+						for(int k = 1; k <= n; k++)
+						{
+							Vector3 next = surfacePoint(heightfield, Vector2Lerp(a, b, (float)k / n));
+
+							if(geometry.vertexCount() + 4 > MAX_VERTICES)
+							{
+								out.push_back(move(geometry));
+								geometry = DrapeGeometry();
+							}
+
+							// Left and right at the start, then at the end the sides swap with the direction
+							unsigned short base = (unsigned short)geometry.vertexCount();
+							addEnd(previous, next, 1.0f);
+							addEnd(previous, next, -1.0f);
+							addEnd(next, previous, 1.0f);
+							addEnd(next, previous, -1.0f);
+
+							geometry.indices.insert(geometry.indices.end(), {
+								base, (unsigned short)(base + 1), (unsigned short)(base + 2),
+								base, (unsigned short)(base + 2), (unsigned short)(base + 3) });
+
+							previous = next;
+						}
+					}
+				}
+			}
+
+			if(!geometry.indices.empty()) out.push_back(move(geometry));
+		}
+
+		static void uploadAll(vector<vector<DrapeGeometry>>& parts, vector<DrapeMesh>& meshes, size_t& bytes)
+		{
+			for(auto& part : parts)
+			{
+				for(auto& geometry : part)
+				{
+					bytes += (geometry.vertices.size() + geometry.normals.size() + geometry.texcoords.size() + geometry.tangents.size()) * sizeof(float);
+					bytes += geometry.indices.size() * sizeof(unsigned short);
+					meshes.push_back(upload(geometry));
+				}
+			}
+		}
+
+		long drawMeshes(const vector<DrapeMesh>& meshes, const Frustum& frustum, const Material& material, Vector3 position)
+		{
+			Matrix transform = MatrixTranslate(position.x, position.y, position.z);
+			long triangles = 0;
+
+			for(const auto& drape : meshes)
+			{
+				BoundingBox worldBounds = { Vector3Add(drape.bounds.min, position), Vector3Add(drape.bounds.max, position) };
+				if(!frustum.containsBox(worldBounds)) continue;
+
+				DrawMesh(drape.mesh, material, transform);
+				triangles += drape.mesh.triangleCount;
+				renderCounters().current.meshDraws++;
+			}
+
+			return triangles;
+		}
+
+	public:
+		StateDrape() {}
+		~StateDrape() { unload(); }
+
+		StateDrape(const StateDrape&) = delete;
+		StateDrape& operator=(const StateDrape&) = delete;
+
+		// Build the fill and border meshes, max_edge is the longest edge left after subdivision in heightfield samples.
+		// The map spans the whole heightfield.
+		void build(const MapEngine& mapEngine, const Heightfield& heightfield, float max_edge = 4.0f)
+		{
+			TRACE_SCOPE("StateDrape::build");
+			MemoryScope memory(MEMORY_DRAPE);
+			unload();
+
+			const Vector3 size = heightfield.getSize();
+			toLocalX = size.x / mapEngine.getMapWidth();
+			toLocalZ = size.z / mapEngine.getMapHeight();
+			float edge = max_edge * heightfield.getScale().x;
+
+			// States are split over the workers, each builds its own meshes, uploads happen here on the GL thread
+			int stateCount = (int)mapEngine.getStates().size();
+			int parts = max(1, min(stateCount, workerCount() * 4));
+			vector<vector<DrapeGeometry>> fillParts(parts), borderParts(parts);
+
+			parallelFor(0, parts, [&](int begin, int end)
+			{
+				for(int part = begin; part < end; part++)
+				{
+					int first = (int)((long)stateCount * part / parts);
+					int last = (int)((long)stateCount * (part + 1) / parts);
+
+					buildFills(mapEngine, heightfield, edge, first, last, fillParts[part]);
+					buildBorders(mapEngine, heightfield, edge, first, last, borderParts[part]);
+				}
+			}, 1);
+
+			uploadAll(fillParts, fills, gpuBytes);
+			uploadAll(borderParts, borders, gpuBytes);
+		}
+
+		void unload()
+		{
+			for(auto& drape : fills) UnloadMesh(drape.mesh);
+			for(auto& drape : borders) UnloadMesh(drape.mesh);
+
+			fills.clear();
+			borders.clear();
+			gpuBytes = 0;
+		}
+
+		bool isBuilt() const { return !fills.empty(); }
+
+		// Look up the uniforms draw() sets on the fill and border shaders (state_drape / state_border)
+		void setupShaders(Shader fill_shader, Shader border_shader)
+		{
+			locFillCamera = GetShaderLocation(fill_shader, "cameraPosition");
+			locFillBias = GetShaderLocation(fill_shader, "drapeBias");
+			locBorderCamera = GetShaderLocation(border_shader, "cameraPosition");
+			locBorderBias = GetShaderLocation(border_shader, "drapeBias");
+			locBorderViewport = GetShaderLocation(border_shader, "viewportSize");
+
+			SetShaderValue(fill_shader, locFillBias, &FILL_BIAS, SHADER_UNIFORM_FLOAT);
+			SetShaderValue(border_shader, locBorderBias, &BORDER_BIAS, SHADER_UNIFORM_FLOAT);
+		}
+
+		// Draw over the already drawn terrain, position is the world position of the terrain corner
+		void draw(const Camera& camera, const Material& fill_material, const Material& border_material, Vector3 position)
+		{
+			float aspect = (float)GetScreenWidth() / max(1, GetScreenHeight());
+			Frustum frustum = Frustum::fromCamera(camera, aspect);
+
+			Vector2 viewport = { (float)GetScreenWidth(), (float)GetScreenHeight() };
+			SetShaderValue(fill_material.shader, locFillCamera, &camera.position, SHADER_UNIFORM_VEC3);
+			SetShaderValue(border_material.shader, locBorderCamera, &camera.position, SHADER_UNIFORM_VEC3);
+			SetShaderValue(border_material.shader, locBorderViewport, &viewport, SHADER_UNIFORM_VEC2);
+
+			// Polygon winding follows the source data, and only the top is ever seen
+			flushRenderBatch();
+			rlDisableBackfaceCulling();
+			rlDisableDepthMask();
+
+			long fillTriangles = drawMeshes(fills, frustum, fill_material, position);
+			long borderTriangles = drawMeshes(borders, frustum, border_material, position);
+			drawnTriangles = fillTriangles + borderTriangles;
+
+			// Every border segment is a quad
+			RenderStats& stats = renderCounters().current;
+			stats.drapeTriangles += drawnTriangles;
+			stats.outlineSegments += borderTriangles / 2;
+
+			flushRenderBatch();
+			rlEnableDepthMask();
+			rlEnableBackfaceCulling();
+		}
+
+		size_t getGpuBytes() const { return gpuBytes; }
+		long getDrawnTriangles() const { return drawnTriangles; }
+};
+
+#endif
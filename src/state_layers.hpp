@@ -0,0 +1,228 @@
+#ifndef ARPADICA_STATELAYERS_H
+#define ARPADICA_STATELAYERS_H
+
+#include "raylib.h"
+#include "map_engine.hpp"
+#include "memory_stats.hpp"
+#include "render_stats.hpp"
+#include <vector>
+#include <cmath>
+
+// Width of the per-state lookup textures, the shader splits a state index into (index % width, index / width)
+static constexpr int STATE_LAYER_WIDTH = 256;
+
+// Flag bits, stored as 0/255 in the channels of the flag texture
+enum StateFlag
+{
+	STATE_FLAG_SELECTED = 0, // red channel
+	STATE_FLAG_HOVERED  = 1  // green channel
+};
+
+enum MapMode
+{
+	MAP_MODE_POLITICAL,
+	MAP_MODE_TERRAIN,    // NUTS mountain typology
+	MAP_MODE_URBAN,      // NUTS urban-rural typology
+	MAP_MODE_COASTAL,    // NUTS coastal typology
+	MAP_MODE_CHOROPLETH, // any numeric column, see setChoropleth
+	MAP_MODE_COUNT
+};
+
+// Per-state palette and flag layers composited in map_overlay.fs on top of the state index overlay.
+// Entry 0 is "no state", state i lives at entry i + 1 (same encoding as MapEngine::render with encode_index).
+// Changing a color or flag only touches a few kilobytes of texture, the 16k overlay is never redrawn.
+// Every map mode keeps its own palette on the CPU, switching modes just uploads a different one.
+class StateLayers
+{
+	private:
+		int entries = 0;
+		int rows = 0;
+
+		vector<Color> palettes[MAP_MODE_COUNT];
+		vector<Color> flags;
+
+		MapMode mode = MAP_MODE_POLITICAL;
+
+		Texture2D paletteTex = { 0 };
+		Texture2D flagsTex = { 0 };
+
+		bool paletteDirty = false;
+		bool flagsDirty = false;
+
+		// Palette of a column with a few discrete classes (NUTS typologies), class 0 means no data
+		void buildCategoricalPalette(vector<Color>& palette, const vector<float>& column, const vector<Color>& classColors)
+		{
+			palette.assign(STATE_LAYER_WIDTH * rows, BLANK);
+
+			for(size_t i = 0; i < column.size() && (int)i + 1 < entries; i++)
+			{
+				int cls = (int)lroundf(column[i]);
+				palette[i + 1] = (cls > 0 && cls <= (int)classColors.size()) ? classColors[cls - 1] : defaultStateColor;
+			}
+		}
+
+		Texture2D loadLayerTexture()
+		{
+			Image blank = GenImageColor(STATE_LAYER_WIDTH, rows, BLANK);
+			Texture2D tex = LoadTextureFromImage(blank);
+			UnloadImage(blank);
+
+			// Lookups must never blend neighbouring states
+			SetTextureFilter(tex, TEXTURE_FILTER_POINT);
+			SetTextureWrap(tex, TEXTURE_WRAP_CLAMP);
+
+			return tex;
+		}
+
+	public:
+		StateLayers() {}
+		~StateLayers() { unload(); }
+
+		StateLayers(const StateLayers&) = delete;
+		StateLayers& operator=(const StateLayers&) = delete;
+
+		void load(const MapEngine& mapEngine)
+		{
+			unload();
+			MemoryScope memory(MEMORY_OVERLAY);
+
+			entries = (int)mapEngine.getStates().size() + 1;
+			rows = (entries + STATE_LAYER_WIDTH - 1) / STATE_LAYER_WIDTH;
+
+			for(auto& palette : palettes) palette.assign(STATE_LAYER_WIDTH * rows, BLANK);
+			flags.assign(STATE_LAYER_WIDTH * rows, BLANK);
+
+			paletteTex = loadLayerTexture();
+			flagsTex = loadLayerTexture();
+
+			syncPoliticalColors(mapEngine);
+
+			// Typology palettes, classes as defined by the NUTS typologies (1 = most mountainous / urban / coastal)
+			buildCategoricalPalette(palettes[MAP_MODE_TERRAIN], mapEngine.getColumn("mountain_type"),
+				{ Color{ 120, 72, 40, 220 }, Color{ 170, 120, 70, 220 }, Color{ 215, 180, 120, 220 }, Color{ 140, 190, 110, 220 } });
+			buildCategoricalPalette(palettes[MAP_MODE_URBAN], mapEngine.getColumn("urban_type"),
+				{ Color{ 200, 40, 40, 220 }, Color{ 240, 160, 60, 220 }, Color{ 110, 180, 90, 220 } });
+			buildCategoricalPalette(palettes[MAP_MODE_COASTAL], mapEngine.getColumn("coast_type"),
+				{ Color{ 20, 90, 200, 220 }, Color{ 110, 170, 230, 220 }, Color{ 225, 215, 190, 220 } });
+
+			flagsDirty = true;
+			update();
+		}
+
+		void unload()
+		{
+			if(paletteTex.id > 0) UnloadTexture(paletteTex);
+			if(flagsTex.id > 0) UnloadTexture(flagsTex);
+
+			paletteTex = { 0 };
+			flagsTex = { 0 };
+		}
+
+		// Copy the ownership colors of every state into the political layer
+		void syncPoliticalColors(const MapEngine& mapEngine)
+		{
+			auto& political = palettes[MAP_MODE_POLITICAL];
+
+			const auto& states = mapEngine.getStates();
+			for(size_t i = 0; i < states.size() && (int)i + 1 < entries; i++)
+			{
+				political[i + 1] = states[i].color;
+			}
+			paletteDirty |= (mode == MAP_MODE_POLITICAL);
+		}
+
+		void setPoliticalColor(int stateIndex, Color color)
+		{
+			if(stateIndex < 0 || stateIndex + 1 >= entries) return;
+
+			palettes[MAP_MODE_POLITICAL][stateIndex + 1] = color;
+			paletteDirty |= (mode == MAP_MODE_POLITICAL);
+		}
+
+		// Color states along a linear ramp from the column minimum (low) to its maximum (high)
+		void setChoropleth(const vector<float>& column, Color low, Color high)
+		{
+			auto& palette = palettes[MAP_MODE_CHOROPLETH];
+			palette.assign(STATE_LAYER_WIDTH * rows, BLANK);
+
+			if(!column.empty())
+			{
+				auto range = minmax_element(column.begin(), column.end());
+				float minValue = *range.first;
+				float span = *range.second - minValue;
+
+				for(size_t i = 0; i < column.size() && (int)i + 1 < entries; i++)
+				{
+					float t = span > 0.0f ? (column[i] - minValue) / span : 0.0f;
+					palette[i + 1] = ColorLerp(low, high, t);
+				}
+			}
+
+			paletteDirty |= (mode == MAP_MODE_CHOROPLETH);
+		}
+
+		void setMapMode(MapMode newMode)
+		{
+			if(newMode == mode || newMode < 0 || newMode >= MAP_MODE_COUNT) return;
+
+			mode = newMode;
+			paletteDirty = true;
+		}
+
+		MapMode getMapMode() const { return mode; }
+
+		void setFlag(int stateIndex, StateFlag flag, bool value)
+		{
+			if(stateIndex < 0 || stateIndex + 1 >= entries) return;
+
+			unsigned char *channels = (unsigned char *)&flags[stateIndex + 1];
+			unsigned char newValue = value ? 255 : 0;
+			if(channels[flag] == newValue) return;
+
+			channels[flag] = newValue;
+			flagsDirty = true;
+		}
+
+		bool hasFlag(int stateIndex, StateFlag flag) const
+		{
+			if(stateIndex < 0 || stateIndex + 1 >= entries) return false;
+
+			return ((const unsigned char *)&flags[stateIndex + 1])[flag] != 0;
+		}
+
+		void clearFlag(StateFlag flag)
+		{
+			for(auto& entry : flags)
+			{
+				unsigned char *channels = (unsigned char *)&entry;
+				if(channels[flag] != 0)
+				{
+					channels[flag] = 0;
+					flagsDirty = true;
+				}
+			}
+		}
+
+		// Upload changed layers, called once per frame
+		void update()
+		{
+			if(paletteDirty && paletteTex.id > 0)
+			{
+				UpdateTexture(paletteTex, palettes[mode].data());
+				countTextureUpload((size_t)GetPixelDataSize(paletteTex.width, paletteTex.height, paletteTex.format));
+				paletteDirty = false;
+			}
+
+			if(flagsDirty && flagsTex.id > 0)
+			{
+				UpdateTexture(flagsTex, flags.data());
+				countTextureUpload((size_t)GetPixelDataSize(flagsTex.width, flagsTex.height, flagsTex.format));
+				flagsDirty = false;
+			}
+		}
+
+		const Texture2D& getPaletteTexture() const { return paletteTex; }
+		const Texture2D& getFlagsTexture() const { return flagsTex; }
+};
+
+#endif
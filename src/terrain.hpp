@@ -0,0 +1,694 @@
+#ifndef ARPADICA_TERRAIN_H
+#define ARPADICA_TERRAIN_H
+
+#include "raylib.h"
+#include "raymath.h"
+#include "rlgl.h"
+#include "parallel.hpp"
+#include "heightfield.hpp"
+#include "trace.hpp"
+#include "memory_stats.hpp"
+#include "render_stats.hpp"
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+
+#define TERRAIN_ERR "Arpadica::Terrain::Error: "
+
+using namespace std;
+
+// View frustum as 6 planes (a, b, c, d), a point p is inside when a*p.x + b*p.y + c*p.z + d >= 0 for all of them
+struct Frustum
+{
+	Vector4 planes[6];
+
+	static Frustum fromCamera(const Camera& camera, float aspect)
+	{
+		Matrix view = GetCameraMatrix(camera);
+		Matrix proj = MatrixPerspective(camera.fovy * DEG2RAD, aspect, RL_CULL_DISTANCE_NEAR, RL_CULL_DISTANCE_FAR);
+		Matrix clip = MatrixMultiply(view, proj);
+
+		// Rows of the combined matrix (Gribb-Hartmann plane extraction)
+		Vector4 row0 = { clip.m0, clip.m4, clip.m8,  clip.m12 };
+		Vector4 row1 = { clip.m1, clip.m5, clip.m9,  clip.m13 };
+		Vector4 row2 = { clip.m2, clip.m6, clip.m10, clip.m14 };
+		Vector4 row3 = { clip.m3, clip.m7, clip.m11, clip.m15 };
+
+		Frustum frustum;
+		frustum.planes[0] = { row3.x + row0.x, row3.y + row0.y, row3.z + row0.z, row3.w + row0.w }; // left
+		frustum.planes[1] = { row3.x - row0.x, row3.y - row0.y, row3.z - row0.z, row3.w - row0.w }; // right
+		frustum.planes[2] = { row3.x + row1.x, row3.y + row1.y, row3.z + row1.z, row3.w + row1.w }; // bottom
+		frustum.planes[3] = { row3.x - row1.x, row3.y - row1.y, row3.z - row1.z, row3.w - row1.w }; // top
+		frustum.planes[4] = { row3.x + row2.x, row3.y + row2.y, row3.z + row2.z, row3.w + row2.w }; // near
+		frustum.planes[5] = { row3.x - row2.x, row3.y - row2.y, row3.z - row2.z, row3.w - row2.w }; // far
+
+		return frustum;
+	}
+
+	bool containsBox(const BoundingBox& box) const
+	{
+		for(const auto& plane : planes)
+		{
+			// Corner of the box furthest along the plane normal
+			float x = plane.x >= 0 ? box.max.x : box.min.x;
+			float y = plane.y >= 0 ? box.max.y : box.min.y;
+			float z = plane.z >= 0 ? box.max.z : box.min.z;
+
+			if(plane.x * x + plane.y * y + plane.z * z + plane.w < 0) return false;
+		}
+
+		return true;
+	}
+};
+
+enum TerrainMode
+{
+	TERRAIN_MODE_MESH,      // chunk meshes built on the CPU from the heightfield
+	TERRAIN_MODE_DISPLACED  // one flat grid per LOD, displaced in map_overlay.vs by sampling the heightmap texture
+};
+
+// Chunked heightmap terrain with geomipmapping. The heightfield is split into square chunks, every chunk has
+// LOD_COUNT meshes with 1, 2, 4... heightmap samples per vertex step. Chunks outside the camera frustum are skipped
+// and distant chunks use coarser meshes, so the drawn triangle count follows screen coverage instead of heightmap size.
+// Every chunk carries a skirt hanging down from its border, which hides the cracks between neighbouring LODs.
+// Chunk meshes are indexed grids with one vertex per used heightmap sample and smooth central difference normals.
+//
+// In mesh mode the coarsest LOD of every chunk is built at load. Finer meshes are built on demand (a few per frame,
+// the next coarser built mesh is drawn meanwhile) and unloaded again when they have not been drawn for a while.
+// In displaced mode no terrain mesh exists at all: every chunk draws the shared flat grid of its LOD, scaled to the
+// chunk, and the vertex shader lifts it to the heightmap and derives the normals. Where streamed detail heights are
+// available (see setDetail) LOD 0 chunks draw a finer grid, so the extra samples show up as geometry.
+class Terrain
+{
+	public:
+		static constexpr int CHUNK_CELLS = 64;        // heightmap cells per chunk side at LOD 0
+		static constexpr int LOD_COUNT = 5;           // LOD l uses a vertex every 2^l samples
+		static constexpr int BUILDS_PER_FRAME = 4;    // on-demand mesh builds per frame
+		static constexpr int EVICT_AFTER_FRAMES = 600; // unload fine meshes unused for this long
+		static constexpr int MAX_DETAIL_CELLS = 128;   // detail grid cells per chunk side, keeps it within 16 bit indices
+		static constexpr int MAX_DETAIL_SLOTS = 64;    // size of the shader's detailSlots array
+
+	private:
+		// CPU side of a chunk mesh, built on worker threads and uploaded on the GL thread
+		struct ChunkGeometry
+		{
+			vector<float> vertices;
+			vector<float> normals;
+			vector<float> texcoords;
+			vector<unsigned short> indices;
+		};
+
+		struct Chunk
+		{
+			int x0, z0, x1, z1; // sample range, inclusive
+			BoundingBox bounds; // local space
+			Mesh meshes[LOD_COUNT];
+			bool built[LOD_COUNT];
+			long lastUsed[LOD_COUNT];
+		};
+
+		int width = 0, height = 0;      // heightmap samples
+		Vector3 size = { 0 };           // world size of the whole terrain
+		Vector3 scale = { 0 };          // world units per sample (y: per gray level)
+		Heightfield heightfield;
+
+		int chunksX = 0, chunksZ = 0;
+		vector<Chunk> chunks;
+
+		TerrainMode mode = TERRAIN_MODE_MESH;
+		Mesh gridMeshes[LOD_COUNT] = { 0 }; // displaced mode, unit grids with CHUNK_CELLS >> lod cells per side
+		int locLodStep = -1;
+
+		// Streamed detail heights, displaced mode only
+		Rectangle detailWindow = { 0, 0, -1, -1 }; // streamed samples (first x, first z, extent)
+		Vector2 detailSpacing = { 0 };             // world distance between streamed samples
+		Mesh detailGrid = { 0 };                   // unit grid with detailCells cells per side
+		int detailCells = 0;
+		float detailSlots[MAX_DETAIL_SLOTS] = { 0 }; // 1 = texture slot holds streamed heights
+		int detailSlotSize = 0;                    // streamed samples per slot side
+		int locDetailWindow = -1, locDetailSpacing = -1, locDetailSlots = -1, locDetailSlotSize = -1;
+
+		float lodDistance = 10.0f; // world distance at which LOD 1 starts, doubles for every further LOD
+		long frame = 0;
+		vector<pair<Chunk *, int>> visible; // reused every frame
+
+		// Per-frame stats
+		int drawnChunks = 0, culledChunks = 0;
+		long drawnTriangles = 0;
+
+		float heightAtSample(int x, int z) const
+		{
+			return heightfield.heightAtSample(x, z);
+		}
+
+		Vector3 samplePosition(int x, int z) const
+		{
+			return { x * scale.x, heightAtSample(x, z), z * scale.z };
+		}
+
+		// Vertex sample coordinates along one axis of a chunk at a given step, always including both ends
+		static vector<int> lodSamples(int from, int to, int step)
+		{
+			vector<int> samples;
+			for(int s = from; s < to; s += step) samples.push_back(s);
+			samples.push_back(to);
+			return samples;
+		}
+
+		// Normal from central differences over +-step samples
+		Vector3 sampleNormal(int x, int z, int step) const
+		{
+			float dx = (heightAtSample(x - step, z) - heightAtSample(x + step, z)) / (2.0f * step * scale.x);
+			float dz = (heightAtSample(x, z - step) - heightAtSample(x, z + step)) / (2.0f * step * scale.z);
+			return Vector3Normalize({ dx, 1.0f, dz });
+		}
+
+		// Build the indexed grid of one chunk LOD: one vertex per sample, 2 triangles per cell (same split as
+		// GenMeshHeightmap), plus a double sided skirt made of lowered copies of the border vertices.
+		// Only reads the heightfield, safe to call from worker threads.
+		ChunkGeometry buildChunkGeometry(const Chunk& chunk, int lod) const
+		{
+			int step = 1 << lod;
+			vector<int> xs = lodSamples(chunk.x0, chunk.x1, step);
+			vector<int> zs = lodSamples(chunk.z0, chunk.z1, step);
+
+			int columns = (int)xs.size();
+			int rows = (int)zs.size();
+			int border = 2 * (columns + rows) - 4;
+
+			ChunkGeometry geometry;
+			geometry.vertices.reserve((size_t)(columns * rows + border) * 3);
+			geometry.normals.reserve((size_t)(columns * rows + border) * 3);
+			geometry.texcoords.reserve((size_t)(columns * rows + border) * 2);
+			geometry.indices.reserve((size_t)(columns - 1) * (rows - 1) * 6 + (size_t)border * 12);
+
+			auto addVertex = [&](Vector3 p, Vector3 n)
+			{
+				geometry.vertices.insert(geometry.vertices.end(), { p.x, p.y, p.z });
+				geometry.normals.insert(geometry.normals.end(), { n.x, n.y, n.z });
+				geometry.texcoords.insert(geometry.texcoords.end(), { p.x / size.x, p.z / size.z });
+				return (unsigned short)(geometry.vertices.size() / 3 - 1);
+			};
+
+			for(int j = 0; j < rows; j++)
+			{
+				for(int i = 0; i < columns; i++)
+				{
+					addVertex(samplePosition(xs[i], zs[j]), sampleNormal(xs[i], zs[j], step));
+				}
+			}
+
+			for(int j = 0; j + 1 < rows; j++)
+			{
+				for(int i = 0; i + 1 < columns; i++)
+				{
+					unsigned short i00 = (unsigned short)(j * columns + i);
+					unsigned short i10 = (unsigned short)(i00 + 1);
+					unsigned short i01 = (unsigned short)(i00 + columns);
+					unsigned short i11 = (unsigned short)(i01 + 1);
+
+					geometry.indices.insert(geometry.indices.end(), { i00, i01, i10, i10, i01, i11 });
+				}
+			}
+
+			// Walk the border once around the chunk and hang a skirt below it
+			vector<unsigned short> ring;
+			for(int i = 0; i < columns; i++) ring.push_back((unsigned short)i);
+			for(int j = 1; j < rows; j++) ring.push_back((unsigned short)(j * columns + columns - 1));
+			for(int i = columns - 2; i >= 0; i--) ring.push_back((unsigned short)((rows - 1) * columns + i));
+			for(int j = rows - 2; j >= 0; j--) ring.push_back((unsigned short)(j * columns));
+
+			float skirtDepth = skirtDepthFor(step);
+			vector<unsigned short> lowered(ring.size());
+			for(size_t k = 0; k + 1 < ring.size(); k++)
+			{
+				unsigned short top = ring[k];
+				Vector3 p = { geometry.vertices[top * 3], geometry.vertices[top * 3 + 1] - skirtDepth, geometry.vertices[top * 3 + 2] };
+				Vector3 n = { geometry.normals[top * 3], geometry.normals[top * 3 + 1], geometry.normals[top * 3 + 2] };
+				lowered[k] = addVertex(p, n);
+			}
+			lowered.back() = lowered.front(); // the ring ends where it started
+
+			for(size_t k = 0; k + 1 < ring.size(); k++)
+			{
+				unsigned short a = ring[k], b = ring[k + 1];
+				unsigned short a2 = lowered[k], b2 = lowered[k + 1];
+
+				geometry.indices.insert(geometry.indices.end(), { a, b, a2, b, b2, a2, a, a2, b, b, a2, b2 });
+			}
+
+			return geometry;
+		}
+
+		// Flat unit grid for displaced mode, x and z in [0, 1]. The skirt vertices are marked with y = -1,
+		// the vertex shader lowers them by the skirt depth.
+		static ChunkGeometry buildGridGeometry(int cells)
+		{
+			ChunkGeometry geometry;
+			int side = cells + 1;
+
+			auto addVertex = [&](float x, float y, float z)
+			{
+				geometry.vertices.insert(geometry.vertices.end(), { x, y, z });
+				geometry.normals.insert(geometry.normals.end(), { 0.0f, 1.0f, 0.0f });
+				geometry.texcoords.insert(geometry.texcoords.end(), { x, z });
+				return (unsigned short)(geometry.vertices.size() / 3 - 1);
+			};
+
+			for(int j = 0; j < side; j++)
+			{
+				for(int i = 0; i < side; i++) addVertex((float)i / cells, 0.0f, (float)j / cells);
+			}
+
+			for(int j = 0; j < cells; j++)
+			{
+				for(int i = 0; i < cells; i++)
+				{
+					unsigned short i00 = (unsigned short)(j * side + i);
+					unsigned short i10 = (unsigned short)(i00 + 1);
+					unsigned short i01 = (unsigned short)(i00 + side);
+					unsigned short i11 = (unsigned short)(i01 + 1);
+
+					geometry.indices.insert(geometry.indices.end(), { i00, i01, i10, i10, i01, i11 });
+				}
+			}
+
+			vector<unsigned short> ring;
+			for(int i = 0; i < side; i++) ring.push_back((unsigned short)i);
+			for(int j = 1; j < side; j++) ring.push_back((unsigned short)(j * side + side - 1));
+			for(int i = side - 2; i >= 0; i--) ring.push_back((unsigned short)((side - 1) * side + i));
+			for(int j = side - 2; j >= 0; j--) ring.push_back((unsigned short)(j * side));
+
+			vector<unsigned short> lowered(ring.size());
+			for(size_t k = 0; k + 1 < ring.size(); k++)
+			{
+				unsigned short top = ring[k];
+				lowered[k] = addVertex(geometry.vertices[top * 3], -1.0f, geometry.vertices[top * 3 + 2]);
+			}
+			lowered.back() = lowered.front();
+
+			for(size_t k = 0; k + 1 < ring.size(); k++)
+			{
+				unsigned short a = ring[k], b = ring[k + 1];
+				unsigned short a2 = lowered[k], b2 = lowered[k + 1];
+
+				geometry.indices.insert(geometry.indices.end(), { a, b, a2, b, b2, a2, a, a2, b, b, a2, b2 });
+			}
+
+			return geometry;
+		}
+
+		float skirtDepthFor(int step) const
+		{
+			return scale.y * 255.0f * 0.1f + scale.x * step;
+		}
+
+		// Upload chunk geometry into a mesh. Vertex arrays are released afterwards, only the GPU copy is drawn.
+		// The index array stays, DrawMesh only draws indexed when mesh.indices is set.
+		static Mesh uploadChunkGeometry(ChunkGeometry& geometry)
+		{
+			Mesh mesh = { 0 };
+			mesh.vertexCount = (int)geometry.vertices.size() / 3;
+			mesh.triangleCount = (int)geometry.indices.size() / 3;
+			mesh.vertices = geometry.vertices.data();
+			mesh.normals = geometry.normals.data();
+			mesh.texcoords = geometry.texcoords.data();
+			mesh.indices = (unsigned short *)RL_MALLOC(geometry.indices.size() * sizeof(unsigned short));
+			memcpy(mesh.indices, geometry.indices.data(), geometry.indices.size() * sizeof(unsigned short));
+
+			UploadMesh(&mesh, false);
+			renderCounters().current.meshUploads++;
+
+			mesh.vertices = mesh.normals = mesh.texcoords = NULL;
+			geometry = ChunkGeometry();
+
+			return mesh;
+		}
+
+		// Build the geometry of several chunk LODs in parallel, then upload them
+		void buildLods(const vector<pair<Chunk *, int>>& requests)
+		{
+			MemoryScope memory(MEMORY_TERRAIN);
+			vector<ChunkGeometry> geometry(requests.size());
+
+			parallelFor(0, (int)requests.size(), [&](int begin, int end)
+			{
+				for(int r = begin; r < end; r++)
+				{
+					geometry[r] = buildChunkGeometry(*requests[r].first, requests[r].second);
+				}
+			});
+
+			for(size_t r = 0; r < requests.size(); r++)
+			{
+				Chunk& chunk = *requests[r].first;
+				int lod = requests[r].second;
+
+				chunk.meshes[lod] = uploadChunkGeometry(geometry[r]);
+				chunk.built[lod] = true;
+			}
+		}
+
+		void unloadLod(Chunk& chunk, int lod)
+		{
+			if(!chunk.built[lod]) return;
+
+			UnloadMesh(chunk.meshes[lod]);
+			chunk.meshes[lod] = { 0 };
+			chunk.built[lod] = false;
+		}
+
+		int desiredLod(const Chunk& chunk, Vector3 cameraLocal) const
+		{
+			// Distance from the camera to the closest point of the chunk box
+			Vector3 closest = {
+				Clamp(cameraLocal.x, chunk.bounds.min.x, chunk.bounds.max.x),
+				Clamp(cameraLocal.y, chunk.bounds.min.y, chunk.bounds.max.y),
+				Clamp(cameraLocal.z, chunk.bounds.min.z, chunk.bounds.max.z)
+			};
+			float distance = Vector3Distance(cameraLocal, closest);
+
+			int lod = 0;
+			float threshold = lodDistance;
+			while(lod < LOD_COUNT - 1 && distance > threshold)
+			{
+				lod++;
+				threshold *= 2.0f;
+			}
+
+			return lod;
+		}
+
+	public:
+		Terrain() {}
+
+		Terrain(const Terrain&) = delete;
+		Terrain& operator=(const Terrain&) = delete;
+
+		// Build the terrain from a heightmap image, terrain_size is the world size (y: height of a white pixel).
+		// Displaced mode also needs the heightmap as a texture, see setupShader.
+		bool load(Image heightmap, Vector3 terrain_size, TerrainMode terrain_mode = TERRAIN_MODE_MESH)
+		{
+			Heightfield source;
+			if(!source.load(heightmap, terrain_size))
+			{
+				cerr << TERRAIN_ERR << "Invalid heightmap image" << endl;
+				return false;
+			}
+
+			return load(move(source), terrain_mode);
+		}
+
+		// Build the terrain from a loaded heightfield (e.g. from the asset cache), the world size is the heightfield's
+		bool load(Heightfield source, TerrainMode terrain_mode = TERRAIN_MODE_MESH)
+		{
+			TRACE_SCOPE("Terrain::load");
+			MemoryScope memory(MEMORY_TERRAIN);
+			unload();
+			mode = terrain_mode;
+
+			if(!source.isLoaded())
+			{
+				cerr << TERRAIN_ERR << "Heightfield not loaded" << endl;
+				return false;
+			}
+
+			heightfield = move(source);
+
+			width = heightfield.getWidth();
+			height = heightfield.getHeight();
+			size = heightfield.getSize();
+			scale = { size.x / (width - 1), size.y / 255.0f, size.z / (height - 1) };
+
+			chunksX = (width - 1 + CHUNK_CELLS - 1) / CHUNK_CELLS;
+			chunksZ = (height - 1 + CHUNK_CELLS - 1) / CHUNK_CELLS;
+			chunks.resize((size_t)chunksX * chunksZ);
+
+			parallelFor(0, chunksZ, [&](int rowBegin, int rowEnd)
+			{
+				for(int cz = rowBegin; cz < rowEnd; cz++)
+				for(int cx = 0; cx < chunksX; cx++)
+				{
+					Chunk& chunk = chunks[(size_t)cz * chunksX + cx];
+					chunk.x0 = cx * CHUNK_CELLS;
+					chunk.z0 = cz * CHUNK_CELLS;
+					chunk.x1 = min(chunk.x0 + CHUNK_CELLS, width - 1);
+					chunk.z1 = min(chunk.z0 + CHUNK_CELLS, height - 1);
+
+					float minY = 1e30f, maxY = -1e30f;
+					for(int z = chunk.z0; z <= chunk.z1; z++)
+					{
+						for(int x = chunk.x0; x <= chunk.x1; x++)
+						{
+							float y = heightAtSample(x, z);
+							minY = min(minY, y);
+							maxY = max(maxY, y);
+						}
+					}
+
+					chunk.bounds.min = { chunk.x0 * scale.x, minY, chunk.z0 * scale.z };
+					chunk.bounds.max = { chunk.x1 * scale.x, maxY, chunk.z1 * scale.z };
+
+					for(int lod = 0; lod < LOD_COUNT; lod++)
+					{
+						chunk.meshes[lod] = { 0 };
+						chunk.built[lod] = false;
+						chunk.lastUsed[lod] = 0;
+					}
+				}
+			});
+
+			if(mode == TERRAIN_MODE_DISPLACED)
+			{
+				for(int lod = 0; lod < LOD_COUNT; lod++)
+				{
+					ChunkGeometry grid = buildGridGeometry(max(1, CHUNK_CELLS >> lod));
+					gridMeshes[lod] = uploadChunkGeometry(grid);
+				}
+
+				return true;
+			}
+
+			// The coarsest LOD must always exist, it is the fallback while finer ones are built
+			vector<pair<Chunk *, int>> coarsest;
+			for(auto& chunk : chunks) coarsest.push_back({ &chunk, LOD_COUNT - 1 });
+			buildLods(coarsest);
+
+			return true;
+		}
+
+		void unload()
+		{
+			for(auto& chunk : chunks)
+			{
+				for(int lod = 0; lod < LOD_COUNT; lod++) unloadLod(chunk, lod);
+			}
+
+			for(auto& grid : gridMeshes)
+			{
+				if(grid.vaoId > 0 || grid.vboId != NULL) UnloadMesh(grid);
+				grid = { 0 };
+			}
+
+			if(detailCells > 0) UnloadMesh(detailGrid);
+			detailGrid = { 0 };
+			detailCells = 0;
+			detailWindow = { 0, 0, -1, -1 };
+
+			chunks.clear();
+			heightfield.unload();
+			chunksX = chunksZ = 0;
+		}
+
+		// Set the terrain uniforms of map_overlay.vs. In displaced mode the heightmap texture must be bound to the
+		// shader's heightMap sampler, position is the world position of the terrain corner.
+		void setupShader(Shader shader, Vector3 position)
+		{
+			int displace = mode == TERRAIN_MODE_DISPLACED ? 1 : 0;
+			float terrainSize[4] = { size.x, size.y, size.z, skirtDepthFor(0) }; // the shader adds one grid step
+			float heightMapSize[2] = { (float)width, (float)height };
+			float origin[3] = { position.x, position.y, position.z };
+
+			SetShaderValue(shader, GetShaderLocation(shader, "terrainDisplace"), &displace, SHADER_UNIFORM_INT);
+			SetShaderValue(shader, GetShaderLocation(shader, "terrainSize"), terrainSize, SHADER_UNIFORM_VEC4);
+			SetShaderValue(shader, GetShaderLocation(shader, "heightMapSize"), heightMapSize, SHADER_UNIFORM_VEC2);
+			SetShaderValue(shader, GetShaderLocation(shader, "terrainOrigin"), origin, SHADER_UNIFORM_VEC3);
+
+			locLodStep = GetShaderLocation(shader, "lodStep");
+			locDetailWindow = GetShaderLocation(shader, "detailWindow");
+			locDetailSpacing = GetShaderLocation(shader, "detailSpacing");
+			locDetailSlots = GetShaderLocation(shader, "detailSlots");
+			locDetailSlotSize = GetShaderLocation(shader, "detailSlotSize");
+		}
+
+		// Streamed detail heights for displaced mode, the detail texture must be bound to the shader's detailHeights
+		// sampler. window is the part of it in use in streamed samples (first x, first z, extent, see
+		// TerrainStreamer::getDetailWindow), spacing the world distance between them. slots flags the texture slots
+		// of slot_size samples that hold their heights already (TerrainStreamer::getDetailSlots), the shader uses
+		// the heightmap in the others. Call every frame before draw.
+		void setDetail(Rectangle window, Vector2 spacing, const vector<float>& slots, int slot_size)
+		{
+			if(mode != TERRAIN_MODE_DISPLACED) return;
+
+			detailWindow = window;
+			detailSpacing = spacing;
+			detailSlotSize = slot_size;
+			for(int i = 0; i < MAX_DETAIL_SLOTS; i++) detailSlots[i] = i < (int)slots.size() ? slots[i] : 0.0f;
+			if(window.width < 0 || spacing.x <= 0.0f) return;
+
+			// As many cells as streamed samples across a chunk, built once the resolution is known
+			int cells = min((int)lroundf(CHUNK_CELLS * scale.x / spacing.x), MAX_DETAIL_CELLS);
+			if(cells <= CHUNK_CELLS || cells == detailCells) return;
+
+			if(detailCells > 0) UnloadMesh(detailGrid);
+			ChunkGeometry grid = buildGridGeometry(cells);
+			detailGrid = uploadChunkGeometry(grid);
+			detailCells = cells;
+		}
+
+		TerrainMode getMode() const { return mode; }
+
+		// Draw the visible chunks with material, position is the world position of the terrain corner
+		void draw(const Camera& camera, const Material& material, Vector3 position)
+		{
+			frame++;
+			drawnChunks = culledChunks = 0;
+			drawnTriangles = 0;
+
+			float aspect = (float)GetScreenWidth() / max(1, GetScreenHeight());
+			Frustum frustum = Frustum::fromCamera(camera, aspect);
+			Vector3 cameraLocal = Vector3Subtract(camera.position, position);
+			Matrix transform = MatrixTranslate(position.x, position.y, position.z);
+
+			// Cull and pick LODs first, so missing meshes can be built together
+			visible.clear();
+			vector<pair<Chunk *, int>> missing;
+
+			for(auto& chunk : chunks)
+			{
+				BoundingBox worldBounds = { Vector3Add(chunk.bounds.min, position), Vector3Add(chunk.bounds.max, position) };
+				worldBounds.min.y -= skirtDepthFor(1 << (LOD_COUNT - 1)); // include the skirt
+
+				if(!frustum.containsBox(worldBounds))
+				{
+					culledChunks++;
+					continue;
+				}
+
+				int lod = desiredLod(chunk, cameraLocal);
+				if(mode == TERRAIN_MODE_MESH && !chunk.built[lod] && (int)missing.size() < BUILDS_PER_FRAME) missing.push_back({ &chunk, lod });
+
+				visible.push_back({ &chunk, lod });
+			}
+
+			buildLods(missing);
+
+			// Detail window in terrain local space, chunks inside it get the detail grid at LOD 0
+			Rectangle detailArea = { detailWindow.x * detailSpacing.x, detailWindow.y * detailSpacing.y,
+				detailWindow.width * detailSpacing.x, detailWindow.height * detailSpacing.y };
+
+			if(mode == TERRAIN_MODE_DISPLACED)
+			{
+				float window[4] = { detailWindow.x, detailWindow.y, detailWindow.x + detailWindow.width, detailWindow.y + detailWindow.height };
+				float spacing[2] = { detailSpacing.x, detailSpacing.y };
+				if(locDetailWindow >= 0) SetShaderValue(material.shader, locDetailWindow, window, SHADER_UNIFORM_VEC4);
+				if(locDetailSpacing >= 0) SetShaderValue(material.shader, locDetailSpacing, spacing, SHADER_UNIFORM_VEC2);
+				if(locDetailSlots >= 0) SetShaderValueV(material.shader, locDetailSlots, detailSlots, SHADER_UNIFORM_FLOAT, MAX_DETAIL_SLOTS);
+				if(locDetailSlotSize >= 0) SetShaderValue(material.shader, locDetailSlotSize, &detailSlotSize, SHADER_UNIFORM_INT);
+			}
+
+			for(auto& entry : visible)
+			{
+				Chunk& chunk = *entry.first;
+				int lod = entry.second;
+
+				if(mode == TERRAIN_MODE_DISPLACED)
+				{
+					bool detail = lod == 0 && detailCells > 0 && detailWindow.width >= 0 &&
+						chunk.x0 * scale.x >= detailArea.x && chunk.x1 * scale.x <= detailArea.x + detailArea.width &&
+						chunk.z0 * scale.z >= detailArea.y && chunk.z1 * scale.z <= detailArea.y + detailArea.height;
+					const Mesh& grid = detail ? detailGrid : gridMeshes[lod];
+
+					// Stretch the shared grid over the chunk, the shader samples the heights
+					float step = detail ? (float)CHUNK_CELLS / detailCells : (float)(1 << lod);
+					if(locLodStep >= 0) SetShaderValue(material.shader, locLodStep, &step, SHADER_UNIFORM_FLOAT);
+
+					Matrix chunkTransform = MatrixMultiply(
+						MatrixScale((chunk.x1 - chunk.x0) * scale.x, 1.0f, (chunk.z1 - chunk.z0) * scale.z),
+						MatrixTranslate(position.x + chunk.x0 * scale.x, position.y, position.z + chunk.z0 * scale.z));
+
+					DrawMesh(grid, material, chunkTransform);
+
+					drawnChunks++;
+					drawnTriangles += grid.triangleCount;
+					continue;
+				}
+
+				// Fall back to the next coarser mesh that exists, the coarsest one always does
+				while(!chunk.built[lod]) lod++;
+
+				chunk.lastUsed[lod] = frame;
+				DrawMesh(chunk.meshes[lod], material, transform);
+
+				drawnChunks++;
+				drawnTriangles += chunk.meshes[lod].triangleCount;
+			}
+
+			RenderStats& stats = renderCounters().current;
+			stats.terrainTriangles += drawnTriangles;
+			stats.terrainChunks += drawnChunks;
+			stats.meshDraws += drawnChunks;
+
+			// Release fine meshes nobody looked at for a while
+			for(auto& chunk : chunks)
+			{
+				for(int lod = 0; lod < LOD_COUNT - 1; lod++)
+				{
+					if(chunk.built[lod] && frame - chunk.lastUsed[lod] > EVICT_AFTER_FRAMES) unloadLod(chunk, lod);
+				}
+			}
+		}
+
+		void setLodDistance(float distance) { lodDistance = distance; }
+
+		int getDrawnChunks() const { return drawnChunks; }
+		int getCulledChunks() const { return culledChunks; }
+		long getDrawnTriangles() const { return drawnTriangles; }
+
+		// Chunk meshes that are built right now, and the index copies raylib keeps of them on the CPU
+		size_t getGpuBytes() const
+		{
+			size_t bytes = 0;
+			for(const auto& grid : gridMeshes) bytes += meshGpuBytes(grid);
+			if(detailCells > 0) bytes += meshGpuBytes(detailGrid);
+			for(const auto& chunk : chunks)
+			{
+				for(int lod = 0; lod < LOD_COUNT; lod++) if(chunk.built[lod]) bytes += meshGpuBytes(chunk.meshes[lod]);
+			}
+			return bytes;
+		}
+
+		size_t getIndexBytes() const
+		{
+			size_t bytes = 0;
+			for(const auto& grid : gridMeshes) if(grid.indices != NULL) bytes += (size_t)grid.triangleCount * 3 * sizeof(unsigned short);
+			if(detailGrid.indices != NULL) bytes += (size_t)detailGrid.triangleCount * 3 * sizeof(unsigned short);
+			for(const auto& chunk : chunks)
+			{
+				for(int lod = 0; lod < LOD_COUNT; lod++)
+				{
+					if(chunk.built[lod] && chunk.meshes[lod].indices != NULL) bytes += (size_t)chunk.meshes[lod].triangleCount * 3 * sizeof(unsigned short);
+				}
+			}
+			return bytes;
+		}
+
+		Vector3 getSize() const { return size; }
+
+		// CPU heights for picking and gameplay, in terrain local space (see Heightfield)
+		const Heightfield& getHeightfield() const { return heightfield; }
+};
+
+#endif
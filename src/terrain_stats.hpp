@@ -0,0 +1,214 @@
+#ifndef ARPADICA_TERRAINSTATS_H
+#define ARPADICA_TERRAINSTATS_H
+
+#include "raylib.h"
+#include "map_engine.hpp"
+#include "heightfield.hpp"
+#include "rasterizer.hpp"
+#include "map_cache.hpp"
+#include "parallel.hpp"
+#include "trace.hpp"
+#include <vector>
+#include <unordered_map>
+#include <string>
+#include <cmath>
+#include <algorithm>
+
+// Slope classes in degrees: [0, 2), [2, 5), [5, 10), [10, 20), [20, 30), [30, 90]
+static constexpr int TERRAIN_SLOPE_BINS = 6;
+static constexpr float terrainSlopeBinEdges[TERRAIN_SLOPE_BINS - 1] = { 2.0f, 5.0f, 10.0f, 20.0f, 30.0f };
+
+// Samples at or below this elevation (0..1 of the heightmap range) count as sea
+static constexpr float TERRAIN_SEA_LEVEL = 0.01f;
+
+static constexpr uint32_t TERRAIN_STATS_VERSION = 1;
+
+// Terrain of one state, measured over the heightfield samples it covers.
+// Elevations are 0..1 of the heightmap range, the land area is in map pixels (same unit as the "area" column).
+struct StateTerrainStats
+{
+	float mean_elevation;
+	float max_elevation;
+	float roughness;                             // standard deviation of the elevation
+	float land_area;
+	float slope_histogram[TERRAIN_SLOPE_BINS];   // share of the covered samples per slope class, sums to 1
+};
+
+// Rasterize every state over the heightfield (one raster pixel per sample) and measure the terrain under it.
+// Rows are rasterized a band at a time, every worker accumulates its slice of each band into totals of just the states
+// it meets there, which are merged once the band is done. Memory stays with the states per band, not workers x states.
+inline vector<StateTerrainStats> bakeStateTerrainStats(const MapEngine& mapEngine, const Heightfield& heightfield)
+{
+	TRACE_SCOPE("bakeStateTerrainStats");
+	struct Totals
+	{
+		double sum = 0.0, sum_squares = 0.0;
+		float max = 0.0f;
+		uint32_t samples = 0, land = 0;
+		uint32_t slopes[TERRAIN_SLOPE_BINS] = { 0 };
+	};
+
+	const size_t stateCount = mapEngine.getStates().size();
+	vector<StateTerrainStats> stats(stateCount);
+	if(stateCount == 0 || !heightfield.isLoaded()) return stats;
+
+	const int width = heightfield.getWidth();
+	const int height = heightfield.getHeight();
+	const Vector3 scale = heightfield.getScale();
+
+	SoftwareRasterizer rasterizer;
+	rasterizer.prepare(mapEngine, width, height);
+
+	auto add = [](Totals& t, const Totals& l)
+	{
+		t.sum += l.sum;
+		t.sum_squares += l.sum_squares;
+		t.max = max(t.max, l.max);
+		t.samples += l.samples;
+		t.land += l.land;
+		for(int b = 0; b < TERRAIN_SLOPE_BINS; b++) t.slopes[b] += l.slopes[b];
+	};
+
+	vector<Totals> totals(stateCount);
+
+	// Totals of the states each worker met in the current band, keyed by state index
+	const int workers = min(workerCount(), height);
+	vector<unordered_map<uint32_t, Totals>> workerTotals(workers);
+
+	const int bandRows = 256;
+	vector<uint32_t> band((size_t)width * bandRows);
+
+	for(int bandBegin = 0; bandBegin < height; bandBegin += bandRows)
+	{
+		int bandEnd = min(bandBegin + bandRows, height);
+		rasterizer.rasterizeIndices(bandBegin, bandEnd, band.data());
+
+		const int workerRows = (bandEnd - bandBegin + workers - 1) / workers;
+
+		parallelFor(0, workers, [&](int workerBegin, int workerEnd)
+		{
+			for(int w = workerBegin; w < workerEnd; w++)
+			{
+				unordered_map<uint32_t, Totals>& local = workerTotals[w];
+				int rowBegin = bandBegin + w * workerRows;
+				int rowEnd = min(bandEnd, rowBegin + workerRows);
+
+				// Neighboring samples mostly belong to the same state, only look it up when it changes
+				uint32_t lastIndex = 0;
+				Totals *current = nullptr;
+
+				for(int z = rowBegin; z < rowEnd; z++)
+				{
+					const uint32_t *row = band.data() + (size_t)(z - bandBegin) * width;
+					for(int x = 0; x < width; x++)
+					{
+						if(row[x] == 0) continue;
+
+						if(row[x] != lastIndex)
+						{
+							lastIndex = row[x];
+							current = &local[row[x] - 1];
+						}
+						Totals& t = *current;
+
+						float elevation = heightfield.rawSample(x, z) / 65535.0f;
+						t.sum += elevation;
+						t.sum_squares += (double)elevation * elevation;
+						t.max = max(t.max, elevation);
+						t.samples++;
+						if(elevation > TERRAIN_SEA_LEVEL) t.land++;
+
+						// Slope of the terrain as drawn, central differences in world units
+						float dx = (heightfield.heightAtSample(x + 1, z) - heightfield.heightAtSample(x - 1, z)) / (2.0f * scale.x);
+						float dz = (heightfield.heightAtSample(x, z + 1) - heightfield.heightAtSample(x, z - 1)) / (2.0f * scale.z);
+						float slope = atanf(sqrtf(dx * dx + dz * dz)) * RAD2DEG;
+
+						int bin = 0;
+						while(bin < TERRAIN_SLOPE_BINS - 1 && slope >= terrainSlopeBinEdges[bin]) bin++;
+						t.slopes[bin]++;
+					}
+				}
+			}
+		});
+
+		for(auto& local : workerTotals)
+		{
+			for(const auto& entry : local) add(totals[entry.first], entry.second);
+			local.clear();
+		}
+	}
+
+	// One raster pixel covers this much of the map
+	const float pixelArea = (mapEngine.getMapWidth() / (float)width) * (mapEngine.getMapHeight() / (float)height);
+
+	for(size_t i = 0; i < stateCount; i++)
+	{
+		const Totals& t = totals[i];
+		StateTerrainStats& s = stats[i];
+		memset(&s, 0, sizeof(s));
+		if(t.samples == 0) continue; // smaller than a sample, leave it flat
+
+		double mean = t.sum / t.samples;
+		s.mean_elevation = (float)mean;
+		s.max_elevation = t.max;
+		s.roughness = (float)sqrt(max(0.0, t.sum_squares / t.samples - mean * mean));
+		s.land_area = t.land * pixelArea;
+		for(int b = 0; b < TERRAIN_SLOPE_BINS; b++) s.slope_histogram[b] = (float)t.slopes[b] / t.samples;
+	}
+
+	return stats;
+}
+
+// Publish the statistics as MapEngine columns: elevation_mean, elevation_max, roughness, land_area, slope_0..slope_5
+inline void storeStateTerrainStats(MapEngine& mapEngine, const vector<StateTerrainStats>& stats)
+{
+	auto column = [&](const string& name, auto value)
+	{
+		vector<float> values(stats.size());
+		for(size_t i = 0; i < stats.size(); i++) values[i] = value(stats[i]);
+		mapEngine.setColumn(name, move(values));
+	};
+
+	column("elevation_mean", [](const StateTerrainStats& s) { return s.mean_elevation; });
+	column("elevation_max", [](const StateTerrainStats& s) { return s.max_elevation; });
+	column("roughness", [](const StateTerrainStats& s) { return s.roughness; });
+	column("land_area", [](const StateTerrainStats& s) { return s.land_area; });
+
+	for(int b = 0; b < TERRAIN_SLOPE_BINS; b++)
+	{
+		column("slope_" + to_string(b), [b](const StateTerrainStats& s) { return s.slope_histogram[b]; });
+	}
+}
+
+// Load the statistics from the cache, or bake and cache them when the sources changed (source_key).
+// Either way they end up as MapEngine columns.
+inline bool loadStateTerrainStats(MapEngine& mapEngine, const Heightfield& heightfield, const MapCache& cache, uint64_t source_key)
+{
+	TRACE_SCOPE("loadStateTerrainStats");
+	if(!heightfield.isLoaded()) return false;
+
+	const size_t stateCount = mapEngine.getStates().size();
+
+	uint64_t key = MapCache::combine(source_key, TERRAIN_STATS_VERSION);
+	key = MapCache::combine(key, stateCount);
+	key = MapCache::combine(key, ((uint64_t)heightfield.getWidth() << 32) | (uint32_t)heightfield.getHeight());
+
+	vector<StateTerrainStats> stats;
+
+	vector<unsigned char> blob;
+	if(cache.read("terrain_stats", key, blob) && blob.size() == stateCount * sizeof(StateTerrainStats))
+	{
+		stats.resize(stateCount);
+		memcpy(stats.data(), blob.data(), blob.size());
+	}
+	else
+	{
+		stats = bakeStateTerrainStats(mapEngine, heightfield);
+		cache.write("terrain_stats", key, stats.data(), stats.size() * sizeof(StateTerrainStats));
+	}
+
+	storeStateTerrainStats(mapEngine, stats);
+	return true;
+}
+
+#endif
@@ -0,0 +1,564 @@
+#ifndef ARPADICA_TERRAINSTREAMER_H
+#define ARPADICA_TERRAINSTREAMER_H
+
+#include "raylib.h"
+#include "raymath.h"
+#include "rlgl.h"
+#include "heightfield.hpp"
+#include "trace.hpp"
+#include "memory_stats.hpp"
+#include "render_stats.hpp"
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+#define TERRAINSTREAMER_ERR "Arpadica::TerrainStreamer::Error: "
+
+// Tiled 16 bit height file: a header followed by tilesX * tilesZ tiles of tileSize x tileSize samples.
+// Tiles are stored row by row, samples row by row inside a tile, edge tiles are padded by repeating the last sample.
+// A tile can be read with one seek and one read, without touching the rest of the file.
+struct HeightTileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	int32_t width, height;  // samples
+	int32_t tileSize;
+	Vector3 size;           // world size of the terrain, like Heightfield
+};
+
+static constexpr uint32_t HEIGHT_TILES_MAGIC = 0x54485241; // "ARHT"
+static constexpr uint32_t HEIGHT_TILES_VERSION = 1;
+
+// Write row major 16 bit samples as a tiled height file
+inline bool writeHeightTiles(const string& path, const uint16_t *samples, int width, int height, Vector3 size, int tile_size = 256)
+{
+	ofstream file(path, ios::binary | ios::trunc);
+	if(!file || samples == NULL || width < 2 || height < 2 || tile_size < 2)
+	{
+		cerr << TERRAINSTREAMER_ERR << "Could not write height tiles: " << path << endl;
+		return false;
+	}
+
+	HeightTileHeader header = { HEIGHT_TILES_MAGIC, HEIGHT_TILES_VERSION, width, height, tile_size, size };
+	file.write((const char *)&header, sizeof(header));
+
+	int tilesX = (width + tile_size - 1) / tile_size;
+	int tilesZ = (height + tile_size - 1) / tile_size;
+
+	vector<uint16_t> tile((size_t)tile_size * tile_size);
+	for(int tz = 0; tz < tilesZ; tz++)
+	{
+		for(int tx = 0; tx < tilesX; tx++)
+		{
+			for(int z = 0; z < tile_size; z++)
+			{
+				int sz = min(tz * tile_size + z, height - 1);
+				for(int x = 0; x < tile_size; x++)
+				{
+					int sx = min(tx * tile_size + x, width - 1);
+					tile[(size_t)z * tile_size + x] = samples[(size_t)sz * width + sx];
+				}
+			}
+
+			file.write((const char *)tile.data(), tile.size() * sizeof(uint16_t));
+		}
+	}
+
+	return (bool)file;
+}
+
+// Streams tiles of a height file around a focus point (usually the camera target) on a background thread.
+// Resident tiles live in a fixed pool of slots allocated up front, so memory never grows past max_resident tiles.
+// Tiles are requested nearest first; when the pool is full, the least recently wanted tiles are evicted.
+//
+// The render thread only calls update(), updateDetail() and the height queries. update() never waits for the loader,
+// when the loader holds the lock it simply tries again next frame. Only the render thread evicts and only the loader
+// fills free slots, so the height queries can read resident tiles without locking.
+//
+// The resident tiles around the focus are also copied into the detail texture, a float texture of detailTiles x
+// detailTiles tiles the terrain shader samples instead of the heightmap (map_overlay.vs). Tiles are stored wrapped
+// around, tile (x, z) in slot (x % detailTiles, z % detailTiles), so a moving window only rewrites the tiles that
+// enter it. At most DETAIL_UPLOADS_PER_FRAME tiles are copied per frame, nearest first. The shader gets a flag per
+// slot and uses the heightmap where a slot doesn't hold its tile yet.
+class TerrainStreamer
+{
+	private:
+		static constexpr int DETAIL_UPLOADS_PER_FRAME = 2; // 256 KB each at 256 samples per tile
+		static constexpr int MAX_DETAIL_TILES = 8;         // per side, the shader has flags for 64 slots
+
+		struct Request
+		{
+			float distance;
+			int tile;
+			bool operator<(const Request& other) const { return distance > other.distance; } // nearest on top
+		};
+
+		struct DetailUpload
+		{
+			int distance; // squared, in tiles
+			int tile, slot;
+		};
+
+		HeightTileHeader header = { 0 };
+		int tilesX = 0, tilesZ = 0;
+		string path;
+
+		// Pool
+		int maxResident = 0;
+		vector<uint16_t> pool;                  // maxResident slots of tileSize * tileSize samples
+		unique_ptr<atomic<int>[]> slotOfTile;   // -1 = not resident
+		vector<int> tileOfSlot;                 // render thread only
+		vector<long> lastWanted;                // per slot, render thread only
+		vector<int> freeSlots;                  // guarded by queueMutex
+		vector<unsigned char> loading;          // per tile, guarded by queueMutex
+
+		// Loader
+		vector<Request> requests;               // heap, nearest on top, guarded by queueMutex
+		mutex queueMutex;
+		condition_variable queueReady;
+		thread loader;
+		atomic<bool> stopLoader{ false };
+		atomic<int> pending{ 0 };
+
+		long frame = 0;
+		vector<int> candidates;                 // eviction candidates, render thread only
+
+		// Detail texture, render thread only
+		Texture2D detailTexture = { 0 };
+		int detailTiles = 0;                    // per side
+		vector<int> detailSlotTile;             // tile whose heights are in a slot, -1 = none
+		vector<float> detailSlotValid;          // per slot, 1 = holds the window's tile there (shader's detailSlots)
+		vector<DetailUpload> detailPending;     // window tiles loaded but not copied yet, reused every frame
+		vector<float> detailPixels;             // one tile, staging for the upload
+		Rectangle detailWindow = { 0, 0, -1, -1 }; // streamed samples covered right now (first x, first z, extent)
+
+		void loadTiles()
+		{
+			Tracer::instance().setThreadName("Terrain streamer");
+			MemoryScope memory(MEMORY_TERRAIN);
+
+			ifstream file(path, ios::binary);
+			const size_t tileSamples = (size_t)header.tileSize * header.tileSize;
+
+			while(true)
+			{
+				int tile, slot;
+				{
+					unique_lock<mutex> lock(queueMutex);
+					queueReady.wait(lock, [&]() { return stopLoader || (!requests.empty() && !freeSlots.empty()); });
+					if(stopLoader) return;
+
+					pop_heap(requests.begin(), requests.end());
+					tile = requests.back().tile;
+					requests.pop_back();
+					pending = (int)requests.size();
+
+					if(slotOfTile[tile].load(memory_order_relaxed) >= 0 || loading[tile]) continue;
+
+					slot = freeSlots.back();
+					freeSlots.pop_back();
+					loading[tile] = 1;
+				}
+
+				// The slot belongs to this thread until it is published
+				TraceScope readTrace("TerrainStreamer: read tile");
+				uint16_t *dst = pool.data() + (size_t)slot * tileSamples;
+				file.clear();
+				file.seekg((streamoff)(sizeof(HeightTileHeader) + (size_t)tile * tileSamples * sizeof(uint16_t)));
+				bool ok = (bool)file.read((char *)dst, tileSamples * sizeof(uint16_t));
+				readTrace.end();
+
+				lock_guard<mutex> lock(queueMutex);
+				loading[tile] = 0;
+				if(ok)
+				{
+					tileOfSlot[slot] = tile;
+					slotOfTile[tile].store(slot, memory_order_release);
+				}
+				else
+				{
+					cerr << TERRAINSTREAMER_ERR << "Could not read tile " << tile << " of " << path << endl;
+					freeSlots.push_back(slot);
+				}
+			}
+		}
+
+		// Raw sample from a resident tile, false when its tile is not loaded
+		bool sample(int x, int z, uint16_t& out) const
+		{
+			x = min(max(x, 0), header.width - 1);
+			z = min(max(z, 0), header.height - 1);
+
+			int tile = (z / header.tileSize) * tilesX + (x / header.tileSize);
+			int slot = slotOfTile[tile].load(memory_order_acquire);
+			if(slot < 0) return false;
+
+			size_t index = (size_t)slot * header.tileSize * header.tileSize + (size_t)(z % header.tileSize) * header.tileSize + (x % header.tileSize);
+			out = pool[index];
+			return true;
+		}
+
+		// World distance between two streamed samples
+		Vector2 sampleSpacing() const
+		{
+			return { header.size.x / (header.width - 1), header.size.z / (header.height - 1) };
+		}
+
+		// Window of about 1024 samples per side, at least 2 tiles
+		void openDetail()
+		{
+			detailTiles = max(2, min(MAX_DETAIL_TILES, 1024 / header.tileSize));
+			const int side = detailTiles * header.tileSize;
+
+			// Left undefined, no slot is valid until its tile is copied in
+			detailTexture.id = rlLoadTexture(NULL, side, side, PIXELFORMAT_UNCOMPRESSED_R32, 1);
+			detailTexture.width = detailTexture.height = side;
+			detailTexture.mipmaps = 1;
+			detailTexture.format = PIXELFORMAT_UNCOMPRESSED_R32;
+
+			if(detailTexture.id == 0) cerr << TERRAINSTREAMER_ERR << "Could not create the detail height texture" << endl;
+
+			detailSlotTile.assign((size_t)detailTiles * detailTiles, -1);
+			detailSlotValid.assign((size_t)detailTiles * detailTiles, 0.0f);
+			detailPending.clear();
+			detailPending.reserve((size_t)detailTiles * detailTiles);
+			detailPixels.resize((size_t)header.tileSize * header.tileSize);
+		}
+
+		// Copy the heights of a resident tile into its detail slot
+		void uploadDetailTile(int tile, int slot)
+		{
+			const int tileSize = header.tileSize;
+			const size_t tileSamples = (size_t)tileSize * tileSize;
+
+			const uint16_t *src = pool.data() + (size_t)slotOfTile[tile].load(memory_order_relaxed) * tileSamples;
+			const float toHeight = header.size.y / 65535.0f;
+			for(size_t i = 0; i < tileSamples; i++) detailPixels[i] = src[i] * toHeight;
+
+			Rectangle rec = { (float)(slot % detailTiles * tileSize), (float)(slot / detailTiles * tileSize), (float)tileSize, (float)tileSize };
+			UpdateTextureRec(detailTexture, rec, detailPixels.data());
+			countTextureUpload(tileSamples * sizeof(float));
+
+			detailSlotTile[slot] = tile;
+		}
+
+	public:
+		TerrainStreamer() {}
+		~TerrainStreamer() { close(); }
+
+		TerrainStreamer(const TerrainStreamer&) = delete;
+		TerrainStreamer& operator=(const TerrainStreamer&) = delete;
+
+		// Open a tiled height file (see writeHeightTiles) and start the loader, keeping at most max_resident tiles
+		bool open(const string& file_path, int max_resident)
+		{
+			close();
+			MemoryScope memory(MEMORY_TERRAIN);
+
+			ifstream file(file_path, ios::binary);
+			if(!file) return false;
+
+			if(!file.read((char *)&header, sizeof(header)) || header.magic != HEIGHT_TILES_MAGIC || header.version != HEIGHT_TILES_VERSION ||
+				header.width < 2 || header.height < 2 || header.tileSize < 2)
+			{
+				cerr << TERRAINSTREAMER_ERR << "Invalid height tile file: " << file_path << endl;
+				header = { 0 };
+				return false;
+			}
+
+			path = file_path;
+			tilesX = (header.width + header.tileSize - 1) / header.tileSize;
+			tilesZ = (header.height + header.tileSize - 1) / header.tileSize;
+
+			const int tileCount = tilesX * tilesZ;
+			maxResident = max(1, min(max_resident, tileCount));
+
+			pool.assign((size_t)maxResident * header.tileSize * header.tileSize, 0);
+			slotOfTile.reset(new atomic<int>[tileCount]);
+			for(int i = 0; i < tileCount; i++) slotOfTile[i].store(-1);
+			loading.assign(tileCount, 0);
+
+			tileOfSlot.assign(maxResident, -1);
+			lastWanted.assign(maxResident, 0);
+			freeSlots.clear();
+			for(int slot = maxResident - 1; slot >= 0; slot--) freeSlots.push_back(slot);
+
+			openDetail();
+
+			stopLoader = false;
+			loader = thread(&TerrainStreamer::loadTiles, this);
+			return true;
+		}
+
+		void close()
+		{
+			if(loader.joinable())
+			{
+				{
+					lock_guard<mutex> lock(queueMutex);
+					stopLoader = true;
+				}
+				queueReady.notify_all();
+				loader.join();
+			}
+
+			if(detailTexture.id != 0) UnloadTexture(detailTexture);
+			detailTexture = { 0 };
+			detailSlotTile.clear();
+			detailSlotValid.clear();
+			detailPending.clear();
+			detailPixels.clear();
+			detailPixels.shrink_to_fit();
+			detailWindow = { 0, 0, -1, -1 };
+
+			requests.clear();
+			pool.clear();
+			pool.shrink_to_fit();
+			slotOfTile.reset();
+			tileOfSlot.clear();
+			lastWanted.clear();
+			freeSlots.clear();
+			loading.clear();
+			tilesX = tilesZ = 0;
+			pending = 0;
+		}
+
+		bool isOpen() const { return loader.joinable(); }
+
+		// Request the tiles within radius of focus (terrain local x, z) and evict tiles nobody wanted for the longest.
+		// Called once per frame from the render thread, never blocks.
+		void update(Vector2 focus, float radius)
+		{
+			if(!isOpen()) return;
+			frame++;
+
+			const float tileWorldX = header.size.x / (header.width - 1) * header.tileSize;
+			const float tileWorldZ = header.size.z / (header.height - 1) * header.tileSize;
+
+			int tx0 = max(0, (int)floorf((focus.x - radius) / tileWorldX));
+			int tx1 = min(tilesX - 1, (int)floorf((focus.x + radius) / tileWorldX));
+			int tz0 = max(0, (int)floorf((focus.y - radius) / tileWorldZ));
+			int tz1 = min(tilesZ - 1, (int)floorf((focus.y + radius) / tileWorldZ));
+
+			unique_lock<mutex> lock(queueMutex, try_to_lock);
+			if(!lock.owns_lock()) return;
+
+			// Cleared in place, the queue and the eviction list keep their storage from frame to frame
+			requests.clear();
+
+			for(int tz = tz0; tz <= tz1; tz++)
+			{
+				for(int tx = tx0; tx <= tx1; tx++)
+				{
+					int tile = tz * tilesX + tx;
+
+					float cx = (tx + 0.5f) * tileWorldX - focus.x;
+					float cz = (tz + 0.5f) * tileWorldZ - focus.y;
+					float distance = sqrtf(cx * cx + cz * cz);
+
+					int slot = slotOfTile[tile].load(memory_order_relaxed);
+					if(slot >= 0) lastWanted[slot] = frame;
+					else if(!loading[tile])
+					{
+						requests.push_back({ distance, tile });
+						push_heap(requests.begin(), requests.end());
+					}
+				}
+			}
+
+			// Make room for the nearest requests by evicting the least recently wanted tiles
+			int needed = min((int)requests.size(), maxResident) - (int)freeSlots.size();
+			if(needed > 0)
+			{
+				candidates.clear();
+				for(int slot = 0; slot < maxResident; slot++)
+				{
+					if(tileOfSlot[slot] >= 0 && lastWanted[slot] < frame) candidates.push_back(slot);
+				}
+
+				int evict = min(needed, (int)candidates.size());
+				partial_sort(candidates.begin(), candidates.begin() + evict, candidates.end(), [&](int a, int b) { return lastWanted[a] < lastWanted[b]; });
+
+				for(int i = 0; i < evict; i++)
+				{
+					int slot = candidates[i];
+					slotOfTile[tileOfSlot[slot]].store(-1, memory_order_relaxed);
+					tileOfSlot[slot] = -1;
+					freeSlots.push_back(slot);
+				}
+			}
+
+			pending = (int)requests.size();
+			lock.unlock();
+			queueReady.notify_one();
+		}
+
+		// Bilinear height at a terrain local position from the resident tiles, false when they are not loaded yet
+		bool heightAt(float x, float z, float& out) const
+		{
+			if(!isOpen()) return false;
+
+			float sx = Clamp(x / header.size.x * (header.width - 1), 0.0f, (float)(header.width - 1));
+			float sz = Clamp(z / header.size.z * (header.height - 1), 0.0f, (float)(header.height - 1));
+			int x0 = (int)sx, z0 = (int)sz;
+			float fx = sx - x0, fz = sz - z0;
+
+			uint16_t h00, h10, h01, h11;
+			if(!sample(x0, z0, h00) || !sample(x0 + 1, z0, h10) || !sample(x0, z0 + 1, h01) || !sample(x0 + 1, z0 + 1, h11)) return false;
+
+			float top = h00 + (h10 - h00) * fx;
+			float bottom = h01 + (h11 - h01) * fx;
+			out = (top + (bottom - top) * fz) / 65535.0f * header.size.y;
+			return true;
+		}
+
+		// Streamed height where available, otherwise the always resident base heightfield
+		float heightAt(float x, float z, const Heightfield& fallback) const
+		{
+			float h;
+			return heightAt(x, z, h) ? h : fallback.heightAt(x, z);
+		}
+
+		// Move the detail window over the tiles around focus (terrain local x, z) and copy the tiles that entered it
+		// or finished loading into the detail texture, a few per frame. Call after update(), render thread only.
+		void updateDetail(Vector2 focus)
+		{
+			if(!isOpen() || detailTexture.id == 0) return;
+
+			const Vector2 spacing = sampleSpacing();
+			int focusX = (int)floorf(focus.x / (spacing.x * header.tileSize));
+			int focusZ = (int)floorf(focus.y / (spacing.y * header.tileSize));
+
+			// First tile of the window, the window stays inside the file
+			int firstX = max(0, min(focusX - detailTiles / 2, tilesX - detailTiles));
+			int firstZ = max(0, min(focusZ - detailTiles / 2, tilesZ - detailTiles));
+			int lastX = min(firstX + detailTiles, tilesX) - 1;
+			int lastZ = min(firstZ + detailTiles, tilesZ) - 1;
+
+			fill(detailSlotValid.begin(), detailSlotValid.end(), 0.0f);
+			detailPending.clear();
+
+			for(int tz = firstZ; tz <= lastZ; tz++)
+			{
+				for(int tx = firstX; tx <= lastX; tx++)
+				{
+					int tile = tz * tilesX + tx;
+					int slot = (tz % detailTiles) * detailTiles + (tx % detailTiles);
+
+					// Evicted tiles keep their copy
+					if(detailSlotTile[slot] == tile)
+					{
+						detailSlotValid[slot] = 1.0f;
+						continue;
+					}
+
+					if(slotOfTile[tile].load(memory_order_acquire) < 0) continue; // pairs with the loader's release
+
+					int dx = tx - focusX, dz = tz - focusZ;
+					detailPending.push_back({ dx * dx + dz * dz, tile, slot });
+				}
+			}
+
+			// Nearest first, the rest stay on the heightmap until a later frame
+			int uploads = min((int)detailPending.size(), DETAIL_UPLOADS_PER_FRAME);
+			partial_sort(detailPending.begin(), detailPending.begin() + uploads, detailPending.end(),
+				[](const DetailUpload& a, const DetailUpload& b) { return a.distance < b.distance; });
+
+			for(int i = 0; i < uploads; i++)
+			{
+				uploadDetailTile(detailPending[i].tile, detailPending[i].slot);
+				detailSlotValid[detailPending[i].slot] = 1.0f;
+			}
+
+			// The last sample of the window is left out, a bilinear lookup needs the one after it
+			detailWindow.x = (float)(firstX * header.tileSize);
+			detailWindow.y = (float)(firstZ * header.tileSize);
+			detailWindow.width = (float)(min((lastX + 1) * header.tileSize, header.width) - 1) - detailWindow.x;
+			detailWindow.height = (float)(min((lastZ + 1) * header.tileSize, header.height) - 1) - detailWindow.y;
+		}
+
+		// Streamed samples the detail texture covers (first x, first z, extent), a negative extent while it is empty.
+		// Sample (x, z) is texel (x % side, z % side), sampleSpacing() apart in terrain local space.
+		Rectangle getDetailWindow() const { return detailWindow; }
+		Vector2 getDetailSpacing() const { return isOpen() ? sampleSpacing() : Vector2{ 0.0f, 0.0f }; }
+
+		// Per texture slot of getDetailSlotSize() samples, row by row: 1 where it holds the window's tile, 0 where
+		// the heightmap has to be used
+		const vector<float>& getDetailSlots() const { return detailSlotValid; }
+		int getDetailSlotSize() const { return header.tileSize; }
+		Texture2D getDetailTexture() const { return detailTexture; }
+
+		// Ray hit on the streamed heights, for a ray in terrain local space. The hit on the base heightfield is
+		// refined by marching the ray across it where the streamed heights differ, falls back to the base hit
+		// where no tiles are resident.
+		bool raycast(Ray ray, const Heightfield& fallback, Vector3 *hit) const
+		{
+			if(!fallback.raycast(ray, hit)) return false;
+
+			float detail;
+			if(!heightAt(hit->x, hit->z, detail)) return true;
+
+			// Start a little above the base hit and walk half a streamed sample at a time
+			const Vector2 spacing = sampleSpacing();
+			const float step = 0.5f * min(spacing.x, spacing.y);
+			const float above = header.size.y * 0.1f / max(fabsf(ray.direction.y), 0.05f);
+			const int maxSteps = 1024;
+
+			float hitT = Vector3Distance(ray.position, *hit);
+			float t = max(0.0f, hitT - min(above, step * maxSteps / 2));
+			auto aboveSurface = [&](float at)
+			{
+				Vector3 p = Vector3Add(ray.position, Vector3Scale(ray.direction, at));
+				return p.y > heightAt(p.x, p.z, fallback);
+			};
+
+			if(!aboveSurface(t)) return true;
+
+			for(int i = 0; i < maxSteps; i++)
+			{
+				float next = t + step;
+				if(aboveSurface(next))
+				{
+					t = next;
+					continue;
+				}
+
+				// Crossed the surface between t and next
+				float low = t, high = next;
+				for(int k = 0; k < 8; k++)
+				{
+					float mid = 0.5f * (low + high);
+					if(aboveSurface(mid)) low = mid;
+					else high = mid;
+				}
+
+				Vector3 p = Vector3Add(ray.position, Vector3Scale(ray.direction, high));
+				*hit = { p.x, heightAt(p.x, p.z, fallback), p.z };
+				return true;
+			}
+
+			return true;
+		}
+
+		int getResidentCount() const
+		{
+			int count = 0;
+			for(int tile : tileOfSlot) count += tile >= 0;
+			return count;
+		}
+
+		int getPendingCount() const { return pending; }
+		int getTileCount() const { return tilesX * tilesZ; }
+		size_t getPoolBytes() const { return pool.size() * sizeof(uint16_t); }
+};
+
+#endif
@@ -0,0 +1,268 @@
+#ifndef ARPADICA_TRACE_H
+#define ARPADICA_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <cstdint>
+#include "memory_stats.hpp"
+
+#define TRACE_ERR "Arpadica::Trace::Error: "
+
+using namespace std;
+
+// Begin / end events for the Chrome trace event format, written as JSON that chrome://tracing and Perfetto open.
+//
+// Every thread records into its own buffer, a list of fixed size chunks only that thread appends to. Recording an
+// event is a timestamp and a store, the count is published with release so write() can read the buffers of
+// threads that are still running. The only lock is taken when a thread picks up its buffer and when it exits.
+// With tracing disabled a scope costs a relaxed load.
+//
+// A thread that exits hands its buffer back, events and all, and the next new thread appends to it. Short lived
+// threads then reuse a few buffers and tids instead of leaking a buffer each.
+//
+// Scopes have to close in the order they opened on each thread, like the viewers expect. Past MAX_EVENTS new scopes
+// are dropped as a whole, a 'B' is only recorded with room kept for its 'E', so no slice is left open.
+//
+// Event names must outlive the trace, use string literals.
+class Tracer
+{
+	public:
+		static constexpr size_t MAX_EVENTS = 1 << 22; // 96 MB of events at most, later scopes are dropped
+
+	private:
+		struct Event
+		{
+			const char *name;
+			uint64_t timestamp;  // microseconds since the trace started
+			char phase;          // 'B' or 'E'
+		};
+
+		static constexpr uint32_t CHUNK_EVENTS = 4096;
+
+		struct Chunk
+		{
+			Event events[CHUNK_EVENTS];
+			atomic<uint32_t> count{ 0 };
+			atomic<Chunk *> next{ nullptr };
+		};
+
+		struct ThreadBuffer
+		{
+			uint32_t id;
+			string name;            // guarded by buffersMutex
+			Chunk *first = nullptr;
+			Chunk *last = nullptr;  // owning thread only
+			uint32_t droppedOpen = 0; // dropped 'B' events still waiting for their 'E', owning thread only
+		};
+
+		// Gives the buffer of a thread back when the thread exits
+		struct BufferOwner
+		{
+			ThreadBuffer *buffer = nullptr;
+			~BufferOwner() { if(buffer != nullptr) Tracer::instance().release(buffer); }
+		};
+
+		atomic<bool> enabled{ false };
+		atomic<size_t> eventCount{ 0 };
+		atomic<size_t> dropped{ 0 };
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+		mutex buffersMutex;
+		vector<ThreadBuffer *> buffers;
+		vector<ThreadBuffer *> freeBuffers; // of exited threads, guarded by buffersMutex
+
+		ThreadBuffer& threadBuffer()
+		{
+			thread_local BufferOwner owner;
+			if(owner.buffer == nullptr)
+			{
+				MemoryScope memory(MEMORY_PROFILING);
+				lock_guard<mutex> lock(buffersMutex);
+
+				if(!freeBuffers.empty())
+				{
+					owner.buffer = freeBuffers.back();
+					owner.buffer->droppedOpen = 0;
+					freeBuffers.pop_back();
+				}
+				else
+				{
+					ThreadBuffer *buffer = new ThreadBuffer();
+					buffer->first = buffer->last = new Chunk();
+					buffer->id = (uint32_t)buffers.size() + 1;
+					buffers.push_back(buffer);
+					owner.buffer = buffer;
+				}
+			}
+			return *owner.buffer;
+		}
+
+		void release(ThreadBuffer *buffer)
+		{
+			lock_guard<mutex> lock(buffersMutex);
+			freeBuffers.push_back(buffer);
+		}
+
+		void record(const char *name, char phase)
+		{
+			ThreadBuffer& buffer = threadBuffer();
+
+			// A 'B' takes the room of its 'E' too, an 'E' is dropped only when its 'B' was
+			bool drop;
+			if(phase == 'B')
+			{
+				drop = eventCount.fetch_add(2, memory_order_relaxed) + 2 > MAX_EVENTS;
+				if(drop) buffer.droppedOpen++;
+			}
+			else
+			{
+				drop = buffer.droppedOpen > 0;
+				if(drop) buffer.droppedOpen--;
+			}
+
+			if(drop)
+			{
+				dropped.fetch_add(1, memory_order_relaxed);
+				return;
+			}
+
+			Chunk *chunk = buffer.last;
+
+			uint32_t count = chunk->count.load(memory_order_relaxed);
+			if(count == CHUNK_EVENTS)
+			{
+				MemoryScope memory(MEMORY_PROFILING);
+				Chunk *next = new Chunk();
+				chunk->next.store(next, memory_order_release);
+				buffer.last = chunk = next;
+				count = 0;
+			}
+
+			uint64_t timestamp = (uint64_t)chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+			chunk->events[count] = { name, timestamp, phase };
+			chunk->count.store(count + 1, memory_order_release);
+		}
+
+		static void writeEscaped(ofstream& out, const char *text)
+		{
+			for(; *text != '\0'; text++)
+			{
+				char c = *text;
+				if(c == '"' || c == '\\') out << '\\';
+				if((unsigned char)c >= 0x20) out << c;
+			}
+		}
+
+	public:
+		// Buffers are never freed, exited threads leave theirs for the next thread and the tracer lives for the
+		// whole program anyway.
+		static Tracer& instance()
+		{
+			static Tracer tracer;
+			return tracer;
+		}
+
+		void setEnabled(bool enable) { enabled.store(enable, memory_order_relaxed); }
+		bool isEnabled() const { return enabled.load(memory_order_relaxed); }
+
+		void begin(const char *name) { if(isEnabled()) record(name, 'B'); }
+		void end(const char *name) { if(isEnabled()) record(name, 'E'); }
+
+		// Shown instead of the thread id in the viewer. A reused buffer takes the name of its latest thread.
+		void setThreadName(const string& name)
+		{
+			ThreadBuffer& buffer = threadBuffer();
+			lock_guard<mutex> lock(buffersMutex);
+			buffer.name = name;
+		}
+
+		// Write everything recorded so far, threads may keep recording while this runs
+		bool write(const string& path)
+		{
+			ofstream out(path, ios::trunc);
+			if(!out)
+			{
+				cerr << TRACE_ERR << "Could not write trace: " << path << endl;
+				return false;
+			}
+
+			vector<ThreadBuffer *> snapshot;
+			vector<string> names;
+			{
+				lock_guard<mutex> lock(buffersMutex);
+				snapshot = buffers;
+				for(ThreadBuffer *buffer : buffers) names.push_back(buffer->name);
+			}
+
+			out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+			bool first = true;
+
+			for(size_t i = 0; i < snapshot.size(); i++)
+			{
+				uint32_t tid = snapshot[i]->id;
+
+				if(!names[i].empty())
+				{
+					out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid << ",\"args\":{\"name\":\"";
+					writeEscaped(out, names[i].c_str());
+					out << "\"}}";
+					first = false;
+				}
+
+				for(Chunk *chunk = snapshot[i]->first; chunk != nullptr; chunk = chunk->next.load(memory_order_acquire))
+				{
+					uint32_t count = chunk->count.load(memory_order_acquire);
+					for(uint32_t e = 0; e < count; e++)
+					{
+						const Event& event = chunk->events[e];
+						out << (first ? "" : ",\n") << "{\"name\":\"";
+						writeEscaped(out, event.name);
+						out << "\",\"ph\":\"" << event.phase << "\",\"ts\":" << event.timestamp << ",\"pid\":1,\"tid\":" << tid << "}";
+						first = false;
+					}
+				}
+			}
+
+			out << "\n]}\n";
+
+			size_t lost = dropped.load(memory_order_relaxed);
+			if(lost > 0) cerr << TRACE_ERR << lost << " events did not fit into the trace and were dropped" << endl;
+
+			return (bool)out;
+		}
+};
+
+// Begin event now, end event when the scope closes or at end(), whichever comes first
+class TraceScope
+{
+	private:
+		const char *name;
+		bool open = true;
+
+	public:
+		TraceScope(const char *event_name) : name(event_name) { Tracer::instance().begin(name); }
+		~TraceScope() { end(); }
+
+		void end()
+		{
+			if(!open) return;
+			open = false;
+			Tracer::instance().end(name);
+		}
+
+		TraceScope(const TraceScope&) = delete;
+		TraceScope& operator=(const TraceScope&) = delete;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+// Trace the enclosing scope under a string literal name
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+
+#endif
@@ -0,0 +1,278 @@
+// Headless MapEngine benchmark, never opens a window and needs no GPU.
+//
+//   arpadica_bench [options] map.geojson [more.geojson ...]
+//
+//   --map WxH        map resolution in pixels the states are projected to (default 16384x8192, like the game)
+//   --queries N      getStateAt over an N x N grid of map positions (default 256)
+//   --colors N       setStateColor calls (default 1000000)
+//   --overlay WxH    resolution of the software rasterized state index overlay (default 4096x2048)
+//   --border WxH     resolution of the border distance field, 0x0 skips it (default 2048x1024)
+//   --slowest N      features listed by triangulation time (default 5)
+//
+// Prints one JSON object per dataset and line (JSON Lines), so runs can be appended to a file and compared.
+// Peak RSS is the peak of the whole process so far, run one dataset per process for isolated numbers.
+
+#include "raylib.h"
+#include "map_engine.hpp"
+#include "rasterizer.hpp"
+#include "parallel.hpp"
+#include "json.hpp"
+#include "logger.hpp"
+#include <string>
+#include <vector>
+#include <chrono>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if !defined(_WIN32)
+	#include <sys/resource.h>
+#endif
+
+#define BENCH_ERR "Arpadica::Bench::Error: "
+
+using namespace std;
+using json = nlohmann::json;
+
+struct BenchOptions
+{
+	int mapWidth = 16384, mapHeight = 8192;
+	int queries = 256;
+	int colors = 1000000;
+	int overlayWidth = 4096, overlayHeight = 2048;
+	int borderWidth = 2048, borderHeight = 1024;
+	int slowest = 5;
+	vector<string> datasets;
+};
+
+static double seconds()
+{
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Peak resident set size of the process in kilobytes, 0 where unknown
+static long peakRssKb()
+{
+#if !defined(_WIN32)
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) == 0) return usage.ru_maxrss; // kilobytes on Linux
+#endif
+	return 0;
+}
+
+static bool parseSize(const char *text, int& w, int& h)
+{
+	return sscanf(text, "%dx%d", &w, &h) == 2 && w >= 0 && h >= 0;
+}
+
+static bool parseOptions(int argc, char **argv, BenchOptions& options)
+{
+	for(int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if(arg == "--map" && hasValue) { if(!parseSize(argv[++i], options.mapWidth, options.mapHeight)) return false; }
+		else if(arg == "--queries" && hasValue) options.queries = atoi(argv[++i]);
+		else if(arg == "--colors" && hasValue) options.colors = atoi(argv[++i]);
+		else if(arg == "--overlay" && hasValue) { if(!parseSize(argv[++i], options.overlayWidth, options.overlayHeight)) return false; }
+		else if(arg == "--border" && hasValue) { if(!parseSize(argv[++i], options.borderWidth, options.borderHeight)) return false; }
+		else if(arg == "--slowest" && hasValue) options.slowest = atoi(argv[++i]);
+		else if(arg.rfind("--", 0) == 0) return false;
+		else options.datasets.push_back(arg);
+	}
+
+	return !options.datasets.empty() && options.mapWidth > 0 && options.mapHeight > 0;
+}
+
+static json benchDataset(const string& path, const BenchOptions& options)
+{
+	json result;
+	result["dataset"] = path;
+
+	MapEngine mapEngine(options.mapWidth, options.mapHeight);
+
+	double start = seconds();
+	bool loaded = mapEngine.LoadMap(path);
+	double loadSeconds = seconds() - start;
+
+	if(!loaded)
+	{
+		result["error"] = "LoadMap failed";
+		return result;
+	}
+
+	const auto& states = mapEngine.getStates();
+	size_t polygons = 0, vertices = 0, triangles = 0;
+	for(const auto& state : states)
+	{
+		polygons += state.polygons.size();
+		for(const auto& polygon : state.polygons) vertices += polygon.size();
+		for(const auto& indices : state.polygon_indices) triangles += indices.size() / 3;
+	}
+
+	result["states"] = states.size();
+	result["polygons"] = polygons;
+	result["vertices"] = vertices;
+	result["triangles"] = triangles;
+	result["load_map_ms"] = loadSeconds * 1000.0;
+
+	// LoadMap's own phases, and the features that cost the most
+	const MapLoadReport& report = mapEngine.getLoadReport();
+	result["load_read_ms"] = report.readSeconds * 1000.0;
+	result["load_parse_ms"] = report.parseSeconds * 1000.0;
+	result["load_bounds_ms"] = report.boundsSeconds * 1000.0;
+	result["load_features_ms"] = report.featuresSeconds * 1000.0;
+	result["load_project_ms"] = report.projectSeconds * 1000.0;
+	result["load_triangulate_ms"] = report.triangulateSeconds * 1000.0;
+	result["load_polygon_bounds_ms"] = report.polygonBoundsSeconds * 1000.0;
+	result["load_columns_ms"] = report.columnsSeconds * 1000.0;
+
+	json slowest = json::array();
+	for(size_t i : report.slowest(options.slowest, [](const FeatureLoadCost& f) { return f.triangulateSeconds; }))
+	{
+		const FeatureLoadCost& f = report.features[i];
+		slowest.push_back({ { "id", f.id }, { "vertices", f.vertices }, { "rings", f.rings }, { "triangulate_ms", f.triangulateSeconds * 1000.0 } });
+	}
+	result["slowest_features"] = slowest;
+
+	// Triangulation again on its own, the same earcut call LoadMap makes per ring
+	start = seconds();
+	size_t checkTriangles = 0;
+	for(const auto& state : states)
+	{
+		for(const auto& polygon : state.polygons)
+		{
+			vector<vector<array<double, 2>>> rings(1);
+			rings[0].reserve(polygon.size());
+			for(const auto& p : polygon) rings[0].push_back({ (double)p.x, (double)p.y });
+
+			checkTriangles += mapbox::earcut<uint32_t>(rings).size() / 3;
+		}
+	}
+	double triangulateSeconds = seconds() - start;
+	result["triangulate_ms"] = triangulateSeconds * 1000.0;
+	result["triangles_per_s"] = triangulateSeconds > 0.0 ? checkTriangles / triangulateSeconds : 0.0;
+
+	start = seconds();
+	mapEngine.calculatePolygonBounds();
+	result["polygon_bounds_ms"] = (seconds() - start) * 1000.0;
+
+	// Dense query grid over the whole map, cell centers
+	if(options.queries > 0)
+	{
+		const int n = options.queries;
+		long hits = 0, stateHits = 0;
+
+		start = seconds();
+		for(int gy = 0; gy < n; gy++)
+		{
+			for(int gx = 0; gx < n; gx++)
+			{
+				int x = (int)((gx + 0.5) * options.mapWidth / n);
+				int y = (int)((gy + 0.5) * options.mapHeight / n);
+				hits += mapEngine.getStateIndexAt(x, y) >= 0;
+			}
+		}
+		double indexSeconds = seconds() - start;
+
+		// getStateAt copies the whole State on top of the lookup
+		start = seconds();
+		for(int gy = 0; gy < n; gy++)
+		{
+			for(int gx = 0; gx < n; gx++)
+			{
+				int x = (int)((gx + 0.5) * options.mapWidth / n);
+				int y = (int)((gy + 0.5) * options.mapHeight / n);
+				State state = mapEngine.getStateAt(x, y);
+				stateHits += !state.id.empty();
+			}
+		}
+		double stateSeconds = seconds() - start;
+
+		double count = (double)n * n;
+		result["state_queries"] = (long)count;
+		result["state_query_hits"] = hits;
+		if(stateHits != hits) result["error"] = "getStateAt and getStateIndexAt disagree";
+		result["get_state_index_at_us"] = indexSeconds / count * 1e6;
+		result["get_state_at_us"] = stateSeconds / count * 1e6;
+		result["queries_per_s"] = indexSeconds > 0.0 ? count / indexSeconds : 0.0;
+	}
+
+	// setStateColor storm, cycling through every state
+	if(options.colors > 0 && !states.empty())
+	{
+		start = seconds();
+		for(int i = 0; i < options.colors; i++)
+		{
+			Color color = { (unsigned char)i, (unsigned char)(i >> 8), (unsigned char)(i >> 16), 255 };
+			mapEngine.setStateColor(i % (int)states.size(), color);
+		}
+		double colorSeconds = seconds() - start;
+
+		result["set_state_color_ms"] = colorSeconds * 1000.0;
+		result["colors_per_s"] = colorSeconds > 0.0 ? options.colors / colorSeconds : 0.0;
+	}
+
+	// State index overlay through the software rasterizer, what the game builds on its background thread
+	if(options.overlayWidth > 0 && options.overlayHeight > 0)
+	{
+		const int bandRows = 64;
+		vector<uint32_t> band((size_t)options.overlayWidth * bandRows);
+
+		start = seconds();
+		SoftwareRasterizer rasterizer;
+		rasterizer.prepare(mapEngine, options.overlayWidth, options.overlayHeight);
+		for(int row = 0; row < options.overlayHeight; row += bandRows)
+		{
+			rasterizer.rasterizeIndices(row, min(row + bandRows, options.overlayHeight), band.data(), true);
+		}
+		double overlaySeconds = seconds() - start;
+
+		double megapixels = (double)options.overlayWidth * options.overlayHeight / 1e6;
+		result["overlay_ms"] = overlaySeconds * 1000.0;
+		result["overlay_mpix_per_s"] = overlaySeconds > 0.0 ? megapixels / overlaySeconds : 0.0;
+	}
+
+	if(options.borderWidth > 0 && options.borderHeight > 0)
+	{
+		start = seconds();
+		Image field = mapEngine.bakeBorderField(options.borderWidth, options.borderHeight, 8.0f);
+		result["border_field_ms"] = (seconds() - start) * 1000.0;
+		MemFree(field.data);
+	}
+
+	result["peak_rss_kb"] = peakRssKb();
+	return result;
+}
+
+int main(int argc, char **argv)
+{
+	// Only the results go to cout, LoadMap's progress and report would end up between them
+	Logger::instance().setLevel(LOGGER_WARNING);
+
+	BenchOptions options;
+	if(!parseOptions(argc, argv, options))
+	{
+		cerr << "Usage: arpadica_bench [--map WxH] [--queries N] [--colors N] [--overlay WxH] [--border WxH] [--slowest N] map.geojson..." << endl;
+		return 1;
+	}
+
+	bool failed = false;
+	for(const auto& dataset : options.datasets)
+	{
+		json result = benchDataset(dataset, options);
+		result["threads"] = workerCount();
+
+		if(result.contains("error"))
+		{
+			cerr << BENCH_ERR << dataset << ": " << result["error"].get<string>() << endl;
+			failed = true;
+		}
+
+		cout << result.dump() << endl;
+	}
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,128 @@
+// Height tile converter, writes the tiled 16 bit height file the terrain streamer reads (see src/terrain_streamer.hpp).
+//
+//   arpadica_heighttiles [options] heights
+//
+//   --raw WxH        heights is raw 16 bit little endian samples, W x H row by row (what most terrain tools export)
+//   --size X,Y,Z     world size of the terrain, must match the game's (default 200,0.75,100)
+//   --tile N         samples per tile side (default 256)
+//   --out PATH       output file (default assets/maps/heightmap.aht, where the game looks for it)
+//
+// Without --raw heights is loaded as an image like the base heightmap, the gray value is the average of the color
+// channels. Images only have 8 bits per channel here, so the detail a raw export brings is lost.
+
+#include "raylib.h"
+#include "terrain_streamer.hpp"
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+
+#define HEIGHTTILES_ERR "Arpadica::HeightTiles::Error: "
+
+using namespace std;
+
+struct HeightTilesOptions
+{
+	int rawWidth = 0, rawHeight = 0; // 0 = image input
+	Vector3 size = { 200.0f, 0.75f, 100.0f };
+	int tileSize = 256;
+	string out = "assets/maps/heightmap.aht";
+	string input;
+};
+
+static bool parseOptions(int argc, char **argv, HeightTilesOptions& options)
+{
+	for(int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if(arg.rfind("--", 0) != 0)
+		{
+			if(!options.input.empty()) return false;
+			options.input = arg;
+			continue;
+		}
+
+		if(i + 1 >= argc) return false;
+		const char *value = argv[++i];
+
+		if(arg == "--tile") options.tileSize = atoi(value);
+		else if(arg == "--out") options.out = value;
+		else if(arg == "--raw")
+		{
+			if(sscanf(value, "%dx%d", &options.rawWidth, &options.rawHeight) != 2) return false;
+		}
+		else if(arg == "--size")
+		{
+			if(sscanf(value, "%f,%f,%f", &options.size.x, &options.size.y, &options.size.z) != 3) return false;
+		}
+		else return false;
+	}
+
+	return !options.input.empty() && options.tileSize >= 2 && options.size.x > 0.0f && options.size.z > 0.0f &&
+		(options.rawWidth == 0 || (options.rawWidth >= 2 && options.rawHeight >= 2));
+}
+
+static bool loadRaw(const string& path, int width, int height, vector<uint16_t>& samples)
+{
+	ifstream file(path, ios::binary);
+	samples.resize((size_t)width * height);
+
+	vector<unsigned char> bytes(samples.size() * 2);
+	if(!file || !file.read((char *)bytes.data(), bytes.size()))
+	{
+		cerr << HEIGHTTILES_ERR << "Could not read " << width << "x" << height << " raw samples from " << path << endl;
+		return false;
+	}
+
+	for(size_t i = 0; i < samples.size(); i++) samples[i] = (uint16_t)(bytes[2 * i] | (bytes[2 * i + 1] << 8));
+	return true;
+}
+
+static bool loadImage(const string& path, int& width, int& height, vector<uint16_t>& samples)
+{
+	Image image = LoadImage(path.c_str());
+	if(image.data == NULL || image.width < 2 || image.height < 2)
+	{
+		cerr << HEIGHTTILES_ERR << "Could not load image: " << path << endl;
+		UnloadImage(image);
+		return false;
+	}
+
+	width = image.width;
+	height = image.height;
+	samples.resize((size_t)width * height);
+
+	// Same conversion as Heightfield::load, 255 -> 65535
+	Color *pixels = LoadImageColors(image);
+	for(size_t i = 0; i < samples.size(); i++) samples[i] = (uint16_t)((pixels[i].r + pixels[i].g + pixels[i].b) / 3 * 257);
+	UnloadImageColors(pixels);
+	UnloadImage(image);
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	HeightTilesOptions options;
+	if(!parseOptions(argc, argv, options))
+	{
+		cerr << "Usage: arpadica_heighttiles [--raw WxH] [--size X,Y,Z] [--tile N] [--out PATH] heights" << endl;
+		return 1;
+	}
+
+	SetTraceLogLevel(LOG_WARNING);
+
+	int width = options.rawWidth, height = options.rawHeight;
+	vector<uint16_t> samples;
+
+	bool loaded = width > 0 ? loadRaw(options.input, width, height, samples) : loadImage(options.input, width, height, samples);
+	if(!loaded) return 1;
+
+	if(!writeHeightTiles(options.out, samples.data(), width, height, options.size, options.tileSize)) return 1;
+
+	int tiles = ((width + options.tileSize - 1) / options.tileSize) * ((height + options.tileSize - 1) / options.tileSize);
+	cerr << "Wrote " << width << "x" << height << " samples as " << tiles << " tiles to " << options.out << endl;
+	return 0;
+}
@@ -0,0 +1,484 @@
+// Synthetic map generator, writes a Voronoi style GeoJSON FeatureCollection that LoadMap reads like a real one.
+//
+//   arpadica_mapgen [options]
+//
+//   --regions N       number of Voronoi cells, rounded to fill a grid (default 1500)
+//   --seed S          same seed and options give the same file, byte for byte (default 1)
+//   --density K       extra vertices along every border edge (default 4)
+//   --roughness R     how far those vertices wander off the straight edge, relative to its length (default 0.25)
+//   --holes P         chance a region gets a hole, filled by an enclave region of its own (default 0.02)
+//   --fragments P     chance a cell is handed to a region a few cells away, making it a MultiPolygon (default 0.05)
+//   --countries N     country_code groups, at most 676 (default 30)
+//   --bounds W,S,E,N  lon / lat extent (default -25,34,45,72, roughly Europe)
+//   --out PATH        output file (default stdout)
+//
+// Cells come from a jittered grid, so a cell only ever touches seeds a few grid steps away and generation stays
+// linear in the region count. Shared borders are subdivided from a hash of the two cells they separate, both
+// sides end up with the same vertices and the map has no gaps or overlaps.
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <iostream>
+#include <algorithm>
+
+#define MAPGEN_ERR "Arpadica::MapGen::Error: "
+
+using namespace std;
+
+// M_PI is not standard, MinGW only has it with _USE_MATH_DEFINES
+static constexpr double PI_D = 3.14159265358979323846;
+
+struct MapGenOptions
+{
+	int regions = 1500;
+	uint64_t seed = 1;
+	int density = 4;
+	double roughness = 0.25;
+	double holes = 0.02;
+	double fragments = 0.05;
+	int countries = 30;
+	double west = -25.0, south = 34.0, east = 45.0, north = 72.0;
+	string out;
+};
+
+struct Point
+{
+	double x, y;
+};
+
+// Ring vertex, edge is what the edge from this vertex to the next one borders: a neighbor cell or -1 for the map edge
+struct RingVertex
+{
+	Point p;
+	long edge;
+};
+
+static uint64_t splitmix(uint64_t x)
+{
+	x += 0x9E3779B97F4A7C15ull;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+	return x ^ (x >> 31);
+}
+
+// Stateless random numbers, every value is a hash of what it belongs to so nothing depends on generation order
+static uint64_t hashOf(uint64_t seed, uint64_t a, uint64_t b = 0, uint64_t c = 0)
+{
+	return splitmix(splitmix(splitmix(seed ^ a) ^ b) ^ c);
+}
+
+static double unitOf(uint64_t hash)
+{
+	return (hash >> 11) * (1.0 / 9007199254740992.0); // [0, 1)
+}
+
+enum HashSalt : uint64_t
+{
+	SALT_SEED_X = 1, SALT_SEED_Y, SALT_EDGE, SALT_HOLE, SALT_FRAGMENT, SALT_FRAGMENT_X, SALT_FRAGMENT_Y,
+	SALT_COUNTRY_X, SALT_COUNTRY_Y, SALT_MOUNTAIN, SALT_URBAN, SALT_COAST
+};
+
+class MapGenerator
+{
+	private:
+		const MapGenOptions& options;
+		int cols = 0, rows = 0;
+		double cellW = 0.0, cellH = 0.0;
+		vector<Point> seeds;
+
+		long cellIndex(int cx, int cy) const { return (long)cy * cols + cx; }
+
+		// Keep the side of the bisector between cell and other that faces the cell
+		static void clip(vector<RingVertex>& ring, Point cell, Point other, long otherIndex)
+		{
+			Point mid = { (cell.x + other.x) * 0.5, (cell.y + other.y) * 0.5 };
+			Point dir = { other.x - cell.x, other.y - cell.y };
+			auto side = [&](Point p) { return (p.x - mid.x) * dir.x + (p.y - mid.y) * dir.y; };
+
+			vector<RingVertex> result;
+			result.reserve(ring.size() + 1);
+
+			for(size_t i = 0; i < ring.size(); i++)
+			{
+				const RingVertex& a = ring[i];
+				const RingVertex& b = ring[(i + 1) % ring.size()];
+				double sa = side(a.p), sb = side(b.p);
+
+				if(sa <= 0.0) result.push_back(a);
+				if((sa <= 0.0) != (sb <= 0.0))
+				{
+					double t = sa / (sa - sb);
+					Point hit = { a.p.x + (b.p.x - a.p.x) * t, a.p.y + (b.p.y - a.p.y) * t };
+
+					// Leaving the half plane the new edge runs along the bisector, entering it continues the old edge
+					result.push_back({ hit, sa <= 0.0 ? otherIndex : a.edge });
+				}
+			}
+
+			ring.swap(result);
+		}
+
+		vector<RingVertex> voronoiCell(long index) const
+		{
+			int cx = (int)(index % cols), cy = (int)(index / cols);
+			Point s = seeds[index];
+
+			vector<RingVertex> ring = {
+				{ { options.west, options.south }, -1 }, { { options.east, options.south }, -1 },
+				{ { options.east, options.north }, -1 }, { { options.west, options.north }, -1 }
+			};
+
+			// A point of this cell is at most one grid cell diagonal from the seed of the grid cell it lies in,
+			// so seeds further than three grid steps never cut it
+			for(int dy = -3; dy <= 3; dy++)
+			{
+				for(int dx = -3; dx <= 3; dx++)
+				{
+					int nx = cx + dx, ny = cy + dy;
+					if((dx == 0 && dy == 0) || nx < 0 || ny < 0 || nx >= cols || ny >= rows) continue;
+
+					long other = cellIndex(nx, ny);
+					Point o = seeds[other];
+
+					// Skip bisectors that lie beyond every vertex
+					double half = 0.5 * hypot(o.x - s.x, o.y - s.y);
+					double reach = 0.0;
+					for(const auto& v : ring) reach = max(reach, hypot(v.p.x - s.x, v.p.y - s.y));
+					if(half >= reach) continue;
+
+					clip(ring, s, o, other);
+				}
+			}
+
+			// Clipping through a vertex leaves duplicates behind
+			vector<RingVertex> clean;
+			double epsilon = 1e-9 * (cellW + cellH);
+			for(const auto& v : ring)
+			{
+				if(!clean.empty() && fabs(v.p.x - clean.back().p.x) < epsilon && fabs(v.p.y - clean.back().p.y) < epsilon) continue;
+				clean.push_back(v);
+			}
+			while(clean.size() > 1 && fabs(clean.front().p.x - clean.back().p.x) < epsilon && fabs(clean.front().p.y - clean.back().p.y) < epsilon)
+			{
+				clean.pop_back();
+			}
+
+			return clean;
+		}
+
+		// Subdivide every border edge. The displacement is worked out from the lower cell index towards the higher
+		// one, so the cells on both sides produce the same points, only in opposite order.
+		vector<Point> roughen(long index, const vector<RingVertex>& ring) const
+		{
+			vector<Point> points;
+			points.reserve(ring.size() * (options.density + 1));
+
+			for(size_t i = 0; i < ring.size(); i++)
+			{
+				const RingVertex& v = ring[i];
+				Point a = v.p, b = ring[(i + 1) % ring.size()].p;
+				points.push_back(a);
+
+				if(v.edge < 0 || options.density <= 0) continue;
+
+				long low = min(index, v.edge), high = max(index, v.edge);
+				bool forward = index == low;
+				Point from = forward ? a : b, to = forward ? b : a;
+
+				Point dir = { to.x - from.x, to.y - from.y };
+				Point normal = { -dir.y, dir.x };
+
+				vector<Point> inner(options.density);
+				for(int k = 0; k < options.density; k++)
+				{
+					double t = (k + 1.0) / (options.density + 1.0);
+					double offset = (unitOf(hashOf(options.seed, SALT_EDGE, ((uint64_t)low << 32) ^ (uint64_t)high, k)) - 0.5);
+					offset *= options.roughness * sin(t * PI_D);
+
+					inner[k] = { from.x + dir.x * t + normal.x * offset, from.y + dir.y * t + normal.y * offset };
+				}
+
+				if(!forward) reverse(inner.begin(), inner.end());
+				points.insert(points.end(), inner.begin(), inner.end());
+			}
+
+			return points;
+		}
+
+		// Smooth noise in [0, 1) from a hashed lattice a few cells wide
+		double valueNoise(uint64_t salt, Point p) const
+		{
+			const double scale = 6.0;
+			double u = (p.x - options.west) / (options.east - options.west) * scale;
+			double v = (p.y - options.south) / (options.north - options.south) * scale;
+
+			int iu = (int)floor(u), iv = (int)floor(v);
+			double fu = u - iu, fv = v - iv;
+			fu = fu * fu * (3.0 - 2.0 * fu);
+			fv = fv * fv * (3.0 - 2.0 * fv);
+
+			auto corner = [&](int x, int y) { return unitOf(hashOf(options.seed, salt, (uint64_t)(uint32_t)x, (uint64_t)(uint32_t)y)); };
+			double top = corner(iu, iv) + (corner(iu + 1, iv) - corner(iu, iv)) * fu;
+			double bottom = corner(iu, iv + 1) + (corner(iu + 1, iv + 1) - corner(iu, iv + 1)) * fu;
+			return min(0.999999, max(0.0, top + (bottom - top) * fv));
+		}
+
+		string countryOf(Point p) const
+		{
+			int best = 0;
+			double bestDistance = INFINITY;
+			for(int k = 0; k < options.countries; k++)
+			{
+				Point c = {
+					options.west + (options.east - options.west) * unitOf(hashOf(options.seed, SALT_COUNTRY_X, k)),
+					options.south + (options.north - options.south) * unitOf(hashOf(options.seed, SALT_COUNTRY_Y, k))
+				};
+
+				double distance = (c.x - p.x) * (c.x - p.x) + (c.y - p.y) * (c.y - p.y);
+				if(distance < bestDistance)
+				{
+					bestDistance = distance;
+					best = k;
+				}
+			}
+
+			return string(1, (char)('A' + best / 26)) + (char)('A' + best % 26);
+		}
+
+		static void writeRing(FILE *out, const vector<Point>& ring, bool reversed)
+		{
+			fputc('[', out);
+			for(size_t i = 0; i <= ring.size(); i++)
+			{
+				// GeoJSON rings repeat their first point at the end
+				size_t at = i % ring.size();
+				if(reversed) at = (ring.size() - at) % ring.size();
+
+				fprintf(out, "%s[%.7f,%.7f]", i == 0 ? "" : ",", ring[at].x, ring[at].y);
+			}
+			fputc(']', out);
+		}
+
+		void writeFeature(FILE *out, bool& first, const string& id, const string& country, Point at,
+			const vector<vector<vector<Point>>>& polygons, const vector<vector<bool>>& reversed)
+		{
+			int mountain = 1 + (int)(valueNoise(SALT_MOUNTAIN, at) * 4.0);
+			int urban = 1 + (int)(valueNoise(SALT_URBAN, at) * 3.0);
+			int coast = 1 + (int)(valueNoise(SALT_COAST, at) * 3.0);
+
+			fprintf(out, "%s\n{\"type\":\"Feature\",\"properties\":{", first ? "" : ",");
+			fprintf(out, "\"region_id\":\"%s\",\"region_name\":\"Synthetic %s\",\"region_name_en\":\"Synthetic %s\",\"region_name_local\":\"Synthetic %s\",",
+				id.c_str(), id.c_str(), id.c_str(), id.c_str());
+			fprintf(out, "\"nuts_level\":\"3\",\"admin_level\":4,\"country_code\":\"%s\",\"mount_type\":%d,\"urban_type\":%d,\"coast_type\":%d},",
+				country.c_str(), mountain, urban, coast);
+
+			bool multi = polygons.size() > 1;
+			fprintf(out, "\"geometry\":{\"type\":\"%s\",\"coordinates\":", multi ? "MultiPolygon" : "Polygon");
+			if(multi) fputc('[', out);
+
+			for(size_t p = 0; p < polygons.size(); p++)
+			{
+				if(p > 0) fputc(',', out);
+				fputc('[', out);
+				for(size_t r = 0; r < polygons[p].size(); r++)
+				{
+					if(r > 0) fputc(',', out);
+					writeRing(out, polygons[p][r], reversed[p][r]);
+				}
+				fputc(']', out);
+			}
+
+			if(multi) fputc(']', out);
+			fputs("}}", out);
+			first = false;
+		}
+
+		static double distanceToSegment(Point p, Point a, Point b)
+		{
+			double dx = b.x - a.x, dy = b.y - a.y;
+			double lengthSq = dx * dx + dy * dy;
+			double t = lengthSq > 0.0 ? ((p.x - a.x) * dx + (p.y - a.y) * dy) / lengthSq : 0.0;
+			t = min(1.0, max(0.0, t));
+			return hypot(p.x - (a.x + dx * t), p.y - (a.y + dy * t));
+		}
+
+	public:
+		MapGenerator(const MapGenOptions& generator_options) : options(generator_options)
+		{
+			double width = options.east - options.west, height = options.north - options.south;
+
+			cols = max(1, (int)lround(sqrt(options.regions * width / height)));
+			rows = max(1, (int)lround((double)options.regions / cols));
+			cellW = width / cols;
+			cellH = height / rows;
+
+			seeds.resize((size_t)cols * rows);
+			for(int cy = 0; cy < rows; cy++)
+			{
+				for(int cx = 0; cx < cols; cx++)
+				{
+					long i = cellIndex(cx, cy);
+					seeds[i] = {
+						options.west + (cx + unitOf(hashOf(options.seed, SALT_SEED_X, i))) * cellW,
+						options.south + (cy + unitOf(hashOf(options.seed, SALT_SEED_Y, i))) * cellH
+					};
+				}
+			}
+		}
+
+		long getCellCount() const { return (long)seeds.size(); }
+
+		// Returns the number of features written
+		long write(FILE *out)
+		{
+			const long cells = getCellCount();
+
+			// Fragments, a cell handed to an unfragmented cell 2 to 5 grid steps away
+			vector<long> owner(cells);
+			auto fragmented = [&](long i) { return unitOf(hashOf(options.seed, SALT_FRAGMENT, i)) < options.fragments; };
+
+			for(long i = 0; i < cells; i++)
+			{
+				owner[i] = i;
+				if(!fragmented(i)) continue;
+
+				int cx = (int)(i % cols), cy = (int)(i / cols);
+				auto step = [&](uint64_t salt) {
+					double u = unitOf(hashOf(options.seed, salt, i));
+					int distance = 2 + (int)(u * 8.0) % 4;
+					return u < 0.5 ? -distance : distance;
+				};
+
+				int tx = min(cols - 1, max(0, cx + step(SALT_FRAGMENT_X)));
+				int ty = min(rows - 1, max(0, cy + step(SALT_FRAGMENT_Y)));
+				long target = cellIndex(tx, ty);
+				if(target != i && !fragmented(target)) owner[i] = target;
+			}
+
+			vector<vector<long>> members(cells);
+			for(long i = 0; i < cells; i++) members[owner[i]].push_back(i);
+
+			fputs("{\"type\":\"FeatureCollection\",\"features\":[", out);
+
+			bool first = true;
+			long features = 0;
+
+			for(long region = 0; region < cells; region++)
+			{
+				if(members[region].empty()) continue;
+
+				string country = countryOf(seeds[region]);
+				string id = country + to_string(region);
+
+				vector<vector<vector<Point>>> polygons;
+				vector<vector<bool>> reversed;
+				vector<Point> enclave;
+
+				for(long cell : members[region])
+				{
+					vector<Point> outer = roughen(cell, voronoiCell(cell));
+					if(outer.size() < 3) continue;
+
+					polygons.push_back({ outer });
+					reversed.push_back({ false }); // cells come out counter clockwise, the GeoJSON exterior order
+
+					// Hole around the seed, well inside the roughened border, clockwise as GeoJSON holes are
+					if(cell == region && unitOf(hashOf(options.seed, SALT_HOLE, cell)) < options.holes)
+					{
+						Point s = seeds[cell];
+						double inner = INFINITY;
+						for(size_t k = 0; k < outer.size(); k++) inner = min(inner, distanceToSegment(s, outer[k], outer[(k + 1) % outer.size()]));
+
+						int sides = 6 + options.density;
+						for(int k = 0; k < sides; k++)
+						{
+							double angle = 2.0 * PI_D * k / sides;
+							enclave.push_back({ s.x + cos(angle) * inner * 0.4, s.y + sin(angle) * inner * 0.4 });
+						}
+
+						polygons.back().push_back(enclave);
+						reversed.back().push_back(true);
+					}
+				}
+
+				if(polygons.empty()) continue;
+
+				writeFeature(out, first, id, country, seeds[region], polygons, reversed);
+				features++;
+
+				if(!enclave.empty())
+				{
+					writeFeature(out, first, id + "E", country, seeds[region], { { enclave } }, { { false } });
+					features++;
+				}
+			}
+
+			fputs("\n]}\n", out);
+			return features;
+		}
+};
+
+static bool parseOptions(int argc, char **argv, MapGenOptions& options)
+{
+	for(int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if(i + 1 >= argc) return false;
+		const char *value = argv[++i];
+
+		if(arg == "--regions") options.regions = atoi(value);
+		else if(arg == "--seed") options.seed = strtoull(value, nullptr, 10);
+		else if(arg == "--density") options.density = atoi(value);
+		else if(arg == "--roughness") options.roughness = atof(value);
+		else if(arg == "--holes") options.holes = atof(value);
+		else if(arg == "--fragments") options.fragments = atof(value);
+		else if(arg == "--countries") options.countries = atoi(value);
+		else if(arg == "--out") options.out = value;
+		else if(arg == "--bounds")
+		{
+			if(sscanf(value, "%lf,%lf,%lf,%lf", &options.west, &options.south, &options.east, &options.north) != 4) return false;
+		}
+		else return false;
+	}
+
+	return options.regions > 0 && options.density >= 0 && options.roughness >= 0.0 &&
+		options.countries >= 1 && options.countries <= 26 * 26 &&
+		options.east > options.west && options.north > options.south;
+}
+
+int main(int argc, char **argv)
+{
+	MapGenOptions options;
+	if(!parseOptions(argc, argv, options))
+	{
+		cerr << "Usage: arpadica_mapgen [--regions N] [--seed S] [--density K] [--roughness R] [--holes P] [--fragments P] "
+			"[--countries N] [--bounds W,S,E,N] [--out PATH]" << endl;
+		return 1;
+	}
+
+	FILE *out = options.out.empty() ? stdout : fopen(options.out.c_str(), "wb");
+	if(out == nullptr)
+	{
+		cerr << MAPGEN_ERR << "Could not write " << options.out << endl;
+		return 1;
+	}
+
+	MapGenerator generator(options);
+	long features = generator.write(out);
+
+	bool written = !ferror(out);
+	if(out != stdout) written = fclose(out) == 0 && written;
+
+	if(!written)
+	{
+		cerr << MAPGEN_ERR << "Writing the map failed" << endl;
+		return 1;
+	}
+
+	cerr << "Generated " << features << " regions from " << generator.getCellCount() << " cells" << endl;
+	return 0;
+}